@@ -0,0 +1,434 @@
+/*******************************************************************************
+MIT License
+
+Copyright (c) 2024 Julian Mitchell
+https://github.com/jupeos/fsm
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+
+/**
+ * @file fsm_bench.c
+ * @author Julian Mitchell
+ * @date 25th Jan 2024
+ * @brief Microbenchmarks of the state machine dispatch paths.
+ *
+ * @details Measures events per second and per-event latency percentiles for:
+ * - dispatch: one state machine, by dispatch mode (linear scan, lookup table, binary search, packed key scan, event
+ *   filter), API (single or batch), transitions per state (1, 8, 64, 512), callbacks (guard and action present or
+ *   absent) and hit rate.
+ * - instances: many instances (1 to 10^7) as state_machine_t arrays, compact populations and broadcasts.
+ *
+ * Latency is sampled per batch of events (BENCH_BATCH) as the clock is too coarse for single events. Results are
+ * printed as one JSON object per line for perf dashboards.
+ *
+ * Build and run (from the repository root):
+ * @code
+ *    cc -O2 -march=native -I. bench/fsm_bench.c -o fsm_bench
+ *    ./fsm_bench --min-time-ms 200 --max-instances 10000000 > bench_output.txt
+ * @endcode
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#define FSM_ENABLE_INDEXED_DISPATCH 1
+#define FSM_ENABLE_SORTED_DISPATCH  1
+#define FSM_ENABLE_PACKED_KEYS      1
+#define FSM_ENABLE_EVENT_FILTER     1
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "finite_state_machine.h"
+#include "finite_state_machine_broadcast.h"
+#include "finite_state_machine_population.h"
+
+#define BENCH_BATCH       256     /*< Events per latency sample.*/
+#define BENCH_EVENTS      4096    /*< Length of the pre-generated event stream.*/
+#define BENCH_MAX_SAMPLES 65536   /*< Latency samples kept per result.*/
+
+typedef enum
+{
+    DISPATCH_LINEAR,
+    DISPATCH_INDEXED,
+    DISPATCH_SORTED,
+    DISPATCH_PACKED,
+    DISPATCH_FILTERED,
+} DISPATCH_MODE;
+
+static const char* const dispatchNames[] = { "linear", "indexed", "sorted", "packed", "filtered" };
+
+typedef struct
+{
+    double samples[ BENCH_MAX_SAMPLES ]; /*< Nanoseconds per event, one per batch.*/
+    size_t numSamples;
+    size_t events;
+    double elapsedNs;
+} result_t;
+
+static double minTimeNs = 100e6;
+static size_t maxInstances = 10000000;
+static volatile uint32_t sink;
+static result_t result;
+
+static double now_ns( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ( ( double )ts.tv_sec * 1e9 ) + ( double )ts.tv_nsec;
+}
+
+static int compare_double( const void* a, const void* b )
+{
+    double x = *( const double* )a;
+    double y = *( const double* )b;
+    return ( x > y ) - ( x < y );
+}
+
+static void result_reset( void )
+{
+    result.numSamples = 0;
+    result.events = 0;
+    result.elapsedNs = 0;
+}
+
+static void result_add( double ns, size_t events )
+{
+    result.elapsedNs += ns;
+    result.events += events;
+    // Keep the most recent samples if the run is long.
+    result.samples[ result.numSamples % BENCH_MAX_SAMPLES ] = ns / ( double )events;
+    ++result.numSamples;
+}
+
+static double percentile( double p )
+{
+    size_t n = ( result.numSamples < BENCH_MAX_SAMPLES ) ? result.numSamples : BENCH_MAX_SAMPLES;
+    size_t i = ( size_t )( p * ( double )( n - 1 ) );
+    return n ? result.samples[ i ] : 0.0;
+}
+
+// Prints a result, *fields* are the JSON members describing the setup.
+static void result_print( const char* bench, const char* fields )
+{
+    size_t n = ( result.numSamples < BENCH_MAX_SAMPLES ) ? result.numSamples : BENCH_MAX_SAMPLES;
+    qsort( result.samples, n, sizeof( double ), compare_double );
+    printf( "{\"bench\":\"%s\",%s,\"events\":%zu,\"events_per_sec\":%.0f,"
+            "\"ns_p50\":%.2f,\"ns_p90\":%.2f,\"ns_p99\":%.2f,\"ns_p999\":%.2f}\n",
+            bench,
+            fields,
+            result.events,
+            ( double )result.events * 1e9 / result.elapsedNs,
+            percentile( 0.5 ),
+            percentile( 0.9 ),
+            percentile( 0.99 ),
+            percentile( 0.999 ) );
+    fflush( stdout );
+}
+
+// Callbacks that cost about as little as real ones can.
+static bool passGuard( data_t stateData, event_t* event )
+{
+    return ( stateData + event->data ) >= 0;
+}
+
+static void countAction( data_t stateData, event_t* event )
+{
+    sink += ( uint32_t )( stateData + event->ID );
+}
+
+/*******************************************************************************
+ * Single machine dispatch
+ ******************************************************************************/
+
+/**
+ * @brief Two states with *numTransitions* transitions each, for events 0 to numTransitions - 1, to each other.
+ * Events numTransitions to 2 * numTransitions - 1 are misses within the lookup table range.
+ */
+static void build_ping_pong( state_t* states, size_t numTransitions, DISPATCH_MODE mode, bool callbacks )
+{
+    for( size_t s = 0; s < 2; ++s )
+    {
+        state_t* state = &states[ s ];
+        memset( state, 0, sizeof( *state ) );
+        state->data = ( data_t )s;
+        state->transitions = ( transition_t* )calloc( numTransitions, sizeof( transition_t ) );
+        state->numTransitions = numTransitions;
+        for( size_t i = 0; i < numTransitions; ++i )
+        {
+            // Listed in descending order so sorting has work to do.
+            transition_t* transition = &state->transitions[ numTransitions - 1 - i ];
+            transition->eventID = ( event_id_t )i;
+            transition->nextState = &states[ 1 - s ];
+            transition->guard = callbacks ? passGuard : SM_NO_GUARD;
+            transition->action = callbacks ? countAction : SM_NO_ACTION;
+        }
+
+        if( mode == DISPATCH_INDEXED )
+        {
+            state->eventIndex = ( fsm_index_t* )calloc( 2 * numTransitions, sizeof( fsm_index_t ) );
+            state->eventIndexCapacity = 2 * numTransitions;
+            fsm_index_state( state );
+        }
+        else if( mode == DISPATCH_SORTED )
+        {
+            fsm_sort_transitions( state, NULL );
+        }
+        else if( mode == DISPATCH_PACKED )
+        {
+            state->keys = ( event_id_t* )calloc( numTransitions, sizeof( event_id_t ) );
+            fsm_pack_keys( state );
+        }
+        else if( mode == DISPATCH_FILTERED )
+        {
+            fsm_filter_state( state );
+        }
+    }
+}
+
+static void free_ping_pong( state_t* states )
+{
+    for( size_t s = 0; s < 2; ++s )
+    {
+        free( states[ s ].transitions );
+        free( states[ s ].eventIndex );
+        free( states[ s ].keys );
+    }
+}
+
+static void bench_dispatch( size_t numTransitions, DISPATCH_MODE mode, bool batch, bool callbacks, double hitRate )
+{
+    static event_t events[ BENCH_EVENTS ];
+    state_t states[ 2 ];
+    build_ping_pong( states, numTransitions, mode, callbacks );
+    state_machine_t fsm = { .currentState = &states[ 0 ] };
+
+    srand( 1 );
+    for( size_t i = 0; i < BENCH_EVENTS; ++i )
+    {
+        bool hit = ( ( double )rand() / RAND_MAX ) < hitRate;
+        events[ i ].ID = ( event_id_t )( ( hit ? 0 : numTransitions ) + ( ( size_t )rand() % numTransitions ) );
+        events[ i ].data = 0;
+    }
+
+    result_reset();
+    size_t next = 0;
+    while( result.elapsedNs < minTimeNs )
+    {
+        event_t* chunk = &events[ next ];
+        double start = now_ns();
+        if( batch )
+        {
+            sink += ( uint32_t )fsm_handle_events( &fsm, chunk, BENCH_BATCH );
+        }
+        else
+        {
+            for( size_t i = 0; i < BENCH_BATCH; ++i )
+            {
+                sink += fsm_handle_event( &fsm, &chunk[ i ] );
+            }
+        }
+        result_add( now_ns() - start, BENCH_BATCH );
+        next = ( next + BENCH_BATCH ) % BENCH_EVENTS;
+    }
+
+    char fields[ 256 ];
+    snprintf( fields,
+              sizeof( fields ),
+              "\"mode\":\"%s\",\"api\":\"%s\",\"transitions\":%zu,\"callbacks\":%s,\"hit_rate\":%.2f,\"instances\":1",
+              dispatchNames[ mode ],
+              batch ? "batch" : "single",
+              numTransitions,
+              callbacks ? "true" : "false",
+              hitRate );
+    result_print( "dispatch", fields );
+    free_ping_pong( states );
+}
+
+/*******************************************************************************
+ * Many instances
+ ******************************************************************************/
+
+#define RING_STATES 4
+
+static state_t ringStates[ RING_STATES ];
+static state_t* ringTable[ RING_STATES ];
+
+// A ring of states, event 0 moves to the next state, event 1 moves back.
+static void build_ring( void )
+{
+    static transition_t transitions[ RING_STATES ][ 2 ];
+    for( size_t s = 0; s < RING_STATES; ++s )
+    {
+        transitions[ s ][ 0 ] = ( transition_t ){ 0, &ringStates[ ( s + 1 ) % RING_STATES ], SM_NO_GUARD, SM_NO_ACTION };
+        transitions[ s ][ 1 ] = ( transition_t ){ 1, &ringStates[ ( s + RING_STATES - 1 ) % RING_STATES ], SM_NO_GUARD, SM_NO_ACTION };
+        ringStates[ s ] = ( state_t ){ SM_STATE_ACTIONS( ( data_t )s, SM_NO_ACTION, SM_NO_ACTION ), .transitions = transitions[ s ], .numTransitions = 2 };
+        ringTable[ s ] = &ringStates[ s ];
+    }
+}
+
+// Visits instances in a pseudo random order so large populations miss the cache as real traffic does.
+static inline size_t next_instance( uint64_t* seed, size_t count )
+{
+    *seed = ( *seed * 6364136223846793005ull ) + 1442695040888963407ull;
+    return ( size_t )( ( *seed >> 33 ) % count );
+}
+
+static void bench_instances( size_t count )
+{
+    char fields[ 128 ];
+    event_t tick = { .ID = 0, .data = 0 };
+    uint64_t seed = 1;
+
+    // One state_machine_t per instance.
+    state_machine_t* machines = ( state_machine_t* )malloc( count * sizeof( state_machine_t ) );
+    for( size_t i = 0; i < count; ++i )
+    {
+        machines[ i ].currentState = &ringStates[ 0 ];
+    }
+    result_reset();
+    while( result.elapsedNs < minTimeNs )
+    {
+        double start = now_ns();
+        for( size_t i = 0; i < BENCH_BATCH; ++i )
+        {
+            sink += fsm_handle_event( &machines[ next_instance( &seed, count ) ], &tick );
+        }
+        result_add( now_ns() - start, BENCH_BATCH );
+    }
+    snprintf( fields, sizeof( fields ), "\"mode\":\"state_machine_t\",\"api\":\"single\",\"instances\":%zu", count );
+    result_print( "instances", fields );
+
+    // A compact population, one instance at a time.
+    fsm_population_t population;
+    fsm_state_index_t* current = ( fsm_state_index_t* )malloc( count * sizeof( fsm_state_index_t ) );
+    fsm_population_init( &population, ringTable, RING_STATES, current, count, 0 );
+    result_reset();
+    while( result.elapsedNs < minTimeNs )
+    {
+        double start = now_ns();
+        for( size_t i = 0; i < BENCH_BATCH; ++i )
+        {
+            sink += fsm_population_handle_event( &population, next_instance( &seed, count ), &tick );
+        }
+        result_add( now_ns() - start, BENCH_BATCH );
+    }
+    snprintf( fields, sizeof( fields ), "\"mode\":\"population\",\"api\":\"single\",\"instances\":%zu", count );
+    result_print( "instances", fields );
+
+    // Broadcasting to every instance: per state machine_t, per state group and with the broadcast kernel.
+    result_reset();
+    while( result.elapsedNs < minTimeNs )
+    {
+        double start = now_ns();
+        for( size_t i = 0; i < count; ++i )
+        {
+            sink += fsm_handle_event( &machines[ i ], &tick );
+        }
+        result_add( now_ns() - start, count );
+    }
+    snprintf( fields, sizeof( fields ), "\"mode\":\"state_machine_t\",\"api\":\"broadcast\",\"instances\":%zu", count );
+    result_print( "instances", fields );
+
+    result_reset();
+    while( result.elapsedNs < minTimeNs )
+    {
+        double start = now_ns();
+        for( size_t s = 0; s < RING_STATES; ++s )
+        {
+            // Walk backwards so an instance moves at most once.
+            sink += ( uint32_t )fsm_population_apply( &population, ( fsm_state_index_t )( RING_STATES - 1 - s ), &tick );
+        }
+        result_add( now_ns() - start, count );
+    }
+    snprintf( fields, sizeof( fields ), "\"mode\":\"population_apply\",\"api\":\"broadcast\",\"instances\":%zu", count );
+    result_print( "instances", fields );
+
+    fsm_broadcast_t* broadcast = ( fsm_broadcast_t* )aligned_alloc( 64, sizeof( fsm_broadcast_t ) );
+    fsm_state_index_t next[ RING_STATES * 2 ];
+    uint8_t flags[ RING_STATES * 2 ];
+    fsm_broadcast_init( broadcast, &population, next, flags, 2 );
+    result_reset();
+    while( result.elapsedNs < minTimeNs )
+    {
+        double start = now_ns();
+        sink += ( uint32_t )fsm_broadcast_event( broadcast, &tick );
+        result_add( now_ns() - start, count );
+    }
+#if FSM_BROADCAST_AVX2
+    const char* kernel = "avx2";
+#elif FSM_BROADCAST_SSSE3
+    const char* kernel = "ssse3";
+#elif FSM_BROADCAST_NEON
+    const char* kernel = "neon";
+#else
+    const char* kernel = "scalar";
+#endif
+    snprintf( fields, sizeof( fields ), "\"mode\":\"broadcast_%s\",\"api\":\"broadcast\",\"instances\":%zu", kernel, count );
+    result_print( "instances", fields );
+
+    free( broadcast );
+    free( current );
+    free( machines );
+}
+
+int main( int argc, char** argv )
+{
+    for( int i = 1; i + 1 < argc; i += 2 )
+    {
+        if( !strcmp( argv[ i ], "--min-time-ms" ) )
+        {
+            minTimeNs = atof( argv[ i + 1 ] ) * 1e6;
+        }
+        else if( !strcmp( argv[ i ], "--max-instances" ) )
+        {
+            maxInstances = ( size_t )strtoull( argv[ i + 1 ], NULL, 10 );
+        }
+    }
+
+    static const size_t transitionCounts[] = { 1, 8, 64, 512 };
+    static const double hitRates[] = { 1.0, 0.5, 0.0 };
+    for( size_t t = 0; t < sizeof( transitionCounts ) / sizeof( transitionCounts[ 0 ] ); ++t )
+    {
+        for( int mode = DISPATCH_LINEAR; mode <= DISPATCH_FILTERED; ++mode )
+        {
+            for( size_t h = 0; h < sizeof( hitRates ) / sizeof( hitRates[ 0 ] ); ++h )
+            {
+                for( int callbacks = 0; callbacks < 2; ++callbacks )
+                {
+                    for( int batch = 0; batch < 2; ++batch )
+                    {
+                        bench_dispatch( transitionCounts[ t ], ( DISPATCH_MODE )mode, batch, callbacks, hitRates[ h ] );
+                    }
+                }
+            }
+        }
+    }
+
+    build_ring();
+    for( size_t count = 1; count <= maxInstances; count *= 10 )
+    {
+        bench_instances( count );
+    }
+    return 0;
+}
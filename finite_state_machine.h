@@ -27,9 +27,50 @@ SOFTWARE.
 #define FINITE_STATE_MACHINE_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
 
 #include "finite_state_machine_conf.h"
 
+#if FSM_ENABLE_STATS
+#include "finite_state_machine_stats.h"
+#endif
+
+#if FSM_ENABLE_TIMEOUTS
+#include "finite_state_machine_timer.h"
+#endif
+
+#if FSM_ENABLE_TRACE
+#include "finite_state_machine_trace.h"
+#endif
+
+#if FSM_ENABLE_ASYNC
+#include "finite_state_machine_port.h"
+#endif
+
+#if FSM_ENABLE_PACKED_KEYS
+#include "finite_state_machine_port.h"
+// States start on a cache line so the fields read by every dispatch share one.
+#define FSM_STATE_ALIGNMENT FSM_ALIGNAS( FSM_CACHE_LINE_SIZE )
+#else
+#define FSM_STATE_ALIGNMENT
+#endif
+
+// The widest vector compare of packed keys the target supports, selected at compile time.
+#if FSM_ENABLE_PACKED_KEYS && FSM_KEYS_SIMD && ( defined( __AVX2__ ) || defined( __SSE2__ ) || defined( _M_X64 ) )
+#include <immintrin.h>
+#if defined( __AVX512F__ )
+#define FSM_KEYS_AVX512 1
+#endif
+#if defined( __AVX2__ )
+#define FSM_KEYS_AVX2 1
+#endif
+#define FSM_KEYS_SSE2 1
+#elif FSM_ENABLE_PACKED_KEYS && FSM_KEYS_SIMD && defined( __ARM_NEON ) && defined( __aarch64__ )
+#include <arm_neon.h>
+#define FSM_KEYS_NEON 1
+#endif
+
 /**
  * @file finite_state_machine.h
  * @author Julian Mitchell
@@ -105,23 +146,59 @@ typedef struct
 {
     event_id_t eventID;                                   /*< The event that triggers this transition.*/
     state_t* nextState;                                   /*< The state to transition to.*/
-    bool ( *guard )( data_t stateData, event_t* event );  /*< A function that returns true if the transition should be allowed (optional).*/
-    void ( *action )( data_t stateData, event_t* event ); /*< A function to be executed on state transition (optional).*/
+    bool ( *guard )( FSM_CALLBACK_PARAMS );  /*< A function that returns true if the transition should be allowed (optional).*/
+    void ( *action )( FSM_CALLBACK_PARAMS ); /*< A function to be executed on state transition (optional).*/
 } transition_t;
 
 /**
  * @brief A state.
  *
  * @note Use the helper macro SM_STATE_ACTIONS  to eliminate the need to set *data* and entry/exit actions.
- * @note Use the helper macro SM_TRANSITIONS  to eliminate the need to set *numTransitions*.
+ * @note Use the helper macro SM_TRANSITIONS  to eliminate the need to set *numTransitions* (and the storage of
+ * enabled options that depends on the number of transitions).
+ * @note Use the helper macro SM_EVENT_INDEX to give the state an event lookup table (FSM_ENABLE_INDEXED_DISPATCH).
+ * @note Use the helper macro SM_TIMEOUT to raise an event after the state has been current for a time (FSM_ENABLE_TIMEOUTS).
+ * @note Set *parent* to nest the state in another (FSM_ENABLE_HIERARCHY), then call fsm_init_hierarchy().
+ * @note Call fsm_filter_state() to reject unhandled events quickly and find the state's default transition
+ * (FSM_ENABLE_EVENT_FILTER, see SM_DEFAULT_TRANSITION).
  */
 struct state
 {
-    data_t data;                                               /*< User defined data.*/
-    void ( *entryAction )( data_t stateData, event_t* event ); /*< The entry action (optional).*/
-    void ( *exitAction )( data_t stateData, event_t* event );  /*< The exit action (optional).*/
-    transition_t* transitions;                                 /*< An array of transition_t structs.*/
-    size_t numTransitions;                                     /*< The number of transitions.*/
+    FSM_STATE_ALIGNMENT data_t data;              /*< User defined data.*/
+    void ( *entryAction )( FSM_CALLBACK_PARAMS ); /*< The entry action (optional).*/
+    void ( *exitAction )( FSM_CALLBACK_PARAMS );  /*< The exit action (optional).*/
+    transition_t* transitions;                    /*< An array of transition_t structs.*/
+    size_t numTransitions;                        /*< The number of transitions.*/
+#if FSM_ENABLE_EVENT_FILTER
+    uint64_t eventFilter;     /*< A bit set for each event ID (modulo 64) no transition is for, set by fsm_filter_state() (0 = none).*/
+    size_t defaultTransition; /*< The default transition number + 1 (0 = none), set by fsm_filter_state().*/
+#endif
+#if FSM_ENABLE_PACKED_KEYS
+    event_id_t* keys; /*< The event ID of each transition, packed for scanning (set by SM_TRANSITIONS).*/
+    size_t numKeys;   /*< The number of keys in use, set by fsm_pack_keys() (0 = scan the transitions).*/
+#endif
+#if FSM_ENABLE_INDEXED_DISPATCH
+    fsm_index_t* eventIndex;   /*< Lookup table of transition number + 1 (0 = none) by event ID (optional, see SM_EVENT_INDEX).*/
+    size_t eventIndexCapacity; /*< The number of entries in eventIndex.*/
+    size_t eventIndexSize;     /*< The number of entries in use, set by fsm_index_state().*/
+#endif
+#if FSM_ENABLE_SORTED_DISPATCH
+    bool sortedTransitions; /*< The transitions are in event ID order, set by fsm_sort_transitions().*/
+#endif
+#if FSM_ENABLE_HIERARCHY
+    state_t* parent;                          /*< The enclosing state (optional, NULL for an outermost state).*/
+    state_t* path[ FSM_HIERARCHY_MAX_DEPTH ]; /*< The enclosing states from the outermost down to this one, set by fsm_init_hierarchy().*/
+    fsm_state_index_t depth;                  /*< The number of enclosing states, set by fsm_init_hierarchy().*/
+    fsm_state_index_t* lcaDepths;             /*< The enclosing states shared with the next state for each transition (set by SM_TRANSITIONS).*/
+#endif
+#if FSM_ENABLE_TIMEOUTS
+    uint32_t timeoutTicks;   /*< Ticks after entry until timeoutEvent is raised (0 = no timeout, see SM_TIMEOUT).*/
+    event_id_t timeoutEvent; /*< The event raised when the state times out.*/
+#endif
+#if FSM_ENABLE_STATS
+    fsm_state_stats_t* stats;                /*< Counters for each of FSM_STATS_MAX_THREADS slots (optional, set by SM_TRANSITIONS).*/
+    fsm_transition_stats_t* transitionStats; /*< Counters for each slot then each transition (optional, set by SM_TRANSITIONS).*/
+#endif
 };
 
 /**
@@ -131,80 +208,1465 @@ struct state
 typedef struct
 {
     state_t* currentState;
+#if FSM_ENABLE_CONTEXT
+    void* context; /*< User data passed to every guard and action, e.g. the session the state machine belongs to.*/
+#endif
+#if FSM_ENABLE_EVENT_QUEUE
+    event_t queue[ FSM_EVENT_QUEUE_SIZE ]; /*< Events posted while handling an event, a ring buffer.*/
+    size_t queueHead;                      /*< The position of the oldest queued event.*/
+    size_t queueCount;                     /*< The number of queued events.*/
+    bool busy;                             /*< An event is being handled.*/
+#endif
+#if FSM_ENABLE_ASYNC
+    state_t* asyncSource;          /*< The state owning the transition in flight.*/
+    transition_t* asyncTransition; /*< The transition whose action is in flight (NULL for none, see fsm_async_begin()).*/
+    bool asyncBegun;               /*< The action being performed called fsm_async_begin().*/
+#endif
+#if FSM_ENABLE_TIMEOUTS
+    fsm_timer_wheel_t* wheel; /*< The wheel timing the current state (optional, see fsm_timeout_start()).*/
+    fsm_timer_t timer;        /*< The current state's timeout.*/
+#endif
+#if FSM_ENABLE_TRACE
+    fsm_trace_ring_t* trace; /*< The state machine's own trace ring (optional, otherwise the thread's).*/
+#endif
 } state_machine_t;
 
+#if FSM_ENABLE_ASYNC
+// The state machine whose transition action the calling thread is performing, in whichever source file.
+#ifdef FSM_IMPLEMENTATION
+FSM_THREAD_LOCAL state_machine_t* fsmAsyncMachine = NULL;
+#else
+extern FSM_THREAD_LOCAL state_machine_t* fsmAsyncMachine;
+#endif
+#define FSM_ASYNC_PENDING( FSM ) ( ( FSM )->asyncTransition != NULL )
+#else
+#define FSM_ASYNC_PENDING( FSM ) false
+#endif
+
 // Helper macros
-#define SM_TRANSITIONS( ... )                         \
-    .transitions = ( transition_t[] ){ __VA_ARGS__ }, \
-    .numTransitions = sizeof( ( transition_t[] ){ __VA_ARGS__ } ) / sizeof( transition_t )
+#define SM_TRANSITIONS( ... )                                                                  \
+    .transitions = ( transition_t[] ){ __VA_ARGS__ },                                          \
+    .numTransitions = sizeof( ( transition_t[] ){ __VA_ARGS__ } ) / sizeof( transition_t )     \
+        SM_KEYS_STORAGE( sizeof( ( transition_t[] ){ __VA_ARGS__ } ) / sizeof( transition_t ) )      \
+        SM_HIERARCHY_STORAGE( sizeof( ( transition_t[] ){ __VA_ARGS__ } ) / sizeof( transition_t ) ) \
+        SM_STATS_STORAGE( sizeof( ( transition_t[] ){ __VA_ARGS__ } ) / sizeof( transition_t ) )
+
+#if FSM_ENABLE_PACKED_KEYS
+#define SM_KEYS_STORAGE( NUM_TRANSITIONS ) , .keys = ( event_id_t[ NUM_TRANSITIONS ] ){ 0 }
+#else
+#define SM_KEYS_STORAGE( NUM_TRANSITIONS )
+#endif
+
+#if FSM_ENABLE_HIERARCHY
+#define SM_HIERARCHY_STORAGE( NUM_TRANSITIONS ) , .lcaDepths = ( fsm_state_index_t[ NUM_TRANSITIONS ] ){ 0 }
+#else
+#define SM_HIERARCHY_STORAGE( NUM_TRANSITIONS )
+#endif
+
+#if FSM_ENABLE_STATS
+#define SM_STATS_STORAGE( NUM_TRANSITIONS )                                      \
+    , .stats = ( fsm_state_stats_t[ FSM_STATS_MAX_THREADS ] ){ { 0 } },          \
+    .transitionStats = ( fsm_transition_stats_t[ FSM_STATS_MAX_THREADS * ( NUM_TRANSITIONS ) ] ){ { 0 } }
+#else
+#define SM_STATS_STORAGE( NUM_TRANSITIONS )
+#endif
 
 #define SM_NO_ACTION NULL
 #define SM_NO_GUARD  NULL
 
 #define SM_STATE_ACTIONS( DATA, ENTRY, EXIT ) .data = DATA, .entryAction = ENTRY, .exitAction = EXIT
 
+#if FSM_ENABLE_INDEXED_DISPATCH
+// Reserves a lookup table covering event IDs 0 to SIZE - 1 (e.g. the number of values in an event enumeration).
+#define SM_EVENT_INDEX( SIZE ) .eventIndex = ( fsm_index_t[ SIZE ] ){ 0 }, .eventIndexCapacity = ( SIZE )
+#endif
+
+#if FSM_ENABLE_EVENT_FILTER
+// A transition taken for any event the state (and the states enclosing it) has no transition for, listed in
+// SM_TRANSITIONS.
+#define SM_DEFAULT_TRANSITION( NEXT_STATE, GUARD, ACTION ) { FSM_DEFAULT_EVENT, NEXT_STATE, GUARD, ACTION }
+// The bit of eventFilter for an event ID.
+#define FSM_EVENT_FILTER_BIT( EVENT_ID ) ( ( uint64_t )1 << ( ( size_t )( EVENT_ID ) & 63u ) )
+#endif
+
+#if FSM_ENABLE_TIMEOUTS
+// Raises EVENT when the state has been current for TICKS ticks of the state machine's timing wheel.
+#define SM_TIMEOUT( TICKS, EVENT ) .timeoutTicks = ( TICKS ), .timeoutEvent = ( EVENT )
+#endif
+
+#if FSM_ENABLE_EVENT_PAYLOAD
+// The payload of an event as a TYPE, NULL if the payload is smaller than a TYPE.
+#define FSM_EVENT_PAYLOAD( EVENT, TYPE ) \
+    ( ( ( EVENT )->payloadSize >= sizeof( TYPE ) ) ? ( const TYPE* )fsm_event_payload( EVENT ) : ( const TYPE* )NULL )
+
 /**
- * @brief State machine event handler.
+ * @brief Attach a payload to an event by reference, the payload is not copied.
  *
- * @param fsm The state machine instance.
- * @param event The event to process.
- * @return true A successful transistion to another state.
- * @return false No valid transition found or the guard condition failed.
+ * @note The payload must outlive every copy of the event, including events waiting in queues.
+ *
+ * @param event The event.
+ * @param payload The payload (for example a received buffer).
+ * @param size The size of the payload in bytes.
+ */
+static inline void fsm_event_set_payload( event_t* event, const void* payload, size_t size )
+{
+    event->payload = payload;
+    event->payloadSize = size;
+}
+
+#if FSM_EVENT_INLINE_SIZE
+/**
+ * @brief Copy a small payload into an event, it then travels with every copy of the event.
+ *
+ * @param event The event.
+ * @param payload The payload.
+ * @param size The size of the payload in bytes, at most FSM_EVENT_INLINE_SIZE.
+ * @return true The payload was copied.
+ * @return false The payload does not fit, the event is unchanged.
+ */
+static inline bool fsm_event_set_inline( event_t* event, const void* payload, size_t size )
+{
+    if( size > FSM_EVENT_INLINE_SIZE )
+    {
+        return false;
+    }
+    for( size_t i = 0; i < size; ++i )
+    {
+        event->inlinePayload.bytes[ i ] = ( ( const unsigned char* )payload )[ i ];
+    }
+    event->payload = NULL;
+    event->payloadSize = size;
+    return true;
+}
+#endif
+
+/**
+ * @brief Get the payload of an event.
+ *
+ * @param event The event.
+ * @return The payload, of *payloadSize* bytes, or NULL if there is none.
+ */
+static inline const void* fsm_event_payload( const event_t* event )
+{
+#if FSM_EVENT_INLINE_SIZE
+    // An inline payload is found from the event itself so it stays valid when the event is copied.
+    return ( event->payload || !event->payloadSize ) ? event->payload : ( const void* )event->inlinePayload.bytes;
+#else
+    return event->payload;
+#endif
+}
+#endif
+
+/**
+ * @brief Exchange two transitions of a state.
+ *
+ * @note Used when transitions are reordered at start up, not thread safe with respect to event handling.
+ *
+ * @param state The state that owns the transitions.
+ * @param a The index of the first transition.
+ * @param b The index of the second transition.
+ */
+static inline void fsm_swap_transitions( state_t* state, size_t a, size_t b )
+{
+    transition_t transition = state->transitions[ a ];
+    state->transitions[ a ] = state->transitions[ b ];
+    state->transitions[ b ] = transition;
+
+#if FSM_ENABLE_EVENT_FILTER
+    if( state->defaultTransition == ( a + 1 ) )
+    {
+        state->defaultTransition = b + 1;
+    }
+    else if( state->defaultTransition == ( b + 1 ) )
+    {
+        state->defaultTransition = a + 1;
+    }
+#endif
+
+#if FSM_ENABLE_PACKED_KEYS
+    if( state->numKeys )
+    {
+        state->keys[ a ] = state->transitions[ a ].eventID;
+        state->keys[ b ] = state->transitions[ b ].eventID;
+    }
+#endif
+
+#if FSM_ENABLE_HIERARCHY
+    if( state->lcaDepths )
+    {
+        fsm_state_index_t lcaDepth = state->lcaDepths[ a ];
+        state->lcaDepths[ a ] = state->lcaDepths[ b ];
+        state->lcaDepths[ b ] = lcaDepth;
+    }
+#endif
+
+#if FSM_ENABLE_STATS
+    // Counters follow their transitions.
+    for( size_t slot = 0; state->transitionStats && ( slot < FSM_STATS_MAX_THREADS ); ++slot )
+    {
+        fsm_transition_stats_t* x = &state->transitionStats[ ( slot * state->numTransitions ) + a ];
+        fsm_transition_stats_t* y = &state->transitionStats[ ( slot * state->numTransitions ) + b ];
+        uint64_t taken = fsm_stats_read( &x->taken );
+        uint64_t guardRejections = fsm_stats_read( &x->guardRejections );
+        uint64_t guardCycles = fsm_stats_read( &x->guardCycles );
+        uint64_t actionCycles = fsm_stats_read( &x->actionCycles );
+        fsm_atomic_store( &x->taken, fsm_stats_read( &y->taken ), memory_order_relaxed );
+        fsm_atomic_store( &x->guardRejections, fsm_stats_read( &y->guardRejections ), memory_order_relaxed );
+        fsm_atomic_store( &x->guardCycles, fsm_stats_read( &y->guardCycles ), memory_order_relaxed );
+        fsm_atomic_store( &x->actionCycles, fsm_stats_read( &y->actionCycles ), memory_order_relaxed );
+        fsm_atomic_store( &y->taken, taken, memory_order_relaxed );
+        fsm_atomic_store( &y->guardRejections, guardRejections, memory_order_relaxed );
+        fsm_atomic_store( &y->guardCycles, guardCycles, memory_order_relaxed );
+        fsm_atomic_store( &y->actionCycles, actionCycles, memory_order_relaxed );
+    }
+#endif
+}
+
+#if FSM_ENABLE_EVENT_FILTER
+/**
+ * @brief Build the event filter of a state from its transitions and find its default transition.
+ *
+ * @details Call once for each state before any events are handled. An event whose bit is set in the filter
+ * (event IDs are taken modulo 64, so IDs below 64 are filtered exactly) is rejected without searching the
+ * transitions. The first transition for FSM_DEFAULT_EVENT (see SM_DEFAULT_TRANSITION) becomes the default.
+ *
+ * @param state The state to filter.
+ * @return true The state has a default transition.
+ * @return false The state has no default transition.
+ */
+static inline bool fsm_filter_state( state_t* state )
+{
+    uint64_t accepted = 0;
+    state->defaultTransition = 0;
+    for( size_t i = 0; i < state->numTransitions; ++i )
+    {
+        event_id_t eventID = state->transitions[ i ].eventID;
+        if( eventID != FSM_DEFAULT_EVENT )
+        {
+            accepted |= FSM_EVENT_FILTER_BIT( eventID );
+        }
+        else if( !state->defaultTransition )
+        {
+            state->defaultTransition = i + 1;
+        }
+    }
+    state->eventFilter = ~accepted;
+    return state->defaultTransition != 0;
+}
+#endif
+
+#if FSM_ENABLE_INDEXED_DISPATCH
+/**
+ * @brief Build the event lookup table of a state from its transitions.
+ *
+ * @details Call once for each state declared with SM_EVENT_INDEX before any events are handled.
+ * Each event ID maps to the first transition listed for it, so first match semantics are unchanged.
+ * Events outside the table are still handled, by scanning the transitions. Until a state is indexed
+ * all of its events are handled by scanning.
+ *
+ * @param state The state to index.
+ * @return true The lookup table is in use.
+ * @return false The state has more transitions than fsm_index_t can number, the table is disabled.
  */
-static bool fsm_handle_event( state_machine_t* fsm, event_t* event )
+static inline bool fsm_index_state( state_t* state )
 {
     bool retVal = false;
-    // Start by looking for a transition with this event for the current state.
-    transition_t* transition = NULL;
-    for( size_t i = 0; i < fsm->currentState->numTransitions; ++i )
+    state->eventIndexSize = 0;
+    if( state->eventIndex )
     {
-        if( fsm->currentState->transitions[ i ].eventID == event->ID )
+        if( ( size_t )( fsm_index_t )state->numTransitions == state->numTransitions )
         {
-            // We found a match.
-            transition = &fsm->currentState->transitions[ i ];
-            break;
+            for( size_t i = 0; i < state->eventIndexCapacity; ++i )
+            {
+                state->eventIndex[ i ] = 0;
+            }
+
+            // Work backwards so the first transition for an event takes the slot.
+            for( size_t i = state->numTransitions; i-- > 0; )
+            {
+                size_t slot = ( size_t )state->transitions[ i ].eventID;
+                if( slot < state->eventIndexCapacity )
+                {
+                    state->eventIndex[ slot ] = ( fsm_index_t )( i + 1 );
+                }
+            }
+            state->eventIndexSize = state->eventIndexCapacity;
+            retVal = true;
+        }
+    }
+    return retVal;
+}
+#endif
+
+#if FSM_ENABLE_HIERARCHY
+/**
+ * @brief Get the enclosing states of a state by following the parent pointers.
+ *
+ * @param state The state.
+ * @param path Receives the enclosing states from the outermost down to the state itself, FSM_HIERARCHY_MAX_DEPTH entries.
+ * @return The number of entries in path or 0 if the state is nested too deeply (or the parents form a loop).
+ */
+static inline size_t fsm_state_ancestors( state_t* state, state_t** path )
+{
+    size_t count = 0;
+    for( state_t* s = state; s; s = s->parent )
+    {
+        if( count == FSM_HIERARCHY_MAX_DEPTH )
+        {
+            return 0;
+        }
+        ++count;
+    }
+
+    size_t i = count;
+    for( state_t* s = state; s; s = s->parent )
+    {
+        path[ --i ] = s;
+    }
+    return count;
+}
+
+/**
+ * @brief Precompute the exit and entry chains of a nested state's transitions.
+ *
+ * @details Call once for each state (nested or not) before any events are handled. Each transition exits
+ * from the current state up to, but not including, the least common ancestor of its source and next state
+ * then enters down to the next state, event handling walks the precomputed paths rather than the parents.
+ * A transition to the source itself or to one of its ancestors exits and re-enters that state.
+ *
+ * @param state The state to initialise.
+ * @return true The state was initialised.
+ * @return false The state or one of its next states is nested deeper than FSM_HIERARCHY_MAX_DEPTH.
+ */
+static inline bool fsm_init_hierarchy( state_t* state )
+{
+    size_t count = fsm_state_ancestors( state, state->path );
+    if( !count )
+    {
+        return false;
+    }
+    state->depth = ( fsm_state_index_t )( count - 1 );
+
+    for( size_t i = 0; state->lcaDepths && ( i < state->numTransitions ); ++i )
+    {
+        state_t* path[ FSM_HIERARCHY_MAX_DEPTH ];
+        size_t nextCount = fsm_state_ancestors( state->transitions[ i ].nextState, path );
+        if( !nextCount )
+        {
+            return false;
+        }
+
+        // The source and next state themselves are never shared, they are always exited and entered.
+        size_t shared = 0;
+        while( ( shared < ( count - 1 ) ) && ( shared < ( nextCount - 1 ) ) && ( state->path[ shared ] == path[ shared ] ) )
+        {
+            ++shared;
+        }
+        state->lcaDepths[ i ] = ( fsm_state_index_t )shared;
+    }
+    return true;
+}
+#endif
+
+/**
+ * @brief Check whether a transition can never be taken because of earlier transitions for the same event.
+ *
+ * @details Only the first transition listed for an event is ever considered. With FSM_ENABLE_GUARD_FALLTHROUGH
+ * the transitions that directly follow it for the same event are also considered, up to the first one
+ * without a guard.
+ *
+ * @param state The state that owns the transition.
+ * @param index The index of the transition.
+ * @return true The transition is shadowed.
+ */
+static inline bool fsm_transition_shadowed( const state_t* state, size_t index )
+{
+    const transition_t* transitions = state->transitions;
+    size_t first = 0;
+    while( transitions[ first ].eventID != transitions[ index ].eventID )
+    {
+        ++first;
+    }
+
+#if FSM_ENABLE_GUARD_FALLTHROUGH
+    for( size_t i = first; i < index; ++i )
+    {
+        if( ( transitions[ i ].eventID != transitions[ index ].eventID ) || !transitions[ i ].guard )
+        {
+            return true;
         }
     }
+    return false;
+#else
+    return first != index;
+#endif
+}
 
-    if( transition )
+#if FSM_ENABLE_SORTED_DISPATCH
+/**
+ * @brief Sort the transitions of a state by event ID so they can be binary searched.
+ *
+ * @details Call once for each state before any events are handled. The sort is stable, transitions
+ * sharing an event ID keep their relative order so first match semantics are unchanged. Transitions that
+ * can never be taken (see fsm_transition_shadowed()) are reported as duplicates. A state that is already
+ * indexed is re-indexed.
+ *
+ * @param state The state to sort.
+ * @param onDuplicate Called for each transition shadowed by earlier ones with the same event ID (optional).
+ * @return The number of duplicate transitions found.
+ */
+static inline size_t fsm_sort_transitions( state_t* state, void ( *onDuplicate )( const state_t* state, const transition_t* transition ) )
+{
+    size_t duplicates = 0;
+    // Insertion sort, stable and allocation free. Transition arrays are small and this runs once.
+    for( size_t i = 1; i < state->numTransitions; ++i )
     {
-        bool guardResult = true;
-        // If there is a guard function, call it.
-        if( transition->guard )
+        for( size_t j = i; ( j > 0 ) && ( state->transitions[ j ].eventID < state->transitions[ j - 1 ].eventID ); --j )
         {
-            guardResult = transition->guard( fsm->currentState->data, event );
+            fsm_swap_transitions( state, j, j - 1 );
         }
+    }
 
-        if( guardResult )
+    for( size_t i = 1; i < state->numTransitions; ++i )
+    {
+        if( fsm_transition_shadowed( state, i ) )
         {
-            // Perform the exit action (if there is one).
-            if( fsm->currentState->exitAction )
+            ++duplicates;
+            if( onDuplicate )
             {
-                fsm->currentState->exitAction( fsm->currentState->data, event );
+                onDuplicate( state, &state->transitions[ i ] );
             }
+        }
+    }
+    state->sortedTransitions = true;
+
+#if FSM_ENABLE_INDEXED_DISPATCH
+    if( state->eventIndexSize )
+    {
+        fsm_index_state( state );
+    }
+#endif
+    return duplicates;
+}
+#endif
+
+#if FSM_ENABLE_GUARD_FALLTHROUGH
+/**
+ * @brief Group the transitions of a state so those for the same event are contiguous.
+ *
+ * @details A failed guard only falls through to a transition directly after it, call once at start up for
+ * states that list alternatives for an event apart. Transitions for the same event keep their relative
+ * order (sorted states are already grouped). A state that is already indexed is re-indexed.
+ *
+ * @param state The state to group.
+ * @return The number of transitions moved.
+ */
+static inline size_t fsm_group_transitions( state_t* state )
+{
+    size_t moved = 0;
+    for( size_t i = 1; i < state->numTransitions; ++i )
+    {
+        // Find the last earlier transition for the same event and move this one up behind it.
+        size_t j = i;
+        while( ( j > 0 ) && ( state->transitions[ j - 1 ].eventID != state->transitions[ i ].eventID ) )
+        {
+            --j;
+        }
 
-            // Perform the associated action (if there is one).
-            if( transition->action )
+        if( ( j > 0 ) && ( j < i ) )
+        {
+            for( size_t k = i; k > j; --k )
             {
-                transition->action( fsm->currentState->data, event );
+                fsm_swap_transitions( state, k, k - 1 );
             }
+            ++moved;
+        }
+    }
 
-            // Move to the next state.
-            fsm->currentState = transition->nextState;            
+#if FSM_ENABLE_INDEXED_DISPATCH
+    if( state->eventIndexSize )
+    {
+        fsm_index_state( state );
+    }
+#endif
+    return moved;
+}
+#endif
 
-            // Perform the entry action (if there is one).
-            if( transition->nextState->entryAction )
+/**
+ * @brief Move the transitions of a state for an event, from a position on, up to that position.
+ *
+ * @param state The state.
+ * @param eventID The event.
+ * @param position Where the first of the event's transitions goes.
+ * @return The position after the event's transitions.
+ */
+static inline size_t fsm_raise_transitions( state_t* state, event_id_t eventID, size_t position )
+{
+    for( size_t i = position; i < state->numTransitions; ++i )
+    {
+        if( state->transitions[ i ].eventID == eventID )
+        {
+            // Adjacent swaps keep the order of the transitions passed over.
+            for( size_t k = i; k > position; --k )
             {
-                transition->nextState->entryAction( transition->nextState->data, event );
+                fsm_swap_transitions( state, k, k - 1 );
             }
+            ++position;
+        }
+    }
+    return position;
+}
 
-            fsm->currentState = transition->nextState;
-            retVal = true;
+/**
+ * @brief Reorder the transitions of a state so those for the given events come first, in the order given.
+ *
+ * @details Use to put the most frequent events first when transitions are scanned, for example with an order
+ * learned by fsm_profile_order(). Transitions for the same event keep their relative order and those for events
+ * not listed follow in their current order, so first match semantics are unchanged. A sorted state is no longer
+ * binary searched and a state that is already indexed is re-indexed.
+ *
+ * @param state The state to reorder.
+ * @param order The event IDs, with no repeats.
+ * @param count The number of event IDs.
+ * @return true The state was reordered.
+ * @return false With guard fall-through, transitions for an event are apart (see fsm_group_transitions()) and
+ * bringing them together would change which are taken. The state is unchanged.
+ */
+static inline bool fsm_reorder_transitions( state_t* state, const event_id_t* order, size_t count )
+{
+#if FSM_ENABLE_GUARD_FALLTHROUGH
+    for( size_t i = 1; i < state->numTransitions; ++i )
+    {
+        for( size_t j = 0; ( j + 1 < i ) && ( state->transitions[ i ].eventID != state->transitions[ i - 1 ].eventID ); ++j )
+        {
+            if( state->transitions[ j ].eventID == state->transitions[ i ].eventID )
+            {
+                return false;
+            }
         }
     }
-    return retVal;
+#endif
+
+    size_t position = 0;
+    for( size_t i = 0; i < count; ++i )
+    {
+        position = fsm_raise_transitions( state, order[ i ], position );
+    }
+
+#if FSM_ENABLE_SORTED_DISPATCH
+    state->sortedTransitions = false;
+#endif
+#if FSM_ENABLE_INDEXED_DISPATCH
+    if( state->eventIndexSize )
+    {
+        fsm_index_state( state );
+    }
+#endif
+    return true;
+}
+
+#if FSM_ENABLE_PACKED_KEYS
+/**
+ * @brief Copy the event IDs of a state's transitions into its packed key array.
+ *
+ * @details Call once for each state before any events are handled, and again if its transitions are changed other
+ * than through fsm_swap_transitions() (which sorting and grouping use). Events are then matched against the keys,
+ * 16 to a cache line with 32 bit event IDs, rather than against the 32 byte transitions two to a line.
+ *
+ * @param state The state to pack.
+ * @return true The state is packed.
+ * @return false The state has no key array (it was not defined with SM_TRANSITIONS).
+ */
+static inline bool fsm_pack_keys( state_t* state )
+{
+    if( !state->keys )
+    {
+        return false;
+    }
+
+    for( size_t i = 0; i < state->numTransitions; ++i )
+    {
+        state->keys[ i ] = state->transitions[ i ].eventID;
+    }
+    state->numKeys = state->numTransitions;
+    return true;
 }
 
+/**
+ * @brief Find the first transition for an event by scanning a state's packed keys.
+ *
+ * @details With FSM_KEYS_SIMD the keys are compared 16 (AVX-512), 8 (AVX2) or 4 (SSE2, NEON) at a time,
+ * whichever the compiler targets, and the remainder one at a time.
+ *
+ * @param state The state, packed.
+ * @param eventID The event ID.
+ * @return The transition or NULL if there is none.
+ */
+static inline transition_t* fsm_find_key( const state_t* state, event_id_t eventID )
+{
+    const event_id_t* keys = state->keys;
+    size_t numKeys = state->numKeys;
+#if FSM_ENABLE_SORTED_DISPATCH
+    if( state->sortedTransitions )
+    {
+        size_t low = 0;
+        size_t high = numKeys;
+        while( low < high )
+        {
+            size_t mid = low + ( ( high - low ) / 2 );
+            if( keys[ mid ] < eventID )
+            {
+                low = mid + 1;
+            }
+            else
+            {
+                high = mid;
+            }
+        }
+        return ( ( low < numKeys ) && ( keys[ low ] == eventID ) ) ? &state->transitions[ low ] : NULL;
+    }
+#endif
+    size_t i = 0;
+#if defined( FSM_KEYS_SSE2 ) || defined( FSM_KEYS_NEON )
+    // Compare a vector of keys at a time, the lowest matching lane is the first match.
+    if( ( sizeof( event_id_t ) == sizeof( int32_t ) ) && ( numKeys >= 4 ) )
+    {
+#if defined( FSM_KEYS_AVX512 )
+        __m512i needle16 = _mm512_set1_epi32( ( int32_t )eventID );
+        for( ; ( i + 16 ) <= numKeys; i += 16 )
+        {
+            __mmask16 mask = _mm512_cmpeq_epi32_mask( _mm512_loadu_si512( ( const void* )&keys[ i ] ), needle16 );
+            if( mask )
+            {
+                return &state->transitions[ i + fsm_first_set( mask ) ];
+            }
+        }
+#endif
+#if defined( FSM_KEYS_AVX2 )
+        __m256i needle8 = _mm256_set1_epi32( ( int32_t )eventID );
+        for( ; ( i + 8 ) <= numKeys; i += 8 )
+        {
+            __m256i match = _mm256_cmpeq_epi32( _mm256_loadu_si256( ( const __m256i* )&keys[ i ] ), needle8 );
+            unsigned mask = ( unsigned )_mm256_movemask_ps( _mm256_castsi256_ps( match ) );
+            if( mask )
+            {
+                return &state->transitions[ i + fsm_first_set( mask ) ];
+            }
+        }
+#endif
+#if defined( FSM_KEYS_SSE2 )
+        __m128i needle4 = _mm_set1_epi32( ( int32_t )eventID );
+        for( ; ( i + 4 ) <= numKeys; i += 4 )
+        {
+            __m128i match = _mm_cmpeq_epi32( _mm_loadu_si128( ( const __m128i* )&keys[ i ] ), needle4 );
+            unsigned mask = ( unsigned )_mm_movemask_ps( _mm_castsi128_ps( match ) );
+            if( mask )
+            {
+                return &state->transitions[ i + fsm_first_set( mask ) ];
+            }
+        }
+#else
+        int32x4_t needle4 = vdupq_n_s32( ( int32_t )eventID );
+        for( ; ( i + 4 ) <= numKeys; i += 4 )
+        {
+            // Narrow each 32 bit lane to 16 bits, giving a 64 bit mask with 16 bits per lane.
+            uint32x4_t match = vceqq_s32( vld1q_s32( ( const int32_t* )&keys[ i ] ), needle4 );
+            uint64_t mask = vget_lane_u64( vreinterpret_u64_u16( vmovn_u32( match ) ), 0 );
+            if( mask )
+            {
+                return &state->transitions[ i + ( fsm_first_set( mask ) / 16 ) ];
+            }
+        }
+#endif
+    }
+#endif
+    for( ; i < numKeys; ++i )
+    {
+        if( keys[ i ] == eventID )
+        {
+            return &state->transitions[ i ];
+        }
+    }
+    return NULL;
+}
+#endif
+
+/**
+ * @brief Find the transition for an event.
+ *
+ * @param state The state to search.
+ * @param eventID The event to look for.
+ * @return The first transition of the state for the event or NULL if there is none.
+ */
+static inline transition_t* fsm_find_transition( const state_t* state, event_id_t eventID )
+{
+#if FSM_ENABLE_EVENT_FILTER
+    // Most events a state ignores are rejected by the filter alone.
+    if( state->eventFilter & FSM_EVENT_FILTER_BIT( eventID ) )
+    {
+        return NULL;
+    }
+#endif
+#if FSM_ENABLE_INDEXED_DISPATCH
+    // Events covered by the lookup table are resolved without a search.
+    size_t slot = ( size_t )eventID;
+    if( slot < state->eventIndexSize )
+    {
+        fsm_index_t entry = state->eventIndex[ slot ];
+        return entry ? &state->transitions[ entry - 1 ] : NULL;
+    }
+#endif
+#if FSM_ENABLE_PACKED_KEYS
+    if( state->numKeys )
+    {
+        return fsm_find_key( state, eventID );
+    }
+#endif
+#if FSM_ENABLE_SORTED_DISPATCH
+    if( state->sortedTransitions )
+    {
+        // Find the first transition not ordered before the event (the first of any duplicates).
+        size_t low = 0;
+        size_t high = state->numTransitions;
+        while( low < high )
+        {
+            size_t mid = low + ( ( high - low ) / 2 );
+            if( state->transitions[ mid ].eventID < eventID )
+            {
+                low = mid + 1;
+            }
+            else
+            {
+                high = mid;
+            }
+        }
+        return ( ( low < state->numTransitions ) && ( state->transitions[ low ].eventID == eventID ) ) ? &state->transitions[ low ] : NULL;
+    }
+#endif
+    for( size_t i = 0; i < state->numTransitions; ++i )
+    {
+        if( state->transitions[ i ].eventID == eventID )
+        {
+            // We found a match.
+            return &state->transitions[ i ];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Find the transition a state takes for an event.
+ *
+ * @param state The state to search.
+ * @param eventID The event to look for.
+ * @return The first transition of the state for the event, otherwise with FSM_ENABLE_EVENT_FILTER its default
+ * transition, or NULL if there is neither.
+ */
+static inline transition_t* fsm_match_transition( const state_t* state, event_id_t eventID )
+{
+    transition_t* transition = fsm_find_transition( state, eventID );
+#if FSM_ENABLE_EVENT_FILTER
+    if( !transition && state->defaultTransition )
+    {
+        transition = &state->transitions[ state->defaultTransition - 1 ];
+    }
+#endif
+    return transition;
+}
+
+#if FSM_ENABLE_STATS
+/**
+ * @brief Get the calling thread's counters of a state.
+ *
+ * @param state The state.
+ * @return The counters or NULL if the state has none.
+ */
+static inline fsm_state_stats_t* fsm_stats_of_state( const state_t* state )
+{
+    return state->stats ? &state->stats[ fsm_stats_thread_slot() ] : NULL;
+}
+
+/**
+ * @brief Get the calling thread's counters of a transition.
+ *
+ * @param state The state that owns the transition.
+ * @param transition The transition.
+ * @return The counters or NULL if the state has none.
+ */
+static inline fsm_transition_stats_t* fsm_stats_of_transition( const state_t* state, const transition_t* transition )
+{
+    size_t index = ( fsm_stats_thread_slot() * state->numTransitions ) + ( size_t )( transition - state->transitions );
+    return state->transitionStats ? &state->transitionStats[ index ] : NULL;
+}
+
+/**
+ * @brief Count an event received by a state (the default FSM_HOOK_EVENT).
+ *
+ * @param state The state.
+ * @param unmatched The state has no transition for the event.
+ */
+static inline void fsm_stats_event( const state_t* state, bool unmatched )
+{
+    fsm_state_stats_t* stats = fsm_stats_of_state( state );
+    if( stats )
+    {
+        fsm_stats_add( unmatched ? &stats->unmatchedEvents : &stats->eventsReceived, 1 );
+    }
+}
+
+/**
+ * @brief Count a guard result (the default FSM_HOOK_GUARD_END).
+ *
+ * @param state The state that owns the transition.
+ * @param transition The transition.
+ * @param passed The guard result.
+ * @param cycles The cycles spent in the guard.
+ */
+static inline void fsm_stats_guard( const state_t* state, const transition_t* transition, bool passed, uint64_t cycles )
+{
+    fsm_state_stats_t* stats = fsm_stats_of_state( state );
+    fsm_transition_stats_t* transitionStats = fsm_stats_of_transition( state, transition );
+    if( stats )
+    {
+        fsm_stats_add( &stats->guardRejections, passed ? 0 : 1 );
+        fsm_stats_add( &stats->guardCycles, cycles );
+    }
+    if( transitionStats )
+    {
+        fsm_stats_add( &transitionStats->guardRejections, passed ? 0 : 1 );
+        fsm_stats_add( &transitionStats->guardCycles, cycles );
+    }
+}
+
+/**
+ * @brief Count a transition taken (the default FSM_HOOK_ACTIONS_END).
+ *
+ * @param state The state that owns the transition.
+ * @param transition The transition.
+ * @param cycles The cycles spent in the exit, transition and entry actions.
+ */
+static inline void fsm_stats_transition( const state_t* state, const transition_t* transition, uint64_t cycles )
+{
+    fsm_state_stats_t* stats = fsm_stats_of_state( state );
+    fsm_transition_stats_t* transitionStats = fsm_stats_of_transition( state, transition );
+    if( stats )
+    {
+        fsm_stats_add( &stats->transitionsTaken, 1 );
+        fsm_stats_add( &stats->actionCycles, cycles );
+    }
+    if( transitionStats )
+    {
+        fsm_stats_add( &transitionStats->taken, 1 );
+        fsm_stats_add( &transitionStats->actionCycles, cycles );
+    }
+}
+
+/**
+ * @brief Take a snapshot of the counters of a state, may be called while events are being handled.
+ *
+ * @param state The state.
+ * @param counters Receives the state's counters summed over all threads.
+ * @param transitionCounters Receives the counters of each transition, *numTransitions* entries (optional).
+ */
+static inline void fsm_stats_snapshot( const state_t* state, fsm_state_counters_t* counters, fsm_transition_counters_t* transitionCounters )
+{
+    fsm_state_counters_t total = { 0, 0, 0, 0, 0, 0 };
+    for( size_t slot = 0; state->stats && ( slot < FSM_STATS_MAX_THREADS ); ++slot )
+    {
+        const fsm_state_stats_t* stats = &state->stats[ slot ];
+        total.eventsReceived += fsm_stats_read( &stats->eventsReceived );
+        total.transitionsTaken += fsm_stats_read( &stats->transitionsTaken );
+        total.guardRejections += fsm_stats_read( &stats->guardRejections );
+        total.unmatchedEvents += fsm_stats_read( &stats->unmatchedEvents );
+        total.guardCycles += fsm_stats_read( &stats->guardCycles );
+        total.actionCycles += fsm_stats_read( &stats->actionCycles );
+    }
+    *counters = total;
+
+    for( size_t i = 0; transitionCounters && ( i < state->numTransitions ); ++i )
+    {
+        fsm_transition_counters_t transitionTotal = { 0, 0, 0, 0 };
+        for( size_t slot = 0; state->transitionStats && ( slot < FSM_STATS_MAX_THREADS ); ++slot )
+        {
+            const fsm_transition_stats_t* stats = &state->transitionStats[ ( slot * state->numTransitions ) + i ];
+            transitionTotal.taken += fsm_stats_read( &stats->taken );
+            transitionTotal.guardRejections += fsm_stats_read( &stats->guardRejections );
+            transitionTotal.guardCycles += fsm_stats_read( &stats->guardCycles );
+            transitionTotal.actionCycles += fsm_stats_read( &stats->actionCycles );
+        }
+        transitionCounters[ i ] = transitionTotal;
+    }
+}
+#endif
+
+// Instrumentation hooks, see finite_state_machine_conf.h.
+#ifndef FSM_HOOK_EVENT
+#if FSM_ENABLE_STATS
+#define FSM_HOOK_EVENT( STATE, EVENT ) fsm_stats_event( STATE, false )
+#else
+#define FSM_HOOK_EVENT( STATE, EVENT )
+#endif
+#endif
+
+#ifndef FSM_HOOK_UNMATCHED
+#if FSM_ENABLE_STATS
+#define FSM_HOOK_UNMATCHED( STATE, EVENT ) fsm_stats_event( STATE, true )
+#else
+#define FSM_HOOK_UNMATCHED( STATE, EVENT )
+#endif
+#endif
+
+#ifndef FSM_HOOK_GUARD_BEGIN
+#if FSM_ENABLE_STATS
+#define FSM_HOOK_GUARD_BEGIN( STATE, TRANSITION )       uint64_t fsmGuardStart = FSM_STATS_CLOCK()
+#define FSM_HOOK_GUARD_END( STATE, TRANSITION, PASSED ) fsm_stats_guard( STATE, TRANSITION, PASSED, FSM_STATS_CLOCK() - fsmGuardStart )
+#else
+#define FSM_HOOK_GUARD_BEGIN( STATE, TRANSITION )
+#define FSM_HOOK_GUARD_END( STATE, TRANSITION, PASSED )
+#endif
+#endif
+
+#ifndef FSM_HOOK_ACTIONS_BEGIN
+#if FSM_ENABLE_STATS
+#define FSM_HOOK_ACTIONS_BEGIN( STATE, TRANSITION ) uint64_t fsmActionsStart = FSM_STATS_CLOCK()
+#define FSM_HOOK_ACTIONS_END( STATE, TRANSITION )   fsm_stats_transition( STATE, TRANSITION, FSM_STATS_CLOCK() - fsmActionsStart )
+#else
+#define FSM_HOOK_ACTIONS_BEGIN( STATE, TRANSITION )
+#define FSM_HOOK_ACTIONS_END( STATE, TRANSITION )
+#endif
+#endif
+
+#if FSM_ENABLE_TRACE
+/**
+ * @brief Record a transition considered for an event (or an event with no transition) in the trace ring.
+ *
+ * @param fsm The state machine instance.
+ * @param state The state that owns the transition (the current state if there is none).
+ * @param transition The transition (optional).
+ * @param event The event.
+ * @param flags FSM_TRACE_GUARD, FSM_TRACE_PASSED and FSM_TRACE_TAKEN.
+ */
+static inline void fsm_trace( state_machine_t* fsm, const state_t* state, const transition_t* transition, const event_t* event, uint8_t flags )
+{
+    fsm_trace_ring_t* ring = fsm->trace ? fsm->trace : fsmTraceRing;
+    if( ring )
+    {
+        fsm_trace_record_t record;
+        record.timestamp = fsm_cycles();
+        record.instance = ( uint64_t )( uintptr_t )fsm;
+        record.source = ( int32_t )state->data;
+        record.eventID = ( int32_t )event->ID;
+        record.destination = ( int32_t )( ( flags & FSM_TRACE_TAKEN ) ? transition->nextState->data : state->data );
+        record.transition = transition ? ( uint16_t )( transition - state->transitions ) : ( uint16_t )FSM_TRACE_NO_TRANSITION;
+        record.flags = flags;
+        record.reserved = 0;
+        fsm_trace_write( ring, &record );
+    }
+}
+#endif
+
+/**
+ * @brief Complete a transition once its action has been performed: move to the next state, perform the entry
+ * actions and start its timeout.
+ *
+ * @param fsm The state machine instance.
+ * @param state The state that owns the transition.
+ * @param transition The transition.
+ * @param event The event passed to the entry actions.
+ */
+static inline void fsm_enter_next_state( state_machine_t* fsm, state_t* state, transition_t* transition, event_t* event )
+{
+    // Move to the next state.
+    fsm->currentState = transition->nextState;
+
+#if FSM_ENABLE_HIERARCHY
+    // Perform the entry actions from below the least common ancestor down to the next state.
+    state_t* next = transition->nextState;
+    size_t shared = state->lcaDepths ? state->lcaDepths[ transition - state->transitions ] : 0;
+    for( size_t i = shared; i <= next->depth; ++i )
+    {
+        state_t* entered = next->path[ i ] ? next->path[ i ] : next;
+        if( entered->entryAction )
+        {
+            FSM_INVOKE( entered->entryAction, fsm->context, entered->data, event );
+        }
+    }
+#else
+    ( void )state;
+    // Perform the entry action (if there is one).
+    if( transition->nextState->entryAction )
+    {
+        FSM_INVOKE( transition->nextState->entryAction, fsm->context, transition->nextState->data, event );
+    }
+#endif
+#if FSM_ENABLE_TIMEOUTS
+    // Entering the next state arms its timeout.
+    if( fsm->wheel && transition->nextState->timeoutTicks )
+    {
+        fsm_timer_arm( fsm->wheel, &fsm->timer, transition->nextState->timeoutTicks );
+    }
+#endif
+}
+
+/**
+ * @brief Take a transition out of the current state.
+ *
+ * @details The guard is evaluated and if it passes the exit, transition and entry actions are performed.
+ * With FSM_ENABLE_ASYNC a transition action that calls fsm_async_begin() leaves the transition in flight,
+ * it is completed by fsm_async_complete().
+ *
+ * @param fsm The state machine instance.
+ * @param state The state that owns the transition, the current state (or with FSM_ENABLE_HIERARCHY one of its
+ * enclosing states).
+ * @param transition A transition of the state.
+ * @param event The event being processed.
+ * @return true The state machine moved to (or with FSM_ENABLE_ASYNC is moving to) the transition's next state.
+ * @return false The guard condition failed.
+ */
+static inline bool fsm_take_transition( state_machine_t* fsm, state_t* state, transition_t* transition, event_t* event )
+{
+    bool retVal = false;
+    bool guardResult = true;
+    // If there is a guard function, call it.
+    if( transition->guard )
+    {
+        FSM_HOOK_GUARD_BEGIN( state, transition );
+        guardResult = FSM_INVOKE( transition->guard, fsm->context, state->data, event );
+        FSM_HOOK_GUARD_END( state, transition, guardResult );
+    }
+#if FSM_ENABLE_TRACE
+    fsm_trace( fsm, state, transition, event, ( uint8_t )( ( transition->guard ? FSM_TRACE_GUARD : 0 ) | ( guardResult ? ( FSM_TRACE_PASSED | FSM_TRACE_TAKEN ) : 0 ) ) );
+#endif
+
+    if( guardResult )
+    {
+        FSM_HOOK_ACTIONS_BEGIN( state, transition );
+#if FSM_ENABLE_TIMEOUTS
+        // Leaving the current state cancels its timeout.
+        if( fsm->wheel )
+        {
+            fsm_timer_cancel( fsm->wheel, &fsm->timer );
+        }
+#endif
+#if FSM_ENABLE_HIERARCHY
+        // Perform the exit actions from the current state up to the least common ancestor.
+        state_t* current = fsm->currentState;
+        size_t shared = state->lcaDepths ? state->lcaDepths[ transition - state->transitions ] : 0;
+        for( size_t i = ( size_t )current->depth + 1; i-- > shared; )
+        {
+            // A state not passed to fsm_init_hierarchy() has no path and only exits itself.
+            state_t* exited = current->path[ i ] ? current->path[ i ] : current;
+            if( exited->exitAction )
+            {
+                FSM_INVOKE( exited->exitAction, fsm->context, exited->data, event );
+            }
+        }
+#else
+        // Perform the exit action (if there is one).
+        if( state->exitAction )
+        {
+            FSM_INVOKE( state->exitAction, fsm->context, state->data, event );
+        }
+#endif
+
+        // Perform the associated action (if there is one).
+        if( transition->action )
+        {
+#if FSM_ENABLE_ASYNC
+            // Let the action find the state machine to begin an asynchronous action on.
+            state_machine_t* active = fsmAsyncMachine;
+            fsmAsyncMachine = fsm;
+            FSM_INVOKE( transition->action, fsm->context, state->data, event );
+            fsmAsyncMachine = active;
+#else
+            FSM_INVOKE( transition->action, fsm->context, state->data, event );
+#endif
+        }
+
+#if FSM_ENABLE_ASYNC
+        if( fsm->asyncBegun )
+        {
+            // The action is waiting for I/O, fsm_async_complete() performs the rest of the transition.
+            fsm->asyncBegun = false;
+            fsm->asyncSource = state;
+            fsm->asyncTransition = transition;
+        }
+        else
+#endif
+        {
+            fsm_enter_next_state( fsm, state, transition, event );
+        }
+        FSM_HOOK_ACTIONS_END( state, transition );
+        retVal = true;
+    }
+    return retVal;
+}
+
+/**
+ * @brief Handle an event in the current state.
+ *
+ * @details The common part of fsm_handle_event() and fsm_handle_events().
+ *
+ * @param fsm The state machine instance.
+ * @param state The current state of the state machine.
+ * @param event The event to process.
+ * @return true A successful transistion to another state.
+ * @return false No valid transition found or the guard condition failed.
+ */
+static inline bool fsm_dispatch( state_machine_t* fsm, state_t* state, event_t* event )
+{
+    bool retVal = false;
+    bool matched = false;
+    FSM_HOOK_EVENT( state, event );
+#if FSM_ENABLE_HIERARCHY
+    // Events the current state does not take are passed to the enclosing states in turn.
+    for( state_t* owner = state; owner && !retVal; owner = owner->parent )
+#else
+    state_t* owner = state;
+#endif
+    {
+        // Start by looking for a transition with this event for the current state.
+        transition_t* transition = fsm_find_transition( owner, event->ID );
+
+        if( transition )
+        {
+            matched = true;
+            retVal = fsm_take_transition( fsm, owner, transition, event );
+#if FSM_ENABLE_GUARD_FALLTHROUGH
+            // The guard failed, try the alternatives that follow for the same event.
+            const transition_t* end = &owner->transitions[ owner->numTransitions ];
+            while( !retVal && ( ++transition < end ) && ( transition->eventID == event->ID ) )
+            {
+                retVal = fsm_take_transition( fsm, owner, transition, event );
+            }
+#endif
+        }
+    }
+
+#if FSM_ENABLE_EVENT_FILTER
+    // Events no transition is for take the default transition of the innermost state that has one.
+#if FSM_ENABLE_HIERARCHY
+    for( state_t* owner = state; owner && !matched; owner = owner->parent )
+#else
+    if( !matched )
+#endif
+    {
+        if( owner->defaultTransition )
+        {
+            matched = true;
+            retVal = fsm_take_transition( fsm, owner, &owner->transitions[ owner->defaultTransition - 1 ], event );
+        }
+    }
+#endif
+
+    if( !matched )
+    {
+        FSM_HOOK_UNMATCHED( state, event );
+#if FSM_ENABLE_TRACE
+        fsm_trace( fsm, state, NULL, event, 0 );
+#endif
+    }
+    return retVal;
+}
+
+#if FSM_ENABLE_EVENT_QUEUE
+/**
+ * @brief Queue an event for a state machine that is handling an event.
+ *
+ * @param fsm The state machine instance.
+ * @param event The event, copied into the queue.
+ * @return true The event was queued.
+ * @return false The queue is full (see FSM_EVENT_QUEUE_SIZE), the event is dropped.
+ */
+static inline bool fsm_queue_event( state_machine_t* fsm, const event_t* event )
+{
+    if( fsm->queueCount == FSM_EVENT_QUEUE_SIZE )
+    {
+        return false;
+    }
+    fsm->queue[ ( fsm->queueHead + fsm->queueCount ) % FSM_EVENT_QUEUE_SIZE ] = *event;
+    ++fsm->queueCount;
+    return true;
+}
+
+/**
+ * @brief Handle the events queued by the event just handled, in the order they were posted.
+ *
+ * @param fsm The state machine instance.
+ * @return The number of queued events that caused a successful transition.
+ */
+static inline size_t fsm_drain_events( state_machine_t* fsm )
+{
+    size_t transitions = 0;
+    while( fsm->queueCount && !FSM_ASYNC_PENDING( fsm ) )
+    {
+        // Copy out first, handling the event may post more.
+        event_t event = fsm->queue[ fsm->queueHead ];
+        fsm->queueHead = ( fsm->queueHead + 1 ) % FSM_EVENT_QUEUE_SIZE;
+        --fsm->queueCount;
+        transitions += fsm_dispatch( fsm, fsm->currentState, &event ) ? 1 : 0;
+    }
+    return transitions;
+}
+#endif
+
+/**
+ * @brief State machine event handler.
+ *
+ * @note With FSM_ENABLE_EVENT_QUEUE a call from a guard or action of the same state machine queues the
+ * event (see fsm_post_event()) rather than handling it recursively, and returns false.
+ * @note With FSM_ENABLE_ASYNC an event arriving while a transition is in flight (see fsm_async_begin()) is
+ * queued with FSM_ENABLE_EVENT_QUEUE, otherwise it is rejected. Either way false is returned.
+ *
+ * @param fsm The state machine instance.
+ * @param event The event to process.
+ * @return true A successful transistion to another state.
+ * @return false No valid transition found or the guard condition failed.
+ */
+static inline bool fsm_handle_event( state_machine_t* fsm, event_t* event )
+{
+#if FSM_ENABLE_EVENT_QUEUE
+    if( fsm->busy )
+    {
+        fsm_queue_event( fsm, event );
+        return false;
+    }
+
+    fsm->busy = true;
+    bool retVal = fsm_dispatch( fsm, fsm->currentState, event );
+    // Run to completion, events posted by the transition are handled before returning.
+    fsm_drain_events( fsm );
+    // A transition in flight keeps the state machine busy, events are queued until it completes.
+    fsm->busy = FSM_ASYNC_PENDING( fsm );
+    return retVal;
+#else
+#if FSM_ENABLE_ASYNC
+    if( FSM_ASYNC_PENDING( fsm ) )
+    {
+        return false;
+    }
+#endif
+    return fsm_dispatch( fsm, fsm->currentState, event );
+#endif
+}
+
+/**
+ * @brief State machine batch event handler.
+ *
+ * @details Equivalent to calling fsm_handle_event() for each event in turn, but the current state is
+ * kept local to the loop rather than reloaded from the state machine for every event. Suited to draining
+ * queues and ring buffers straight into a state machine.
+ *
+ * @param fsm The state machine instance.
+ * @param events An array of events to process in order.
+ * @param count The number of events.
+ * @note With FSM_ENABLE_ASYNC the events after one that leaves a transition in flight are queued with
+ * FSM_ENABLE_EVENT_QUEUE, otherwise they are rejected.
+ *
+ * @return The number of events that caused a successful transition, all events are always consumed.
+ */
+static inline size_t fsm_handle_events( state_machine_t* fsm, event_t* events, size_t count )
+{
+    size_t transitions = 0;
+#if FSM_ENABLE_EVENT_QUEUE
+    if( fsm->busy )
+    {
+        for( size_t i = 0; i < count; ++i )
+        {
+            fsm_queue_event( fsm, &events[ i ] );
+        }
+        return 0;
+    }
+    fsm->busy = true;
+#endif
+    state_t* state = fsm->currentState;
+    size_t i = 0;
+    while( i < count && !FSM_ASYNC_PENDING( fsm ) )
+    {
+        if( fsm_dispatch( fsm, state, &events[ i++ ] ) )
+        {
+            state = fsm->currentState;
+            ++transitions;
+        }
+#if FSM_ENABLE_EVENT_QUEUE
+        // Posted events run to completion before the next event of the batch.
+        if( fsm->queueCount )
+        {
+            fsm_drain_events( fsm );
+            state = fsm->currentState;
+        }
+#endif
+    }
+#if FSM_ENABLE_EVENT_QUEUE
+    // The rest of the batch waits for a transition in flight to complete.
+    while( i < count )
+    {
+        fsm_queue_event( fsm, &events[ i++ ] );
+    }
+    fsm->busy = FSM_ASYNC_PENDING( fsm );
+#endif
+    return transitions;
+}
+
+#if FSM_ENABLE_EVENT_QUEUE
+/**
+ * @brief Post an event to a state machine, typically from one of its own guards or actions.
+ *
+ * @details Events posted while the state machine is handling an event are queued and handled in the
+ * order posted once the current transition has completed (including its entry action), without recursion
+ * or allocation. An event posted to an idle state machine is handled straight away. Not thread safe, a
+ * state machine must only be used by one thread at a time.
+ *
+ * @param fsm The state machine instance.
+ * @param event The event, copied if it is queued.
+ * @return true The event was queued or handled.
+ * @return false The queue is full (see FSM_EVENT_QUEUE_SIZE), the event is dropped.
+ */
+static inline bool fsm_post_event( state_machine_t* fsm, const event_t* event )
+{
+    if( fsm->busy )
+    {
+        return fsm_queue_event( fsm, event );
+    }
+
+    event_t copy = *event;
+    fsm_handle_event( fsm, &copy );
+    return true;
+}
+#endif
+
+#if FSM_ENABLE_ASYNC
+/**
+ * @brief Begin an asynchronous transition action, e.g. one waiting for a database or network reply.
+ *
+ * @details Called from a transition action. Once the action returns the state machine stays in a transitioning
+ * state: the exit actions have been performed but the next state has not been entered. The thread is free to
+ * drive other state machines meanwhile. When the I/O completes call fsm_async_complete() with the handle and
+ * the result to enter the next state.
+ *
+ * @return The handle to complete the transition with, the state machine performing the action (NULL when not
+ * called from a transition action).
+ */
+static inline state_machine_t* fsm_async_begin( void )
+{
+    state_machine_t* fsm = fsmAsyncMachine;
+    if( fsm )
+    {
+        fsm->asyncBegun = true;
+    }
+    return fsm;
+}
+
+/**
+ * @brief Check for a transition in flight.
+ *
+ * @param fsm The state machine instance.
+ * @return true A transition action has begun (see fsm_async_begin()) and not yet completed.
+ * @return false The state machine is in its current state.
+ */
+static inline bool fsm_async_pending( const state_machine_t* fsm )
+{
+    return FSM_ASYNC_PENDING( fsm );
+}
+
+/**
+ * @brief Complete the transition in flight: move to the next state, perform the entry actions and then handle
+ * the events queued meanwhile.
+ *
+ * @note Called from the thread driving the state machine, like fsm_handle_event(). Calling it from the action
+ * itself (the I/O completed straight away) completes the transition synchronously, with the original event.
+ *
+ * @param fsm The handle returned by fsm_async_begin().
+ * @param event The result of the action, passed to the entry actions.
+ * @return true The transition was completed.
+ * @return false There is no transition in flight.
+ */
+static inline bool fsm_async_complete( state_machine_t* fsm, event_t* event )
+{
+    if( fsm->asyncBegun )
+    {
+        fsm->asyncBegun = false;
+        return true;
+    }
+    if( !fsm->asyncTransition )
+    {
+        return false;
+    }
+
+    state_t* state = fsm->asyncSource;
+    transition_t* transition = fsm->asyncTransition;
+    fsm->asyncSource = NULL;
+    fsm->asyncTransition = NULL;
+    fsm_enter_next_state( fsm, state, transition, event );
+#if FSM_ENABLE_EVENT_QUEUE
+    // The events that arrived meanwhile run to completion, unless one begins another asynchronous action.
+    fsm_drain_events( fsm );
+    fsm->busy = FSM_ASYNC_PENDING( fsm );
+#endif
+    return true;
+}
+#endif
+
+#if FSM_ENABLE_TIMEOUTS
+/**
+ * @brief Time the states of a state machine with a timing wheel.
+ *
+ * @details From now on each state entered with a timeout (see SM_TIMEOUT) arms the state machine's timer
+ * and leaving the state cancels it, both O(1). The current state's timeout is armed straight away.
+ *
+ * @param fsm The state machine instance.
+ * @param wheel The wheel, shared by any number of state machines and advanced by fsm_timeout_tick().
+ */
+static inline void fsm_timeout_start( state_machine_t* fsm, fsm_timer_wheel_t* wheel )
+{
+    fsm->wheel = wheel;
+    if( fsm->currentState->timeoutTicks )
+    {
+        fsm_timer_arm( wheel, &fsm->timer, fsm->currentState->timeoutTicks );
+    }
+}
+
+/**
+ * @brief Stop timing the states of a state machine, cancelling any pending timeout.
+ *
+ * @param fsm The state machine instance.
+ */
+static inline void fsm_timeout_stop( state_machine_t* fsm )
+{
+    if( fsm->wheel )
+    {
+        fsm_timer_cancel( fsm->wheel, &fsm->timer );
+        fsm->wheel = NULL;
+    }
+}
+
+/**
+ * @brief Advance a timing wheel by one tick and deliver the timeouts that are due.
+ *
+ * @details Each state machine whose current state timed out is given that state's timeoutEvent (with
+ * zero data) through fsm_handle_events(). Timeouts armed or cancelled by the transitions taken are
+ * honoured within the same tick. Must be called by the thread that handles these state machines' events.
+ *
+ * @param wheel The wheel.
+ * @return The number of timeouts that caused a successful transition.
+ */
+static inline size_t fsm_timeout_tick( fsm_timer_wheel_t* wheel )
+{
+    size_t transitions = 0;
+    fsm_timer_advance( wheel );
+    for( fsm_timer_t* timer = fsm_timer_pop_expired( wheel ); timer; timer = fsm_timer_pop_expired( wheel ) )
+    {
+        state_machine_t* fsm = ( state_machine_t* )( ( char* )timer - offsetof( state_machine_t, timer ) );
+        event_t event;
+        memset( &event, 0, sizeof( event ) );
+        event.ID = fsm->currentState->timeoutEvent;
+        transitions += fsm_handle_events( fsm, &event, 1 );
+    }
+    return transitions;
+}
+#endif
+
 #ifdef __cplusplus
 }
 #endif
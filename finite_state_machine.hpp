@@ -0,0 +1,344 @@
+/*******************************************************************************
+MIT License
+
+Copyright (c) 2024 Julian Mitchell
+https://github.com/jupeos/fsm
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+
+#ifndef FINITE_STATE_MACHINE_HPP
+#define FINITE_STATE_MACHINE_HPP
+
+#include <cstddef>
+#include <type_traits>
+
+#include "finite_state_machine_conf.h"
+
+/**
+ * @file finite_state_machine.hpp
+ * @author Julian Mitchell
+ * @date 25th Jan 2024
+ * @brief A compile-time finite state machine for C++17.
+ *
+ * @details The state graph is described entirely by template parameters so the event handler is generated
+ * by the compiler as a chain of comparisons (which optimisers typically turn into a jump table) with every
+ * guard and action called directly, allowing them to be inlined. No function pointers are stored.
+ *
+ * The semantics match fsm_handle_event() in finite_state_machine.h: the first transition listed for the
+ * current state and event is taken if its guard passes (with FSM_ENABLE_GUARD_FALLTHROUGH a failed guard tries
+ * the current state's next transition if it is for the same event, as in fsm_dispatch()), performing the exit
+ * action of the current state, the transition action then the entry action of the next state. States are
+ * identified by their data_t value and
+ * guards and actions have the same signatures as in C, using event_t and data_t from
+ * finite_state_machine_conf.h, so C and C++ translation units can share callbacks and definitions. With
+ * FSM_ENABLE_CONTEXT they also receive the context the machine was constructed with.
+ * Guards and actions may be functions (including C functions) or, from C++20, captureless lambdas.
+ *
+ * Example usage:
+ * @code
+ *    #include "finite_state_machine.hpp"
+ *
+ *    enum STATE_ID : data_t { STATE_OPEN, STATE_CLOSED };
+ *    enum EVENT_ID : event_id_t { EVENT_OPEN, EVENT_CLOSE };
+ *
+ *    void doorOpenedAction( data_t stateID, event_t* event );
+ *    void doorClosedAction( data_t stateID, event_t* event );
+ *
+ *    using door_t = fsm::machine<
+ *        fsm::states< fsm::state< STATE_OPEN >, fsm::state< STATE_CLOSED > >,
+ *        fsm::transitions< fsm::transition< STATE_OPEN, EVENT_CLOSE, STATE_CLOSED, nullptr, doorClosedAction >,
+ *                          fsm::transition< STATE_CLOSED, EVENT_OPEN, STATE_OPEN, nullptr, doorOpenedAction > > >;
+ *
+ *    door_t door( STATE_CLOSED );
+ *
+ *    void openFunc( void )
+ *    {
+ *        event_t event = { EVENT_OPEN, 0 };
+ *        door.handle_event( event );
+ *    }
+ * @endcode
+ */
+
+static_assert( __cplusplus >= 201703L, "finite_state_machine.hpp requires C++17" );
+
+namespace fsm
+{
+
+/**
+ * @brief A state.
+ *
+ * @tparam ID The state's data, identifying it.
+ * @tparam Entry The entry action (optional).
+ * @tparam Exit The exit action (optional).
+ */
+template< data_t ID, auto Entry = nullptr, auto Exit = nullptr >
+struct state
+{
+    static constexpr data_t id = ID;
+    static constexpr auto entry = Entry;
+    static constexpr auto exit = Exit;
+};
+
+/**
+ * @brief A state transition.
+ *
+ * @tparam Source The state the transition leaves.
+ * @tparam Event The event that triggers this transition.
+ * @tparam Target The state to transition to.
+ * @tparam Guard A function that returns true if the transition should be allowed (optional).
+ * @tparam Action A function to be executed on state transition (optional).
+ */
+template< data_t Source, event_id_t Event, data_t Target, auto Guard = nullptr, auto Action = nullptr >
+struct transition
+{
+    static constexpr data_t source = Source;
+    static constexpr event_id_t event = Event;
+    static constexpr data_t target = Target;
+    static constexpr auto guard = Guard;
+    static constexpr auto action = Action;
+};
+
+/**
+ * @brief The list of states of a machine.
+ */
+template< typename... States >
+struct states
+{
+};
+
+/**
+ * @brief The list of transitions of a machine, in priority order.
+ */
+template< typename... Transitions >
+struct transitions
+{
+};
+
+#if FSM_ENABLE_EVENT_PAYLOAD
+/**
+ * @brief Get the payload of an event as a T, see fsm_event_payload().
+ *
+ * @param event The event.
+ * @return The payload or nullptr if there is none or it is smaller than a T.
+ */
+template< typename T >
+inline const T* payload( const event_t& event )
+{
+    const void* data = event.payload;
+#if FSM_EVENT_INLINE_SIZE
+    if( !data && event.payloadSize )
+    {
+        data = event.inlinePayload.bytes;
+    }
+#endif
+    return ( event.payloadSize >= sizeof( T ) ) ? static_cast< const T* >( data ) : nullptr;
+}
+#endif
+
+namespace detail
+{
+
+// Is a callback template parameter set?
+template< auto Callback >
+constexpr bool is_set = !std::is_same_v< std::decay_t< decltype( Callback ) >, std::nullptr_t >;
+
+// Call an optional action.
+template< auto Action >
+inline void invoke( [[maybe_unused]] void* context, data_t stateData, event_t& event )
+{
+    if constexpr( is_set< Action > )
+    {
+        FSM_INVOKE( Action, context, stateData, &event );
+    }
+}
+
+}  // namespace detail
+
+template< typename States, typename Transitions >
+class machine;
+
+/**
+ * @brief A state machine.
+ *
+ * @tparam States An fsm::states list.
+ * @tparam Transitions An fsm::transitions list.
+ */
+template< typename... States, typename... Transitions >
+class machine< states< States... >, transitions< Transitions... > >
+{
+public:
+    /**
+     * @brief Check at compile time that a state is declared.
+     *
+     * @tparam ID The state's data.
+     * @return true The state is in the states list.
+     */
+    template< data_t ID >
+    static constexpr bool has_state()
+    {
+        return ( ( States::id == ID ) || ... );
+    }
+
+    static_assert( sizeof...( States ) > 0, "A machine needs at least one state" );
+    static_assert( ( ( has_state< Transitions::source >() && has_state< Transitions::target >() ) && ... ),
+                   "Every transition must leave and enter a declared state" );
+
+    /**
+     * @brief Construct a machine in its initial state.
+     *
+     * @param initialState The data of the initial state.
+     */
+    explicit constexpr machine( data_t initialState ) : currentState_( initialState )
+    {
+    }
+
+#if FSM_ENABLE_CONTEXT
+    /**
+     * @brief Construct a machine in its initial state with a user context.
+     *
+     * @param initialState The data of the initial state.
+     * @param context User data passed to every guard and action.
+     */
+    constexpr machine( data_t initialState, void* context ) : currentState_( initialState ), context_( context )
+    {
+    }
+
+    /**
+     * @brief The user context.
+     *
+     * @return The context passed to guards and actions.
+     */
+    constexpr void* context() const
+    {
+        return context_;
+    }
+#endif
+
+    /**
+     * @brief The current state.
+     *
+     * @return The data of the current state.
+     */
+    constexpr data_t current_state() const
+    {
+        return currentState_;
+    }
+
+    /**
+     * @brief State machine event handler.
+     *
+     * @param event The event to process.
+     * @return true A successful transistion to another state.
+     * @return false No valid transition found or the guard condition failed.
+     */
+    bool handle_event( event_t& event )
+    {
+        bool retVal = false;
+        bool fallingThrough = false;
+        // The first transition matching the current state and event decides, as in fsm_handle_event().
+        ( void )( try_transition< Transitions >( event, retVal, fallingThrough ) || ... );
+        return retVal;
+    }
+
+    /**
+     * @brief State machine batch event handler, see fsm_handle_events().
+     *
+     * @param events An array of events to process in order.
+     * @param count The number of events.
+     * @return The number of events that caused a successful transition.
+     */
+    std::size_t handle_events( event_t* events, std::size_t count )
+    {
+        std::size_t transitions = 0;
+        for( std::size_t i = 0; i < count; ++i )
+        {
+            transitions += handle_event( events[ i ] ) ? 1 : 0;
+        }
+        return transitions;
+    }
+
+private:
+    // Perform the exit action of the state with the given data.
+    template< data_t ID >
+    void exit( event_t& event )
+    {
+        ( void )( ( ( States::id == ID ) && ( detail::invoke< States::exit >( callback_context(), ID, event ), true ) ) || ... );
+    }
+
+    // Perform the entry action of the state with the given data.
+    template< data_t ID >
+    void entry( event_t& event )
+    {
+        ( void )( ( ( States::id == ID ) && ( detail::invoke< States::entry >( callback_context(), ID, event ), true ) ) || ... );
+    }
+
+    // Returns true if the search stops, the transition matched or a failed guard has no alternative, and sets
+    // result if it was taken. fallingThrough is set once a guard has failed.
+    template< typename Transition >
+    bool try_transition( event_t& event, bool& result, bool& fallingThrough )
+    {
+        if( currentState_ != Transition::source )
+        {
+            return false;
+        }
+        if( event.ID != Transition::event )
+        {
+            // Only the current state's transition directly after a failed guard is an alternative.
+            return fallingThrough;
+        }
+
+        if constexpr( detail::is_set< Transition::guard > )
+        {
+            if( !FSM_INVOKE( Transition::guard, callback_context(), Transition::source, &event ) )
+            {
+                // With FSM_ENABLE_GUARD_FALLTHROUGH the current state's next transition may be an alternative.
+                fallingThrough = true;
+                return !FSM_ENABLE_GUARD_FALLTHROUGH;
+            }
+        }
+
+        exit< Transition::source >( event );
+        detail::invoke< Transition::action >( callback_context(), Transition::source, event );
+        currentState_ = Transition::target;
+        entry< Transition::target >( event );
+        result = true;
+        return true;
+    }
+
+    // The context passed to guards and actions, FSM_INVOKE() drops it without FSM_ENABLE_CONTEXT.
+    constexpr void* callback_context() const
+    {
+#if FSM_ENABLE_CONTEXT
+        return context_;
+#else
+        return nullptr;
+#endif
+    }
+
+    data_t currentState_;
+#if FSM_ENABLE_CONTEXT
+    void* context_ = nullptr;
+#endif
+};
+
+}  // namespace fsm
+
+#endif  // FINITE_STATE_MACHINE_HPP
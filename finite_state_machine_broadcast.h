@@ -0,0 +1,528 @@
+/*******************************************************************************
+MIT License
+
+Copyright (c) 2024 Julian Mitchell
+https://github.com/jupeos/fsm
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+
+#ifndef FINITE_STATE_MACHINE_BROADCAST_H
+#define FINITE_STATE_MACHINE_BROADCAST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "finite_state_machine_population.h"
+#include "finite_state_machine_port.h"
+
+#ifndef FSM_BROADCAST_SIMD
+#define FSM_BROADCAST_SIMD 1 /*< Set to 0 to force the scalar kernel, e.g. for comparison. */
+#endif
+
+#if FSM_BROADCAST_SIMD && defined( __AVX2__ )
+#include <immintrin.h>
+#define FSM_BROADCAST_AVX2 1
+#elif FSM_BROADCAST_SIMD && defined( __SSSE3__ )
+#include <tmmintrin.h>
+#define FSM_BROADCAST_SSSE3 1
+#elif FSM_BROADCAST_SIMD && defined( __ARM_NEON ) && defined( __aarch64__ )
+#include <arm_neon.h>
+#define FSM_BROADCAST_NEON 1
+#endif
+
+/**
+ * @file finite_state_machine_broadcast.h
+ * @author Julian Mitchell
+ * @date 25th Jan 2024
+ * @brief Broadcast an event to every instance of a population.
+ *
+ * @details A table of the next state for every [state][event] pair is built once from the state graph.
+ * Broadcasting an event (a timeout tick for example) then reduces the table to a column for that event,
+ * evaluating each state's guard once, and maps every instance's current state through the column.
+ * With a uint8_t fsm_state_index_t and up to 64 states the mapping is done 16 (SSSE3, NEON) or 32 (AVX2)
+ * instances at a time with byte shuffles, otherwise a scalar loop is used. Exit, transition and entry
+ * actions are performed, in instance order, only for the instances whose transition has any.
+ *
+ * The event IDs covered by the table are 0 to numEvents - 1, the column for other events is worked out from
+ * the state graph each time they are broadcast.
+ *
+ * Example usage:
+ * @code
+ *    #include "finite_state_machine_broadcast.h"
+ *
+ *    static fsm_state_index_t next[ 2 * EVENT_COUNT ];
+ *    static uint8_t flags[ 2 * EVENT_COUNT ];
+ *    static fsm_broadcast_t broadcast;
+ *
+ *    void init( void )
+ *    {
+ *        fsm_broadcast_init( &broadcast, &population, next, flags, EVENT_COUNT );
+ *    }
+ *
+ *    void tick( void )
+ *    {
+ *        event_t event = { .ID = EVENT_TIMEOUT, .data = 0 };
+ *        fsm_broadcast_event( &broadcast, &event );
+ *    }
+ * @endcode
+ */
+
+#ifndef FSM_BROADCAST_MAX_STATES
+#define FSM_BROADCAST_MAX_STATES 256 /*< The largest state table a broadcast can be built for. */
+#endif
+
+// Values of the broadcast flags table.
+#define FSM_BROADCAST_TAKEN        0x01 /*< The state has a transition for the event.*/
+#define FSM_BROADCAST_GUARDED      0x02 /*< The transition has a guard.*/
+#define FSM_BROADCAST_SIDE_EFFECTS 0x04 /*< The transition has an exit, transition or entry action.*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief A broadcast table for a population.
+ * @note The column members are scratch space for the event being broadcast, so a broadcast table must not
+ * be used by two threads at once.
+ */
+typedef struct
+{
+    FSM_ALIGNAS( 64 ) fsm_state_index_t columnNext[ FSM_BROADCAST_MAX_STATES ]; /*< The next state from each state.*/
+    FSM_ALIGNAS( 64 ) uint8_t columnSideEffects[ FSM_BROADCAST_MAX_STATES ];    /*< 0xFF if leaving the state performs actions.*/
+    FSM_ALIGNAS( 64 ) uint8_t columnTaken[ FSM_BROADCAST_MAX_STATES ];          /*< 0xFF if the state has a transition that passed its guard.*/
+    const transition_t* columnTransition[ FSM_BROADCAST_MAX_STATES ];           /*< The transition taken from each state.*/
+    state_t* columnOwner[ FSM_BROADCAST_MAX_STATES ];                          /*< The state that owns each transition taken.*/
+    fsm_population_t* population;                                              /*< The population.*/
+    fsm_state_index_t* next;                                                   /*< The next state for [state][event].*/
+    uint8_t* flags;                                                            /*< FSM_BROADCAST_ flags for [state][event].*/
+    size_t numEvents;                                                          /*< The number of events in the table.*/
+} fsm_broadcast_t;
+
+/**
+ * @brief Find the first transition considered for an event, before any guard is evaluated.
+ *
+ * @param state The current state.
+ * @param eventID The event ID.
+ * @param owner Receives the state that owns the transition.
+ * @return The transition or NULL if there is none.
+ */
+static inline transition_t* fsm_broadcast_candidate( state_t* state, event_id_t eventID, state_t** owner )
+{
+    transition_t* retVal = NULL;
+#if FSM_ENABLE_HIERARCHY
+    for( state_t* candidate = state; candidate && !retVal; candidate = candidate->parent )
+#else
+    state_t* candidate = state;
+#endif
+    {
+        retVal = fsm_find_transition( candidate, eventID );
+        *owner = candidate;
+    }
+#if FSM_ENABLE_EVENT_FILTER
+#if FSM_ENABLE_HIERARCHY
+    for( state_t* candidate = state; candidate && !retVal; candidate = candidate->parent )
+#else
+    if( !retVal )
+#endif
+    {
+        retVal = candidate->defaultTransition ? &candidate->transitions[ candidate->defaultTransition - 1 ] : NULL;
+        *owner = candidate;
+    }
+#endif
+    return retVal;
+}
+
+/**
+ * @brief Work out a state's entry in the broadcast table for an event.
+ *
+ * @details A state whose first transition considered has a guard is marked FSM_BROADCAST_GUARDED, the
+ * transition it takes is chosen when the event is broadcast (see fsm_population_resolve()).
+ *
+ * @param population The population.
+ * @param stateIndex The index of the state.
+ * @param eventID The event ID.
+ * @param target Receives the index of the next state, *numStates* if it is not in the state table.
+ * @return The FSM_BROADCAST_ flags.
+ */
+static inline uint8_t fsm_broadcast_entry( const fsm_population_t* population, size_t stateIndex, event_id_t eventID, size_t* target )
+{
+    state_t* state = population->states[ stateIndex ];
+    state_t* owner = state;
+    const transition_t* transition = fsm_broadcast_candidate( state, eventID, &owner );
+    uint8_t flag = 0;
+    *target = stateIndex;
+    if( transition )
+    {
+        *target = fsm_population_index_of( population, transition->nextState );
+        flag = FSM_BROADCAST_TAKEN;
+        flag |= transition->guard ? FSM_BROADCAST_GUARDED : 0;
+        flag |= fsm_population_has_actions( state, owner, transition ) ? FSM_BROADCAST_SIDE_EFFECTS : 0;
+    }
+    return flag;
+}
+
+/**
+ * @brief Build the broadcast table of a population.
+ *
+ * @param broadcast The broadcast table.
+ * @param population The population, its state graph must not change afterwards.
+ * @param next Storage for numStates * numEvents next states.
+ * @param flags Storage for numStates * numEvents flags.
+ * @param numEvents The number of event IDs covered by the table.
+ * @return true The table is ready for use.
+ * @return false The population has more than FSM_BROADCAST_MAX_STATES states or a transition leads to a state
+ * not in its state table.
+ */
+static inline bool fsm_broadcast_init( fsm_broadcast_t* broadcast,
+                                       fsm_population_t* population,
+                                       fsm_state_index_t* next,
+                                       uint8_t* flags,
+                                       size_t numEvents )
+{
+    if( population->numStates > FSM_BROADCAST_MAX_STATES )
+    {
+        return false;
+    }
+
+    broadcast->population = population;
+    broadcast->next = next;
+    broadcast->flags = flags;
+    broadcast->numEvents = numEvents;
+    for( size_t s = 0; s < FSM_BROADCAST_MAX_STATES; ++s )
+    {
+        broadcast->columnNext[ s ] = ( fsm_state_index_t )s;
+        broadcast->columnSideEffects[ s ] = 0;
+        broadcast->columnTaken[ s ] = 0;
+        broadcast->columnTransition[ s ] = NULL;
+        broadcast->columnOwner[ s ] = NULL;
+    }
+
+    bool retVal = true;
+    for( size_t s = 0; s < population->numStates; ++s )
+    {
+        for( size_t e = 0; e < numEvents; ++e )
+        {
+            size_t target;
+            uint8_t flag = fsm_broadcast_entry( population, s, ( event_id_t )e, &target );
+            if( target >= population->numStates )
+            {
+                target = s;
+                flag = 0;
+                retVal = false;
+            }
+            next[ ( s * numEvents ) + e ] = ( fsm_state_index_t )target;
+            flags[ ( s * numEvents ) + e ] = flag;
+        }
+    }
+    return retVal;
+}
+
+/**
+ * @brief Perform the actions of a transition for one instance.
+ *
+ * @param broadcast The broadcast table.
+ * @param stateIndex The state the instance is leaving.
+ * @param event The event being broadcast.
+ */
+static inline void fsm_broadcast_actions( fsm_broadcast_t* broadcast, size_t stateIndex, event_t* event )
+{
+    state_t* owner = broadcast->columnOwner[ stateIndex ];
+    const transition_t* transition = broadcast->columnTransition[ stateIndex ];
+    fsm_population_exit( broadcast->population, broadcast->population->states[ stateIndex ], owner, transition, event );
+    fsm_population_enter( broadcast->population, owner, transition, event );
+}
+
+/**
+ * @brief Count the bits set in a lane mask.
+ *
+ * @param mask The mask.
+ * @return The number of bits set.
+ */
+static inline size_t fsm_broadcast_popcount( uint32_t mask )
+{
+    mask = mask - ( ( mask >> 1 ) & 0x55555555u );
+    mask = ( mask & 0x33333333u ) + ( ( mask >> 2 ) & 0x33333333u );
+    return ( size_t )( ( ( ( mask + ( mask >> 4 ) ) & 0x0F0F0F0Fu ) * 0x01010101u ) >> 24 );
+}
+
+/**
+ * @brief Map instances through the columns one at a time.
+ *
+ * @param broadcast The broadcast table.
+ * @param first The first instance.
+ * @param last One past the last instance.
+ * @param event The event being broadcast.
+ * @return The number of instances that made a transition.
+ */
+static inline size_t fsm_broadcast_scalar( fsm_broadcast_t* broadcast, size_t first, size_t last, event_t* event )
+{
+    size_t moved = 0;
+    fsm_state_index_t* current = broadcast->population->current;
+    for( size_t i = first; i < last; ++i )
+    {
+        fsm_state_index_t state = current[ i ];
+        if( broadcast->columnSideEffects[ state ] )
+        {
+            fsm_broadcast_actions( broadcast, state, event );
+        }
+        moved += broadcast->columnTaken[ state ] & 1;
+        current[ i ] = broadcast->columnNext[ state ];
+    }
+    return moved;
+}
+
+#if FSM_BROADCAST_AVX2
+/**
+ * @brief Look up 32 byte indices (below 64) in a 64 byte column.
+ *
+ * @param column The column, as four 16 byte blocks duplicated into both halves of a register.
+ * @param blocks The number of blocks in use.
+ * @param index The indices.
+ * @return The looked up bytes.
+ */
+static inline __m256i fsm_broadcast_lookup( const __m256i* column, size_t blocks, __m256i index )
+{
+    const __m256i lowBits = _mm256_and_si256( index, _mm256_set1_epi8( 0x0F ) );
+    const __m256i block = _mm256_and_si256( _mm256_srli_epi16( index, 4 ), _mm256_set1_epi8( 0x0F ) );
+    __m256i result = _mm256_shuffle_epi8( column[ 0 ], lowBits );
+    for( size_t b = 1; b < blocks; ++b )
+    {
+        __m256i select = _mm256_cmpeq_epi8( block, _mm256_set1_epi8( ( char )b ) );
+        result = _mm256_blendv_epi8( result, _mm256_shuffle_epi8( column[ b ], lowBits ), select );
+    }
+    return result;
+}
+
+/**
+ * @brief Map instances through the columns 32 at a time (AVX2).
+ *
+ * @param broadcast The broadcast table.
+ * @param count The number of instances.
+ * @param event The event being broadcast.
+ * @param moved Incremented by the number of instances that made a transition.
+ * @return The number of instances mapped, the remainder is left to fsm_broadcast_scalar().
+ */
+static inline size_t fsm_broadcast_simd( fsm_broadcast_t* broadcast, size_t count, event_t* event, size_t* moved )
+{
+    const size_t blocks = ( broadcast->population->numStates + 15 ) / 16;
+    __m256i next[ 4 ], sideEffects[ 4 ], taken[ 4 ];
+    for( size_t b = 0; b < blocks; ++b )
+    {
+        next[ b ] = _mm256_broadcastsi128_si256( _mm_load_si128( ( const __m128i* )&broadcast->columnNext[ b * 16 ] ) );
+        sideEffects[ b ] = _mm256_broadcastsi128_si256( _mm_load_si128( ( const __m128i* )&broadcast->columnSideEffects[ b * 16 ] ) );
+        taken[ b ] = _mm256_broadcastsi128_si256( _mm_load_si128( ( const __m128i* )&broadcast->columnTaken[ b * 16 ] ) );
+    }
+
+    uint8_t* current = ( uint8_t* )broadcast->population->current;
+    size_t i = 0;
+    for( ; i + 32 <= count; i += 32 )
+    {
+        __m256i state = _mm256_loadu_si256( ( const __m256i* )&current[ i ] );
+        uint32_t actions = ( uint32_t )_mm256_movemask_epi8( fsm_broadcast_lookup( sideEffects, blocks, state ) );
+        while( actions )
+        {
+            // Lanes with actions leave the vector path, in instance order.
+            unsigned lane = 0;
+            while( !( actions & ( 1u << lane ) ) )
+            {
+                ++lane;
+            }
+            fsm_broadcast_actions( broadcast, current[ i + lane ], event );
+            actions &= actions - 1;
+        }
+        *moved += fsm_broadcast_popcount( ( uint32_t )_mm256_movemask_epi8( fsm_broadcast_lookup( taken, blocks, state ) ) );
+        _mm256_storeu_si256( ( __m256i* )&current[ i ], fsm_broadcast_lookup( next, blocks, state ) );
+    }
+    return i;
+}
+#elif FSM_BROADCAST_SSSE3
+/**
+ * @brief Look up 16 byte indices (below 64) in a 64 byte column.
+ *
+ * @param column The column, as four 16 byte blocks.
+ * @param blocks The number of blocks in use.
+ * @param index The indices.
+ * @return The looked up bytes.
+ */
+static inline __m128i fsm_broadcast_lookup( const __m128i* column, size_t blocks, __m128i index )
+{
+    const __m128i lowBits = _mm_and_si128( index, _mm_set1_epi8( 0x0F ) );
+    const __m128i block = _mm_and_si128( _mm_srli_epi16( index, 4 ), _mm_set1_epi8( 0x0F ) );
+    __m128i result = _mm_shuffle_epi8( column[ 0 ], lowBits );
+    for( size_t b = 1; b < blocks; ++b )
+    {
+        __m128i select = _mm_cmpeq_epi8( block, _mm_set1_epi8( ( char )b ) );
+        result = _mm_or_si128( _mm_andnot_si128( select, result ), _mm_and_si128( select, _mm_shuffle_epi8( column[ b ], lowBits ) ) );
+    }
+    return result;
+}
+
+/**
+ * @brief Map instances through the columns 16 at a time (SSSE3).
+ *
+ * @param broadcast The broadcast table.
+ * @param count The number of instances.
+ * @param event The event being broadcast.
+ * @param moved Incremented by the number of instances that made a transition.
+ * @return The number of instances mapped, the remainder is left to fsm_broadcast_scalar().
+ */
+static inline size_t fsm_broadcast_simd( fsm_broadcast_t* broadcast, size_t count, event_t* event, size_t* moved )
+{
+    const size_t blocks = ( broadcast->population->numStates + 15 ) / 16;
+    __m128i next[ 4 ], sideEffects[ 4 ], taken[ 4 ];
+    for( size_t b = 0; b < blocks; ++b )
+    {
+        next[ b ] = _mm_load_si128( ( const __m128i* )&broadcast->columnNext[ b * 16 ] );
+        sideEffects[ b ] = _mm_load_si128( ( const __m128i* )&broadcast->columnSideEffects[ b * 16 ] );
+        taken[ b ] = _mm_load_si128( ( const __m128i* )&broadcast->columnTaken[ b * 16 ] );
+    }
+
+    uint8_t* current = ( uint8_t* )broadcast->population->current;
+    size_t i = 0;
+    for( ; i + 16 <= count; i += 16 )
+    {
+        __m128i state = _mm_loadu_si128( ( const __m128i* )&current[ i ] );
+        uint32_t actions = ( uint32_t )_mm_movemask_epi8( fsm_broadcast_lookup( sideEffects, blocks, state ) );
+        while( actions )
+        {
+            // Lanes with actions leave the vector path, in instance order.
+            unsigned lane = 0;
+            while( !( actions & ( 1u << lane ) ) )
+            {
+                ++lane;
+            }
+            fsm_broadcast_actions( broadcast, current[ i + lane ], event );
+            actions &= actions - 1;
+        }
+        *moved += fsm_broadcast_popcount( ( uint32_t )_mm_movemask_epi8( fsm_broadcast_lookup( taken, blocks, state ) ) );
+        _mm_storeu_si128( ( __m128i* )&current[ i ], fsm_broadcast_lookup( next, blocks, state ) );
+    }
+    return i;
+}
+#elif FSM_BROADCAST_NEON
+/**
+ * @brief Map instances through the columns 16 at a time (NEON).
+ *
+ * @param broadcast The broadcast table.
+ * @param count The number of instances.
+ * @param event The event being broadcast.
+ * @param moved Incremented by the number of instances that made a transition.
+ * @return The number of instances mapped, the remainder is left to fsm_broadcast_scalar().
+ */
+static inline size_t fsm_broadcast_simd( fsm_broadcast_t* broadcast, size_t count, event_t* event, size_t* moved )
+{
+    // Table lookups of up to 64 bytes, indices beyond the table (never used) return 0.
+    const uint8x16x4_t next = vld1q_u8_x4( ( const uint8_t* )broadcast->columnNext );
+    const uint8x16x4_t sideEffects = vld1q_u8_x4( broadcast->columnSideEffects );
+    const uint8x16x4_t taken = vld1q_u8_x4( broadcast->columnTaken );
+
+    uint8_t* current = ( uint8_t* )broadcast->population->current;
+    size_t i = 0;
+    for( ; i + 16 <= count; i += 16 )
+    {
+        uint8x16_t state = vld1q_u8( &current[ i ] );
+        uint8x16_t actions = vqtbl4q_u8( sideEffects, state );
+        if( vmaxvq_u8( actions ) )
+        {
+            // Lanes with actions leave the vector path, in instance order.
+            for( unsigned lane = 0; lane < 16; ++lane )
+            {
+                if( broadcast->columnSideEffects[ current[ i + lane ] ] )
+                {
+                    fsm_broadcast_actions( broadcast, current[ i + lane ], event );
+                }
+            }
+        }
+        *moved += vaddvq_u8( vandq_u8( vqtbl4q_u8( taken, state ), vdupq_n_u8( 1 ) ) );
+        vst1q_u8( &current[ i ], vqtbl4q_u8( next, state ) );
+    }
+    return i;
+}
+#endif
+
+/**
+ * @brief Broadcast an event to every instance of the population.
+ *
+ * @details Equivalent to handling the event for each instance in turn, except that each state's guard is
+ * evaluated once for all of its instances.
+ *
+ * @param broadcast The broadcast table.
+ * @param event The event to process.
+ * @return The number of instances that made a transition.
+ */
+static inline size_t fsm_broadcast_event( fsm_broadcast_t* broadcast, event_t* event )
+{
+    fsm_population_t* population = broadcast->population;
+    size_t moved = 0;
+    size_t e = ( size_t )event->ID;
+    bool tabled = e < broadcast->numEvents;
+
+    // Reduce the table to a column for this event, or work the column out for an event not in the table. Each
+    // instance's transition is decided by the column before any instance moves.
+    for( size_t s = 0; s < population->numStates; ++s )
+    {
+        size_t target;
+        uint8_t flag;
+        if( tabled )
+        {
+            size_t entry = ( s * broadcast->numEvents ) + e;
+            flag = broadcast->flags[ entry ];
+            target = broadcast->next[ entry ];
+        }
+        else
+        {
+            flag = fsm_broadcast_entry( population, s, event->ID, &target );
+        }
+        bool taken = ( flag & FSM_BROADCAST_TAKEN ) && ( target < population->numStates );
+        bool sideEffects = taken && ( flag & FSM_BROADCAST_SIDE_EFFECTS );
+        if( flag & ( FSM_BROADCAST_GUARDED | FSM_BROADCAST_SIDE_EFFECTS ) )
+        {
+            // Guards are evaluated once per state, in the order fsm_handle_event() evaluates them.
+            state_t* state = population->states[ s ];
+            state_t* owner = state;
+            transition_t* transition = fsm_population_resolve( population, state, event, &owner );
+            target = transition ? fsm_population_index_of( population, transition->nextState ) : population->numStates;
+            taken = target < population->numStates;
+            sideEffects = taken && fsm_population_has_actions( state, owner, transition );
+            broadcast->columnTransition[ s ] = transition;
+            broadcast->columnOwner[ s ] = owner;
+        }
+        broadcast->columnNext[ s ] = taken ? ( fsm_state_index_t )target : ( fsm_state_index_t )s;
+        broadcast->columnTaken[ s ] = taken ? 0xFF : 0;
+        broadcast->columnSideEffects[ s ] = sideEffects ? 0xFF : 0;
+    }
+
+    size_t first = 0;
+#if FSM_BROADCAST_AVX2 || FSM_BROADCAST_SSSE3 || FSM_BROADCAST_NEON
+    if( ( sizeof( fsm_state_index_t ) == 1 ) && ( population->numStates <= 64 ) )
+    {
+        first = fsm_broadcast_simd( broadcast, population->count, event, &moved );
+    }
+#endif
+    return moved + fsm_broadcast_scalar( broadcast, first, population->count, event );
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // FINITE_STATE_MACHINE_BROADCAST_H
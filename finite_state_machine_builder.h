@@ -0,0 +1,438 @@
+/*******************************************************************************
+MIT License
+
+Copyright (c) 2024 Julian Mitchell
+https://github.com/jupeos/fsm
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+
+#ifndef FINITE_STATE_MACHINE_BUILDER_H
+#define FINITE_STATE_MACHINE_BUILDER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "finite_state_machine.h"
+#include "finite_state_machine_port.h"
+
+/**
+ * @file finite_state_machine_builder.h
+ * @author Julian Mitchell
+ * @date 25th Jan 2024
+ * @brief Build state graphs at run time, for example from configuration.
+ *
+ * @details States and transitions are added to a builder by number and fsm_builder_build() lays the whole
+ * graph out in one contiguous, cache line aligned arena: the states, then every state's transitions
+ * adjacent and in state order, then the storage of enabled options (event lookup tables, packed keys,
+ * counters and hierarchy tables). The result behaves exactly like states defined with SM_TRANSITIONS, nested
+ * states are initialised, keys are packed and states with an event lookup table are indexed, and
+ * fsm_graph_free() releases it in one call. The builder only allocates as its tables grow and may be freed
+ * once the graph is built.
+ *
+ * Example usage:
+ * @code
+ *    #include "finite_state_machine_builder.h"
+ *
+ *    fsm_builder_t builder;
+ *    fsm_builder_init( &builder );
+ *    size_t open = fsm_builder_add_state( &builder, STATE_OPEN, SM_NO_ACTION, SM_NO_ACTION );
+ *    size_t closed = fsm_builder_add_state( &builder, STATE_CLOSED, SM_NO_ACTION, SM_NO_ACTION );
+ *    fsm_builder_add_transition( &builder, open, EVENT_CLOSE, closed, SM_NO_GUARD, doorClosedAction );
+ *    fsm_builder_add_transition( &builder, closed, EVENT_OPEN, open, SM_NO_GUARD, doorOpenedAction );
+ *
+ *    fsm_graph_t* graph = fsm_builder_build( &builder );
+ *    fsm_builder_free( &builder );
+ *
+ *    state_machine_t fsm = { .currentState = &graph->states[ closed ] };
+ *    ...
+ *    fsm_graph_free( graph );
+ * @endcode
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief A state graph in a single arena.
+ */
+typedef struct
+{
+    state_t* states;            /*< The states, in the order they were added.*/
+    size_t numStates;           /*< The number of states.*/
+    transition_t* transitions;  /*< All transitions grouped by state, each state's transitions point into this.*/
+    size_t numTransitions;      /*< The number of transitions.*/
+    size_t size;                /*< The size of the arena in bytes.*/
+} fsm_graph_t;
+
+/**
+ * @brief A state waiting to be built.
+ */
+typedef struct
+{
+    state_t state; /*< The state's data, actions and options.*/
+    size_t parent; /*< The number of the enclosing state + 1 (0 = none, FSM_ENABLE_HIERARCHY).*/
+} fsm_builder_state_t;
+
+/**
+ * @brief A transition waiting to be built.
+ */
+typedef struct
+{
+    size_t source;           /*< The number of the state that owns the transition.*/
+    size_t target;           /*< The number of the next state.*/
+    transition_t transition; /*< The event, guard and action.*/
+} fsm_builder_transition_t;
+
+/**
+ * @brief A state graph builder.
+ */
+typedef struct
+{
+    fsm_builder_state_t* states;           /*< The states added.*/
+    size_t numStates;                      /*< The number of states added.*/
+    size_t stateCapacity;                  /*< The number of states there is room for.*/
+    fsm_builder_transition_t* transitions; /*< The transitions added.*/
+    size_t numTransitions;                 /*< The number of transitions added.*/
+    size_t transitionCapacity;             /*< The number of transitions there is room for.*/
+    bool failed;                           /*< An allocation or argument was invalid, fsm_builder_build() will fail.*/
+} fsm_builder_t;
+
+/**
+ * @brief Initialise a builder.
+ *
+ * @param builder The builder.
+ */
+static inline void fsm_builder_init( fsm_builder_t* builder )
+{
+    memset( builder, 0, sizeof( *builder ) );
+}
+
+/**
+ * @brief Free a builder's tables, graphs already built are not affected.
+ *
+ * @param builder The builder.
+ */
+static inline void fsm_builder_free( fsm_builder_t* builder )
+{
+    free( builder->states );
+    free( builder->transitions );
+    fsm_builder_init( builder );
+}
+
+/**
+ * @brief Make room in a builder table for one more entry, doubling its capacity when it is full.
+ *
+ * @param table The table.
+ * @param count The number of entries in use.
+ * @param capacity The number of entries there is room for, updated.
+ * @param size The size of an entry.
+ * @return true There is room.
+ */
+static inline bool fsm_builder_reserve( void** table, size_t count, size_t* capacity, size_t size )
+{
+    if( count < *capacity )
+    {
+        return true;
+    }
+
+    size_t newCapacity = *capacity ? ( *capacity * 2 ) : 16;
+    void* newTable = realloc( *table, newCapacity * size );
+    if( !newTable )
+    {
+        return false;
+    }
+    *table = newTable;
+    *capacity = newCapacity;
+    return true;
+}
+
+/**
+ * @brief Add a state.
+ *
+ * @param builder The builder.
+ * @param data User defined data.
+ * @param entryAction The entry action (optional).
+ * @param exitAction The exit action (optional).
+ * @return The number of the state (states are numbered from 0 in the order added) or SIZE_MAX if out of memory.
+ */
+static inline size_t fsm_builder_add_state( fsm_builder_t* builder,
+                                            data_t data,
+                                            void ( *entryAction )( FSM_CALLBACK_PARAMS ),
+                                            void ( *exitAction )( FSM_CALLBACK_PARAMS ) )
+{
+    void* table = builder->states;
+    if( !fsm_builder_reserve( &table, builder->numStates, &builder->stateCapacity, sizeof( fsm_builder_state_t ) ) )
+    {
+        builder->failed = true;
+        return SIZE_MAX;
+    }
+    builder->states = ( fsm_builder_state_t* )table;
+
+    fsm_builder_state_t* state = &builder->states[ builder->numStates ];
+    memset( state, 0, sizeof( *state ) );
+    state->state.data = data;
+    state->state.entryAction = entryAction;
+    state->state.exitAction = exitAction;
+    return builder->numStates++;
+}
+
+/**
+ * @brief Get a state that has been added, to set its options.
+ *
+ * @details Options are set in the returned state_t as for a static definition, for example *eventIndexCapacity*
+ * (FSM_ENABLE_INDEXED_DISPATCH) to give the built state a lookup table. The pointer is only valid until the next
+ * state is added, and fields referring to other states or to storage are set by fsm_builder_build().
+ *
+ * @param builder The builder.
+ * @param state The number of the state.
+ * @return The state or NULL if there is no such state.
+ */
+static inline state_t* fsm_builder_state( fsm_builder_t* builder, size_t state )
+{
+    return ( state < builder->numStates ) ? &builder->states[ state ].state : NULL;
+}
+
+#if FSM_ENABLE_HIERARCHY
+/**
+ * @brief Nest a state in another.
+ *
+ * @param builder The builder.
+ * @param state The number of the state.
+ * @param parent The number of the enclosing state.
+ * @return true The parent was set.
+ * @return false There is no such state or parent.
+ */
+static inline bool fsm_builder_set_parent( fsm_builder_t* builder, size_t state, size_t parent )
+{
+    if( ( state >= builder->numStates ) || ( parent >= builder->numStates ) )
+    {
+        builder->failed = true;
+        return false;
+    }
+    builder->states[ state ].parent = parent + 1;
+    return true;
+}
+#endif
+
+/**
+ * @brief Add a transition, transitions of a state keep the order they are added in.
+ *
+ * @param builder The builder.
+ * @param source The number of the state that owns the transition.
+ * @param eventID The event that triggers the transition.
+ * @param target The number of the state to transition to.
+ * @param guard A function that returns true if the transition should be allowed (optional).
+ * @param action A function to be executed on state transition (optional).
+ * @return true The transition was added.
+ * @return false There is no such state or out of memory.
+ */
+static inline bool fsm_builder_add_transition( fsm_builder_t* builder,
+                                               size_t source,
+                                               event_id_t eventID,
+                                               size_t target,
+                                               bool ( *guard )( FSM_CALLBACK_PARAMS ),
+                                               void ( *action )( FSM_CALLBACK_PARAMS ) )
+{
+    void* table = builder->transitions;
+    if( ( source >= builder->numStates ) || ( target >= builder->numStates ) ||
+        !fsm_builder_reserve( &table, builder->numTransitions, &builder->transitionCapacity, sizeof( fsm_builder_transition_t ) ) )
+    {
+        builder->failed = true;
+        return false;
+    }
+    builder->transitions = ( fsm_builder_transition_t* )table;
+
+    fsm_builder_transition_t* transition = &builder->transitions[ builder->numTransitions++ ];
+    memset( transition, 0, sizeof( *transition ) );
+    transition->source = source;
+    transition->target = target;
+    transition->transition.eventID = eventID;
+    transition->transition.guard = guard;
+    transition->transition.action = action;
+    return true;
+}
+
+/**
+ * @brief Reserve space in an arena layout.
+ *
+ * @param offset The end of the layout so far, updated.
+ * @param size The number of bytes.
+ * @param alignment The alignment, a power of two.
+ * @return The offset of the reserved space.
+ */
+static inline size_t fsm_arena_reserve( size_t* offset, size_t size, size_t alignment )
+{
+    size_t start = ( *offset + ( alignment - 1 ) ) & ~( alignment - 1 );
+    *offset = start + size;
+    return start;
+}
+
+/**
+ * @brief Build the graph described by a builder.
+ *
+ * @param builder The builder, unchanged so more graphs may be built from it.
+ * @return The graph, to be freed with fsm_graph_free(), or NULL if out of memory, an earlier call failed or
+ * a nested state could not be initialised.
+ */
+static inline fsm_graph_t* fsm_builder_build( const fsm_builder_t* builder )
+{
+    if( builder->failed )
+    {
+        return NULL;
+    }
+
+    // Lay out the arena: the graph, the states, the transitions then per state storage.
+    size_t numStates = builder->numStates;
+    size_t numTransitions = builder->numTransitions;
+    size_t size = sizeof( fsm_graph_t );
+    size_t statesOffset = fsm_arena_reserve( &size, numStates * sizeof( state_t ), FSM_CACHE_LINE_SIZE );
+    size_t transitionsOffset = fsm_arena_reserve( &size, numTransitions * sizeof( transition_t ), FSM_CACHE_LINE_SIZE );
+#if FSM_ENABLE_INDEXED_DISPATCH
+    size_t indexSize = 0;
+    for( size_t i = 0; i < numStates; ++i )
+    {
+        indexSize += builder->states[ i ].state.eventIndexCapacity;
+    }
+    size_t indexOffset = fsm_arena_reserve( &size, indexSize * sizeof( fsm_index_t ), sizeof( fsm_index_t ) );
+#endif
+#if FSM_ENABLE_PACKED_KEYS
+    size_t keysOffset = fsm_arena_reserve( &size, numTransitions * sizeof( event_id_t ), FSM_CACHE_LINE_SIZE );
+#endif
+#if FSM_ENABLE_HIERARCHY
+    size_t lcaOffset = fsm_arena_reserve( &size, numTransitions * sizeof( fsm_state_index_t ), sizeof( fsm_state_index_t ) );
+#endif
+#if FSM_ENABLE_STATS
+    size_t statsOffset = fsm_arena_reserve( &size, numStates * FSM_STATS_MAX_THREADS * sizeof( fsm_state_stats_t ), FSM_CACHE_LINE_SIZE );
+    size_t transitionStatsOffset =
+        fsm_arena_reserve( &size, numTransitions * FSM_STATS_MAX_THREADS * sizeof( fsm_transition_stats_t ), FSM_CACHE_LINE_SIZE );
+#endif
+    size = ( size + ( FSM_CACHE_LINE_SIZE - 1 ) ) & ~( ( size_t )FSM_CACHE_LINE_SIZE - 1 );
+
+    char* arena = ( char* )aligned_alloc( FSM_CACHE_LINE_SIZE, size );
+    if( !arena )
+    {
+        return NULL;
+    }
+    memset( arena, 0, size );
+
+    fsm_graph_t* graph = ( fsm_graph_t* )arena;
+    graph->states = ( state_t* )( arena + statesOffset );
+    graph->numStates = numStates;
+    graph->transitions = ( transition_t* )( arena + transitionsOffset );
+    graph->numTransitions = numTransitions;
+    graph->size = size;
+
+    // Count each state's transitions to find where its run of transitions starts.
+    for( size_t i = 0; i < numTransitions; ++i )
+    {
+        ++graph->states[ builder->transitions[ i ].source ].numTransitions;
+    }
+
+    size_t first = 0;
+#if FSM_ENABLE_INDEXED_DISPATCH
+    fsm_index_t* eventIndex = ( fsm_index_t* )( arena + indexOffset );
+#endif
+    for( size_t i = 0; i < numStates; ++i )
+    {
+        state_t* state = &graph->states[ i ];
+        size_t count = state->numTransitions;
+        *state = builder->states[ i ].state;
+        state->transitions = &graph->transitions[ first ];
+        state->numTransitions = 0;
+#if FSM_ENABLE_INDEXED_DISPATCH
+        state->eventIndex = state->eventIndexCapacity ? eventIndex : NULL;
+        state->eventIndexSize = 0;
+        eventIndex += state->eventIndexCapacity;
+#endif
+#if FSM_ENABLE_PACKED_KEYS
+        state->keys = ( event_id_t* )( arena + keysOffset ) + first;
+        state->numKeys = 0;
+#endif
+#if FSM_ENABLE_SORTED_DISPATCH
+        state->sortedTransitions = false;
+#endif
+#if FSM_ENABLE_HIERARCHY
+        state->parent = builder->states[ i ].parent ? &graph->states[ builder->states[ i ].parent - 1 ] : NULL;
+        state->lcaDepths = ( fsm_state_index_t* )( arena + lcaOffset ) + first;
+#endif
+#if FSM_ENABLE_STATS
+        state->stats = ( fsm_state_stats_t* )( arena + statsOffset ) + ( i * FSM_STATS_MAX_THREADS );
+        state->transitionStats = ( fsm_transition_stats_t* )( arena + transitionStatsOffset ) + ( first * FSM_STATS_MAX_THREADS );
+#endif
+        first += count;
+    }
+
+    // Place each transition at the end of its state's run, keeping the order they were added in.
+    for( size_t i = 0; i < numTransitions; ++i )
+    {
+        const fsm_builder_transition_t* added = &builder->transitions[ i ];
+        state_t* state = &graph->states[ added->source ];
+        transition_t* transition = &state->transitions[ state->numTransitions++ ];
+        *transition = added->transition;
+        transition->nextState = &graph->states[ added->target ];
+    }
+
+    bool retVal = true;
+    for( size_t i = 0; i < numStates; ++i )
+    {
+#if FSM_ENABLE_PACKED_KEYS
+        fsm_pack_keys( &graph->states[ i ] );
+#endif
+#if FSM_ENABLE_EVENT_FILTER
+        fsm_filter_state( &graph->states[ i ] );
+#endif
+#if FSM_ENABLE_HIERARCHY
+        retVal = retVal && fsm_init_hierarchy( &graph->states[ i ] );
+#endif
+#if FSM_ENABLE_INDEXED_DISPATCH
+        if( graph->states[ i ].eventIndex )
+        {
+            fsm_index_state( &graph->states[ i ] );
+        }
+#endif
+    }
+
+    if( !retVal )
+    {
+        free( arena );
+        graph = NULL;
+    }
+    return graph;
+}
+
+/**
+ * @brief Free a graph built by fsm_builder_build(), no state machine may still be using it.
+ *
+ * @param graph The graph (optional).
+ */
+static inline void fsm_graph_free( fsm_graph_t* graph )
+{
+    free( graph );
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
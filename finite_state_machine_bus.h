@@ -0,0 +1,631 @@
+/*******************************************************************************
+MIT License
+
+Copyright (c) 2024 Julian Mitchell
+https://github.com/jupeos/fsm
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+
+#ifndef FINITE_STATE_MACHINE_BUS_H
+#define FINITE_STATE_MACHINE_BUS_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "finite_state_machine.h"
+
+/**
+ * @file finite_state_machine_bus.h
+ * @author Julian Mitchell
+ * @date 25th Jan 2024
+ * @brief Route events to only the state machine instances that can react to them.
+ *
+ * @details An event bus holds an array of state machine instances sharing a table of states. It keeps the
+ * instances in one list per state and, built once from the table, the states that accept each event ID (that
+ * have a transition for it, of their own or with FSM_ENABLE_HIERARCHY of an enclosing state), so publishing an
+ * event reaches the instances whose current state accepts it without looking at any other instance. Moving an
+ * instance between lists is O(1) and happens as part of every transition made through the bus.
+ *
+ * Event IDs 0 to numEvents - 1 are indexed. States with transitions for other IDs (including a default
+ * transition, FSM_ENABLE_EVENT_FILTER) and instances in a state that is not in the table receive every event.
+ *
+ * With more than one thread the instances receiving an event are split between threads once there are at
+ * least FSM_BUS_MIN_PARALLEL of them, instance lists are updated by the publishing thread afterwards. Guards
+ * and actions must then be safe to run concurrently for different instances. A bus is published to by one
+ * thread at a time. Requires POSIX threads.
+ *
+ * Example usage:
+ * @code
+ *    #include "finite_state_machine_bus.h"
+ *
+ *    static state_t* states[] = { &doorOpenState, &doorClosedState };
+ *    static state_machine_t doors[ 100000 ];
+ *    static fsm_bus_t bus;
+ *
+ *    void init( void )
+ *    {
+ *        for( size_t i = 0; i < 100000; ++i )
+ *        {
+ *            doors[ i ].currentState = &doorClosedState;
+ *        }
+ *        fsm_bus_init( &bus, doors, 100000, states, 2, NUM_EVENTS, 4 );
+ *    }
+ *
+ *    void openAll( void )
+ *    {
+ *        event_t event = { .ID = EVENT_OPEN, .data = 0 };
+ *        fsm_bus_publish( &bus, &event );
+ *    }
+ * @endcode
+ */
+
+#ifndef FSM_BUS_MIN_PARALLEL
+#define FSM_BUS_MIN_PARALLEL 1024 /*< The fewest instances receiving an event for the delivery to be split between threads. */
+#endif
+
+#define FSM_BUS_NONE SIZE_MAX /*< The end of an instance list.*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief A state and its index in the table, for looking states up by address.
+ */
+typedef struct
+{
+    const state_t* state; /*< The state.*/
+    size_t index;         /*< Its index in the table.*/
+} fsm_bus_entry_t;
+
+struct fsm_bus;
+
+/**
+ * @brief A thread delivering a share of the events published.
+ */
+typedef struct
+{
+    struct fsm_bus* bus; /*< The bus the worker belongs to.*/
+    size_t index;        /*< The share the worker delivers, 1 to numWorkers (the publisher delivers share 0).*/
+    size_t transitions;  /*< The number of transitions made by the last share delivered.*/
+    size_t generation;   /*< The last delivery the worker has seen, set before it starts.*/
+    pthread_t thread;    /*< The thread.*/
+} fsm_bus_worker_t;
+
+/**
+ * @brief An event bus.
+ */
+typedef struct fsm_bus
+{
+    state_machine_t* instances; /*< The state machine instances.*/
+    size_t numInstances;        /*< The number of instances.*/
+    state_t* const* states;     /*< The state table.*/
+    size_t numStates;           /*< The number of states in the table.*/
+    size_t numEvents;           /*< The number of event IDs indexed.*/
+    fsm_bus_entry_t* byState;   /*< The states in address order.*/
+    size_t* eventFirst;         /*< The position of each event ID's first state in eventStates, then other IDs', then the total.*/
+    size_t* eventStates;        /*< The states that accept each event ID, numStates standing for states not in the table.*/
+    size_t* heads;              /*< The first instance in each state (and in states not in the table), FSM_BUS_NONE for none.*/
+    size_t* counts;             /*< The number of instances in each state (and in states not in the table).*/
+    size_t* nextInstance;       /*< The next instance in the same state.*/
+    size_t* previousInstance;   /*< The previous instance in the same state.*/
+    size_t* stateOf;            /*< The list each instance is in.*/
+    size_t* delivery;           /*< The instances receiving the event being published.*/
+    state_t** before;           /*< Their states before the event.*/
+    size_t numDelivery;         /*< The number of instances receiving the event being published.*/
+    event_t event;              /*< The event being published.*/
+    fsm_bus_worker_t* workers;  /*< The worker threads.*/
+    size_t numWorkers;          /*< The number of worker threads.*/
+    pthread_mutex_t lock;       /*< Guards the fields below.*/
+    pthread_cond_t wake;        /*< Signalled when there is an event to deliver or the workers are to stop.*/
+    pthread_cond_t done;        /*< Signalled when the workers have delivered their shares.*/
+    size_t generation;          /*< The number of deliveries handed to the workers.*/
+    size_t pending;             /*< The number of workers still delivering.*/
+    bool stopping;              /*< The workers are to exit.*/
+} fsm_bus_t;
+
+/**
+ * @brief Order lookup entries by state address, see qsort().
+ */
+static inline int fsm_bus_compare_entries( const void* a, const void* b )
+{
+    uintptr_t x = ( uintptr_t )( ( const fsm_bus_entry_t* )a )->state;
+    uintptr_t y = ( uintptr_t )( ( const fsm_bus_entry_t* )b )->state;
+    return ( x > y ) - ( x < y );
+}
+
+/**
+ * @brief Find a state in the table.
+ *
+ * @return The index of the state or numStates if it is not in the table.
+ */
+static inline size_t fsm_bus_index_of( const fsm_bus_t* bus, const state_t* state )
+{
+    size_t low = 0;
+    size_t high = bus->numStates;
+    while( low < high )
+    {
+        size_t mid = low + ( ( high - low ) / 2 );
+        if( ( uintptr_t )bus->byState[ mid ].state < ( uintptr_t )state )
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return ( ( low < bus->numStates ) && ( bus->byState[ low ].state == state ) ) ? bus->byState[ low ].index : bus->numStates;
+}
+
+/**
+ * @brief List the event IDs a state accepts, numEvents standing for every other ID.
+ *
+ * @param bus The bus.
+ * @param state The state, NULL for a state not in the table.
+ * @param stamps The last state each event ID was listed for.
+ * @param stamp A value identifying this call in stamps.
+ * @param rows Receives the event IDs, up to numEvents + 1 of them.
+ * @return The number of event IDs listed.
+ */
+static inline size_t fsm_bus_rows_of( const fsm_bus_t* bus, const state_t* state, size_t* stamps, size_t stamp, size_t* rows )
+{
+    size_t count = 0;
+    bool all = !state;
+    // The depth is bounded in case the enclosing states form a cycle.
+    for( size_t depth = 0; state && !all && ( depth <= bus->numStates ); ++depth )
+    {
+        for( size_t t = 0; t < state->numTransitions; ++t )
+        {
+            size_t row = ( size_t )state->transitions[ t ].eventID;
+            if( row >= bus->numEvents )
+            {
+                all = true;
+            }
+            else if( stamps[ row ] != stamp )
+            {
+                stamps[ row ] = stamp;
+                rows[ count++ ] = row;
+            }
+        }
+#if FSM_ENABLE_HIERARCHY
+        state = state->parent;
+#else
+        state = NULL;
+#endif
+    }
+
+    if( all )
+    {
+        for( count = 0; count <= bus->numEvents; ++count )
+        {
+            rows[ count ] = count;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Add an instance to the list of a state.
+ */
+static inline void fsm_bus_link( fsm_bus_t* bus, size_t instance, size_t state )
+{
+    bus->stateOf[ instance ] = state;
+    bus->previousInstance[ instance ] = FSM_BUS_NONE;
+    bus->nextInstance[ instance ] = bus->heads[ state ];
+    if( bus->heads[ state ] != FSM_BUS_NONE )
+    {
+        bus->previousInstance[ bus->heads[ state ] ] = instance;
+    }
+    bus->heads[ state ] = instance;
+    ++bus->counts[ state ];
+}
+
+/**
+ * @brief Remove an instance from the list it is in.
+ */
+static inline void fsm_bus_unlink( fsm_bus_t* bus, size_t instance )
+{
+    size_t state = bus->stateOf[ instance ];
+    size_t previous = bus->previousInstance[ instance ];
+    size_t next = bus->nextInstance[ instance ];
+    if( previous != FSM_BUS_NONE )
+    {
+        bus->nextInstance[ previous ] = next;
+    }
+    else
+    {
+        bus->heads[ state ] = next;
+    }
+    if( next != FSM_BUS_NONE )
+    {
+        bus->previousInstance[ next ] = previous;
+    }
+    --bus->counts[ state ];
+}
+
+/**
+ * @brief Move an instance to the list of its current state if it has changed.
+ *
+ * @details Call after handling an event for an instance other than through the bus.
+ *
+ * @param bus The bus.
+ * @param instance The instance.
+ */
+static inline void fsm_bus_refresh( fsm_bus_t* bus, size_t instance )
+{
+    size_t listed = bus->stateOf[ instance ];
+    const state_t* current = bus->instances[ instance ].currentState;
+    if( ( listed == bus->numStates ) || ( bus->states[ listed ] != current ) )
+    {
+        fsm_bus_unlink( bus, instance );
+        fsm_bus_link( bus, instance, fsm_bus_index_of( bus, current ) );
+    }
+}
+
+/**
+ * @brief Handle the event being published for a range of the instances receiving it.
+ *
+ * @return The number of instances that made a transition.
+ */
+static inline size_t fsm_bus_deliver( fsm_bus_t* bus, size_t begin, size_t end )
+{
+    size_t transitions = 0;
+    for( size_t i = begin; i < end; ++i )
+    {
+        state_machine_t* fsm = &bus->instances[ bus->delivery[ i ] ];
+        // Each instance gets its own copy, an action may change the event.
+        event_t event = bus->event;
+        bus->before[ i ] = fsm->currentState;
+        transitions += fsm_handle_event( fsm, &event ) ? 1 : 0;
+    }
+    return transitions;
+}
+
+/**
+ * @brief The start of a share of the instances receiving an event.
+ */
+static inline size_t fsm_bus_share( const fsm_bus_t* bus, size_t share )
+{
+    return ( bus->numDelivery * share ) / ( bus->numWorkers + 1 );
+}
+
+/**
+ * @brief Worker thread entry, delivers its share of each event published until the bus is freed.
+ */
+static inline void* fsm_bus_worker( void* argument )
+{
+    fsm_bus_worker_t* worker = ( fsm_bus_worker_t* )argument;
+    fsm_bus_t* bus = worker->bus;
+    pthread_mutex_lock( &bus->lock );
+    // The starting generation is taken before the thread is created, a delivery may already be waiting.
+    size_t seen = worker->generation;
+    for( ;; )
+    {
+        while( ( bus->generation == seen ) && !bus->stopping )
+        {
+            pthread_cond_wait( &bus->wake, &bus->lock );
+        }
+        if( bus->stopping )
+        {
+            break;
+        }
+        seen = bus->generation;
+        pthread_mutex_unlock( &bus->lock );
+
+        worker->transitions = fsm_bus_deliver( bus, fsm_bus_share( bus, worker->index ), fsm_bus_share( bus, worker->index + 1 ) );
+
+        pthread_mutex_lock( &bus->lock );
+        if( --bus->pending == 0 )
+        {
+            pthread_cond_signal( &bus->done );
+        }
+    }
+    pthread_mutex_unlock( &bus->lock );
+    return NULL;
+}
+
+/**
+ * @brief Free the storage of a bus, stopping its worker threads.
+ *
+ * @param bus The bus.
+ */
+static inline void fsm_bus_free( fsm_bus_t* bus )
+{
+    pthread_mutex_lock( &bus->lock );
+    bus->stopping = true;
+    pthread_cond_broadcast( &bus->wake );
+    pthread_mutex_unlock( &bus->lock );
+    for( size_t i = 0; i < bus->numWorkers; ++i )
+    {
+        pthread_join( bus->workers[ i ].thread, NULL );
+    }
+    pthread_mutex_destroy( &bus->lock );
+    pthread_cond_destroy( &bus->wake );
+    pthread_cond_destroy( &bus->done );
+
+    free( bus->byState );
+    free( bus->eventFirst );
+    free( bus->eventStates );
+    free( bus->heads );
+    free( bus->counts );
+    free( bus->nextInstance );
+    free( bus->previousInstance );
+    free( bus->stateOf );
+    free( bus->delivery );
+    free( ( void* )bus->before );
+    free( bus->workers );
+    bus->workers = NULL;
+    bus->numWorkers = 0;
+}
+
+/**
+ * @brief Index the states that accept each event ID.
+ *
+ * @return true The index is built.
+ * @return false Out of memory.
+ */
+static inline bool fsm_bus_index_events( fsm_bus_t* bus )
+{
+    const size_t numRows = bus->numEvents + 1;
+    size_t* stamps = ( size_t* )malloc( numRows * sizeof( size_t ) );
+    size_t* rows = ( size_t* )malloc( numRows * sizeof( size_t ) );
+    bus->eventFirst = ( size_t* )calloc( numRows + 1, sizeof( size_t ) );
+    bool retVal = stamps && rows && bus->eventFirst;
+    for( size_t i = 0; retVal && ( i < numRows ); ++i )
+    {
+        stamps[ i ] = SIZE_MAX;
+    }
+
+    // Count the states of each event ID, then place them, the last stands for states not in the table.
+    for( size_t s = 0; retVal && ( s <= bus->numStates ); ++s )
+    {
+        size_t count = fsm_bus_rows_of( bus, ( s < bus->numStates ) ? bus->states[ s ] : NULL, stamps, s, rows );
+        for( size_t i = 0; i < count; ++i )
+        {
+            ++bus->eventFirst[ rows[ i ] + 1 ];
+        }
+    }
+    for( size_t i = 0; retVal && ( i < numRows ); ++i )
+    {
+        bus->eventFirst[ i + 1 ] += bus->eventFirst[ i ];
+    }
+    bus->eventStates = retVal ? ( size_t* )malloc( ( bus->eventFirst[ numRows ] + 1 ) * sizeof( size_t ) ) : NULL;
+    retVal = retVal && bus->eventStates;
+    for( size_t i = 0; retVal && ( i < numRows ); ++i )
+    {
+        stamps[ i ] = SIZE_MAX;
+    }
+    for( size_t s = 0; retVal && ( s <= bus->numStates ); ++s )
+    {
+        size_t count = fsm_bus_rows_of( bus, ( s < bus->numStates ) ? bus->states[ s ] : NULL, stamps, s, rows );
+        for( size_t i = 0; i < count; ++i )
+        {
+            // eventFirst[ row ] is advanced as the row fills and ends up at the start of the next row.
+            bus->eventStates[ bus->eventFirst[ rows[ i ] ]++ ] = s;
+        }
+    }
+    for( size_t i = numRows; retVal && ( i > 0 ); --i )
+    {
+        bus->eventFirst[ i ] = bus->eventFirst[ i - 1 ];
+    }
+    if( retVal )
+    {
+        bus->eventFirst[ 0 ] = 0;
+    }
+    free( stamps );
+    free( rows );
+    return retVal;
+}
+
+/**
+ * @brief Initialise a bus over an array of instances.
+ *
+ * @param bus The bus.
+ * @param instances The state machine instances, each with its current state set.
+ * @param numInstances The number of instances.
+ * @param states The state table, the states the instances can be in.
+ * @param numStates The number of states in the table.
+ * @param numEvents The number of event IDs to index, IDs 0 to numEvents - 1.
+ * @param numThreads The number of threads to deliver events with, including the publishing thread.
+ * @return true The bus is ready for use, free it with fsm_bus_free().
+ * @return false Out of memory, nothing is left allocated.
+ */
+static inline bool fsm_bus_init( fsm_bus_t* bus,
+                                 state_machine_t* instances,
+                                 size_t numInstances,
+                                 state_t* const* states,
+                                 size_t numStates,
+                                 size_t numEvents,
+                                 size_t numThreads )
+{
+    bus->instances = instances;
+    bus->numInstances = numInstances;
+    bus->states = states;
+    bus->numStates = numStates;
+    bus->numEvents = numEvents;
+    bus->eventFirst = NULL;
+    bus->eventStates = NULL;
+    bus->numDelivery = 0;
+    bus->workers = NULL;
+    bus->numWorkers = 0;
+    bus->generation = 0;
+    bus->pending = 0;
+    bus->stopping = false;
+    pthread_mutex_init( &bus->lock, NULL );
+    pthread_cond_init( &bus->wake, NULL );
+    pthread_cond_init( &bus->done, NULL );
+
+    bus->byState = ( fsm_bus_entry_t* )malloc( ( numStates + 1 ) * sizeof( fsm_bus_entry_t ) );
+    bus->heads = ( size_t* )malloc( ( numStates + 1 ) * sizeof( size_t ) );
+    bus->counts = ( size_t* )calloc( numStates + 1, sizeof( size_t ) );
+    bus->nextInstance = ( size_t* )malloc( ( numInstances + 1 ) * sizeof( size_t ) );
+    bus->previousInstance = ( size_t* )malloc( ( numInstances + 1 ) * sizeof( size_t ) );
+    bus->stateOf = ( size_t* )malloc( ( numInstances + 1 ) * sizeof( size_t ) );
+    bus->delivery = ( size_t* )malloc( ( numInstances + 1 ) * sizeof( size_t ) );
+    bus->before = ( state_t** )malloc( ( numInstances + 1 ) * sizeof( state_t* ) );
+    bus->workers = ( numThreads > 1 ) ? ( fsm_bus_worker_t* )calloc( numThreads - 1, sizeof( fsm_bus_worker_t ) ) : NULL;
+    bool retVal = bus->byState && bus->heads && bus->counts && bus->nextInstance && bus->previousInstance && bus->stateOf && bus->delivery &&
+                  bus->before && ( bus->workers || ( numThreads <= 1 ) );
+    if( retVal )
+    {
+        for( size_t i = 0; i < numStates; ++i )
+        {
+            bus->byState[ i ].state = states[ i ];
+            bus->byState[ i ].index = i;
+        }
+        qsort( bus->byState, numStates, sizeof( fsm_bus_entry_t ), fsm_bus_compare_entries );
+        retVal = fsm_bus_index_events( bus );
+    }
+    if( retVal )
+    {
+        for( size_t s = 0; s <= numStates; ++s )
+        {
+            bus->heads[ s ] = FSM_BUS_NONE;
+        }
+        // Linked in reverse so each list starts in instance order.
+        for( size_t i = numInstances; i-- > 0; )
+        {
+            fsm_bus_link( bus, i, fsm_bus_index_of( bus, instances[ i ].currentState ) );
+        }
+        // Threads that cannot be started only make the delivery coarser.
+        for( size_t i = 0; i + 1 < numThreads; ++i )
+        {
+            fsm_bus_worker_t* worker = &bus->workers[ bus->numWorkers ];
+            worker->bus = bus;
+            worker->index = bus->numWorkers + 1;
+            worker->generation = bus->generation;
+            if( pthread_create( &worker->thread, NULL, fsm_bus_worker, worker ) == 0 )
+            {
+                ++bus->numWorkers;
+            }
+        }
+    }
+    else
+    {
+        fsm_bus_free( bus );
+    }
+    return retVal;
+}
+
+/**
+ * @brief Count the instances an event would be delivered to.
+ *
+ * @param bus The bus.
+ * @param eventID The event ID.
+ * @return The number of instances whose current state accepts the event.
+ */
+static inline size_t fsm_bus_subscribers( const fsm_bus_t* bus, event_id_t eventID )
+{
+    size_t row = ( ( size_t )eventID < bus->numEvents ) ? ( size_t )eventID : bus->numEvents;
+    size_t count = 0;
+    for( size_t k = bus->eventFirst[ row ]; k < bus->eventFirst[ row + 1 ]; ++k )
+    {
+        count += bus->counts[ bus->eventStates[ k ] ];
+    }
+    return count;
+}
+
+/**
+ * @brief Publish an event to every instance whose current state accepts it.
+ *
+ * @details The instances receiving the event are those in the accepting states when it is published, each
+ * handles it with fsm_handle_event(), split between the bus threads when there are enough of them.
+ *
+ * @param bus The bus.
+ * @param event The event, copied for each instance.
+ * @return The number of instances that made a transition.
+ */
+static inline size_t fsm_bus_publish( fsm_bus_t* bus, const event_t* event )
+{
+    size_t row = ( ( size_t )event->ID < bus->numEvents ) ? ( size_t )event->ID : bus->numEvents;
+    bus->numDelivery = 0;
+    for( size_t k = bus->eventFirst[ row ]; k < bus->eventFirst[ row + 1 ]; ++k )
+    {
+        for( size_t i = bus->heads[ bus->eventStates[ k ] ]; i != FSM_BUS_NONE; i = bus->nextInstance[ i ] )
+        {
+            bus->delivery[ bus->numDelivery++ ] = i;
+        }
+    }
+    bus->event = *event;
+
+    size_t transitions = 0;
+    if( bus->numWorkers && ( bus->numDelivery >= FSM_BUS_MIN_PARALLEL ) )
+    {
+        pthread_mutex_lock( &bus->lock );
+        ++bus->generation;
+        bus->pending = bus->numWorkers;
+        pthread_cond_broadcast( &bus->wake );
+        pthread_mutex_unlock( &bus->lock );
+
+        transitions = fsm_bus_deliver( bus, 0, fsm_bus_share( bus, 1 ) );
+
+        pthread_mutex_lock( &bus->lock );
+        while( bus->pending )
+        {
+            pthread_cond_wait( &bus->done, &bus->lock );
+        }
+        pthread_mutex_unlock( &bus->lock );
+        for( size_t w = 0; w < bus->numWorkers; ++w )
+        {
+            transitions += bus->workers[ w ].transitions;
+        }
+    }
+    else
+    {
+        transitions = fsm_bus_deliver( bus, 0, bus->numDelivery );
+    }
+
+    // Instances that changed state move to the list of their new state.
+    for( size_t i = 0; i < bus->numDelivery; ++i )
+    {
+        if( bus->instances[ bus->delivery[ i ] ].currentState != bus->before[ i ] )
+        {
+            fsm_bus_unlink( bus, bus->delivery[ i ] );
+            fsm_bus_link( bus, bus->delivery[ i ], fsm_bus_index_of( bus, bus->instances[ bus->delivery[ i ] ].currentState ) );
+        }
+    }
+    return transitions;
+}
+
+/**
+ * @brief Handle an event for one instance, keeping the bus up to date, see fsm_handle_event().
+ *
+ * @param bus The bus.
+ * @param instance The instance.
+ * @param event The event to process.
+ * @return true A successful transistion to another state.
+ * @return false No valid transition found or the guard condition failed.
+ */
+static inline bool fsm_bus_handle_event( fsm_bus_t* bus, size_t instance, event_t* event )
+{
+    bool retVal = fsm_handle_event( &bus->instances[ instance ], event );
+    fsm_bus_refresh( bus, instance );
+    return retVal;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // FINITE_STATE_MACHINE_BUS_H
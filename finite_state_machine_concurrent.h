@@ -0,0 +1,245 @@
+/*******************************************************************************
+MIT License
+
+Copyright (c) 2024 Julian Mitchell
+https://github.com/jupeos/fsm
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+
+#ifndef FINITE_STATE_MACHINE_CONCURRENT_H
+#define FINITE_STATE_MACHINE_CONCURRENT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "finite_state_machine.h"
+#include "finite_state_machine_port.h"
+
+/**
+ * @file finite_state_machine_concurrent.h
+ * @author Julian Mitchell
+ * @date 25th Jan 2024
+ * @brief A state machine that any number of threads may send events to without a lock.
+ *
+ * @details The current state is an atomic pointer and a transition commits with a compare and swap from the
+ * state it was chosen in. The contract for each event is:
+ * - before the commit the current state is observed, its transition for the event is found and the guard is
+ *   evaluated with that state's data. Guards may therefore run for a transition that is then not taken and
+ *   must not have side effects.
+ * - the commit moves the current state from the observed state to the next state in one atomic step. If
+ *   another thread moved the state machine first, the event is retried from the new current state (up to a
+ *   limit) or a conflict is reported, nothing having run but guards.
+ * - after the commit the thread that won performs the exit action of the observed state, the transition
+ *   action then the entry action of the next state.
+ *
+ * The compare and swap sees only the state pointer, not how the state machine got there (ABA). If other
+ * threads commit a self-transition, or move the state machine away and back (A to B to A), after the state was
+ * observed, the stale attempt still commits as though the state had not changed: its guard is not evaluated
+ * again and its actions run after, or at the same time as, those of the transitions in between. So each
+ * event is still taken at most once, but a guard must depend only on the state's data and the event, not on
+ * anything the actions change. Send events through one thread (or fsm_handle_event() under a lock) when
+ * transitions must see every action before them.
+ *
+ * Readers calling fsm_concurrent_state() always see a state that was committed, never an intermediate one,
+ * but may see the next state before its entry action has completed. Actions of successive transitions can
+ * run at the same time on different threads, so actions must be thread safe. Only the current state's own
+ * transitions are considered (with guard fall-through), the *state_machine_t* options that keep per machine
+ * storage (hierarchy, event queue, timeouts) do not apply. As with fsm_handle_event() the event hook (and the
+ * FSM_ENABLE_STATS event count) fires once per event, for the state first observed, while the guard hooks fire
+ * for every guard evaluated, retries included.
+ *
+ * Example usage:
+ * @code
+ *    #include "finite_state_machine_concurrent.h"
+ *
+ *    static fsm_concurrent_machine_t door;
+ *
+ *    void init( void )
+ *    {
+ *        fsm_concurrent_init( &door, &doorClosedState );
+ *    }
+ *
+ *    // Any thread.
+ *    void openFunc( void )
+ *    {
+ *        event_t event = { .ID = EVENT_OPEN, .data = 0 };
+ *        if( fsm_concurrent_handle_event( &door, &event, 8 ) == FSM_CAS_CONFLICT )
+ *        {
+ *            printf( "Door busy.\r\n" );
+ *        }
+ *    }
+ * @endcode
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief The outcome of a concurrent event.
+ */
+typedef enum
+{
+    FSM_CAS_TAKEN,     /*< The state machine moved to the transition's next state.*/
+    FSM_CAS_NOT_TAKEN, /*< No transition for the event in the observed state or its guard failed.*/
+    FSM_CAS_CONFLICT,  /*< Other threads kept moving the state machine, the event was not handled.*/
+} fsm_cas_result_t;
+
+/**
+ * @brief A state machine shared between threads.
+ */
+typedef struct
+{
+    FSM_ATOMIC( state_t* ) currentState; /*< The last committed state.*/
+#if FSM_ENABLE_CONTEXT
+    void* context; /*< User data passed to every guard and action, set after fsm_concurrent_init().*/
+#endif
+} fsm_concurrent_machine_t;
+
+/**
+ * @brief Initialise a shared state machine, before any thread uses it.
+ *
+ * @param fsm The state machine instance.
+ * @param initialState The initial state.
+ */
+static inline void fsm_concurrent_init( fsm_concurrent_machine_t* fsm, state_t* initialState )
+{
+    fsm_atomic_init( &fsm->currentState, initialState );
+}
+
+/**
+ * @brief Read the current state of a shared state machine.
+ *
+ * @param fsm The state machine instance.
+ * @return The last committed state.
+ */
+static inline state_t* fsm_concurrent_state( fsm_concurrent_machine_t* fsm )
+{
+    return fsm_atomic_load( &fsm->currentState, memory_order_acquire );
+}
+
+/**
+ * @brief Choose the transition a state takes for an event, evaluating guards.
+ *
+ * @param fsm The state machine instance.
+ * @param state The observed state.
+ * @param event The event.
+ * @return The transition or NULL if there is none or its guard failed.
+ */
+static inline transition_t* fsm_concurrent_select( fsm_concurrent_machine_t* fsm, state_t* state, event_t* event )
+{
+    ( void )fsm; // Only the context is read, with FSM_ENABLE_CONTEXT.
+    transition_t* transition = fsm_match_transition( state, event->ID );
+    if( !transition )
+    {
+        FSM_HOOK_UNMATCHED( state, event );
+    }
+
+    while( transition )
+    {
+        bool guardResult = true;
+        if( transition->guard )
+        {
+            FSM_HOOK_GUARD_BEGIN( state, transition );
+            guardResult = FSM_INVOKE( transition->guard, fsm->context, state->data, event );
+            FSM_HOOK_GUARD_END( state, transition, guardResult );
+        }
+
+        if( guardResult )
+        {
+            return transition;
+        }
+
+#if FSM_ENABLE_GUARD_FALLTHROUGH
+        // The guard failed, try the alternatives that follow for the same event.
+        ++transition;
+        if( ( transition == &state->transitions[ state->numTransitions ] ) || ( transition->eventID != event->ID ) )
+        {
+            transition = NULL;
+        }
+#else
+        transition = NULL;
+#endif
+    }
+    return NULL;
+}
+
+/**
+ * @brief Shared state machine event handler, callable from any thread.
+ *
+ * @param fsm The state machine instance.
+ * @param event The event to process.
+ * @param maxRetries The number of times the event is retried after another thread moved the state machine first.
+ * @return FSM_CAS_TAKEN, FSM_CAS_NOT_TAKEN or FSM_CAS_CONFLICT if the retries ran out.
+ */
+static inline fsm_cas_result_t fsm_concurrent_handle_event( fsm_concurrent_machine_t* fsm, event_t* event, size_t maxRetries )
+{
+    state_t* state = fsm_atomic_load( &fsm->currentState, memory_order_acquire );
+    // Counted once, against the state first observed, however many times the event is retried.
+    FSM_HOOK_EVENT( state, event );
+    for( size_t attempt = 0;; ++attempt )
+    {
+        transition_t* transition = fsm_concurrent_select( fsm, state, event );
+        if( !transition )
+        {
+            return FSM_CAS_NOT_TAKEN;
+        }
+
+        // Commit, a weak compare and swap may fail spuriously with the state unchanged. Only the pointer is
+        // compared, so transitions back to this state by other threads go undetected (see the file details).
+        state_t* expected = state;
+        while( !fsm_atomic_compare_exchange_weak( &fsm->currentState, &expected, transition->nextState, memory_order_acq_rel ) &&
+               ( expected == state ) )
+        {
+        }
+
+        if( expected == state )
+        {
+            FSM_HOOK_ACTIONS_BEGIN( state, transition );
+            if( state->exitAction )
+            {
+                FSM_INVOKE( state->exitAction, fsm->context, state->data, event );
+            }
+            if( transition->action )
+            {
+                FSM_INVOKE( transition->action, fsm->context, state->data, event );
+            }
+            if( transition->nextState->entryAction )
+            {
+                FSM_INVOKE( transition->nextState->entryAction, fsm->context, transition->nextState->data, event );
+            }
+            FSM_HOOK_ACTIONS_END( state, transition );
+            return FSM_CAS_TAKEN;
+        }
+
+        if( attempt == maxRetries )
+        {
+            return FSM_CAS_CONFLICT;
+        }
+        state = fsm_atomic_load( &fsm->currentState, memory_order_acquire );
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -26,8 +26,31 @@ SOFTWARE.
 #ifndef FINITE_STATE_MACHINE_CONF_H
 #define FINITE_STATE_MACHINE_CONF_H
 
+#include <stddef.h>
 #include <stdint.h>
 
+#ifndef FSM_ENABLE_EVENT_PAYLOAD
+#define FSM_ENABLE_EVENT_PAYLOAD 0 /*< Events carry a payload, referenced or held inline (see fsm_event_payload()). */
+#endif
+
+#ifndef FSM_ENABLE_CONTEXT
+#define FSM_ENABLE_CONTEXT 0 /*< Guards and actions also receive the state machine's context (see FSM_CALLBACK_PARAMS). */
+#endif
+
+#ifndef FSM_ENABLE_ASYNC
+#define FSM_ENABLE_ASYNC 0 /*< Transition actions may wait for I/O without blocking the thread (see fsm_async_begin()). */
+#endif
+
+/*
+ * Define FSM_IMPLEMENTATION in exactly one source file of the program, before including any of the headers,
+ * to define the variables shared by all source files. It is needed with FSM_ENABLE_ASYNC, FSM_ENABLE_STATS and
+ * FSM_ENABLE_TRACE, and leaving it out is a link error.
+ */
+
+#ifndef FSM_EVENT_INLINE_SIZE
+#define FSM_EVENT_INLINE_SIZE 16 /*< The bytes of payload an event can hold inline (FSM_ENABLE_EVENT_PAYLOAD), 0 for none. */
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -37,12 +60,115 @@ extern "C" {
 typedef int32_t data_t;     /*< Generic data passed to guards and actions (could be an enumeration for a state identifier). */
 typedef int32_t event_id_t; /*< User defined type for an event identifier. */
 
+typedef uint16_t fsm_index_t;      /*< Transition numbers stored in event lookup tables (uint8_t suffices for states with fewer than 255 transitions). */
+typedef uint8_t fsm_state_index_t; /*< A state's position in a state table, used by compact populations (uint16_t for more than 255 states). */
+
 typedef struct
 {
     event_id_t ID; /*< A unique event identifier (could be an enumeration) */
     data_t data;   /*< User defined data to be included with each event. */
+#if FSM_ENABLE_EVENT_PAYLOAD
+    const void* payload; /*< The payload, not copied (NULL for none or the inline payload). */
+    size_t payloadSize;  /*< The size of the payload in bytes. */
+#if FSM_EVENT_INLINE_SIZE
+    union
+    {
+        uint64_t align;                               /*< Aligns the bytes for any scalar type. */
+        void* pointer;                                /*< Aligns the bytes for pointers. */
+        double real;                                  /*< Aligns the bytes for floating point. */
+        unsigned char bytes[ FSM_EVENT_INLINE_SIZE ]; /*< The payload when *payload* is NULL and *payloadSize* is not 0. */
+    } inlinePayload;
+#endif
+#endif
 } event_t;
 
+/* The parameters of guards and actions, with FSM_ENABLE_CONTEXT preceded by the user context of the state machine
+ * (for example a session) so callbacks reach per instance data directly. FSM_INVOKE() calls a callback. */
+#if FSM_ENABLE_CONTEXT
+#define FSM_CALLBACK_PARAMS                          void* context, data_t stateData, event_t* event
+#define FSM_INVOKE( CALLBACK, CONTEXT, DATA, EVENT ) ( CALLBACK )( CONTEXT, DATA, EVENT )
+#else
+#define FSM_CALLBACK_PARAMS                          data_t stateData, event_t* event
+#define FSM_INVOKE( CALLBACK, CONTEXT, DATA, EVENT ) ( CALLBACK )( DATA, EVENT )
+#endif
+
+/* Optional features of the state machine in finite_state_machine.h (0 = disabled, 1 = enabled). */
+
+#ifndef FSM_ENABLE_INDEXED_DISPATCH
+#define FSM_ENABLE_INDEXED_DISPATCH 0 /*< Per-state event lookup tables (see SM_EVENT_INDEX and fsm_index_state()). */
+#endif
+
+#ifndef FSM_ENABLE_SORTED_DISPATCH
+#define FSM_ENABLE_SORTED_DISPATCH 0 /*< Binary search of transitions sorted by event ID (see fsm_sort_transitions()). */
+#endif
+
+#ifndef FSM_ENABLE_PACKED_KEYS
+#define FSM_ENABLE_PACKED_KEYS 0 /*< Event IDs are also kept in a packed array per state for scanning (see fsm_pack_keys()). */
+#endif
+
+#ifndef FSM_ENABLE_EVENT_FILTER
+#define FSM_ENABLE_EVENT_FILTER 0 /*< Per-state filters reject unhandled events in one check, and default transitions (see fsm_filter_state()). */
+#endif
+
+#ifndef FSM_DEFAULT_EVENT
+#define FSM_DEFAULT_EVENT ( ( event_id_t )-1 ) /*< The event ID of default transitions (see SM_DEFAULT_TRANSITION), reserved. */
+#endif
+
+#ifndef FSM_KEYS_SIMD
+#define FSM_KEYS_SIMD 1 /*< Packed keys are compared with the vector instructions the compiler targets, 0 for scalar. */
+#endif
+
+#ifndef FSM_ENABLE_GUARD_FALLTHROUGH
+#define FSM_ENABLE_GUARD_FALLTHROUGH 0 /*< A failed guard tries the next transition listed for the same event (see fsm_group_transitions()). */
+#endif
+
+#ifndef FSM_ENABLE_HIERARCHY
+#define FSM_ENABLE_HIERARCHY 0 /*< States may be nested, unhandled events are passed to the enclosing state. */
+#endif
+
+#ifndef FSM_HIERARCHY_MAX_DEPTH
+#define FSM_HIERARCHY_MAX_DEPTH 8 /*< The maximum nesting levels (FSM_ENABLE_HIERARCHY), the outermost state counts as one. */
+#endif
+
+#ifndef FSM_ENABLE_EVENT_QUEUE
+#define FSM_ENABLE_EVENT_QUEUE 0 /*< Events raised while a state machine is handling an event are queued (see fsm_post_event()). */
+#endif
+
+#ifndef FSM_EVENT_QUEUE_SIZE
+#define FSM_EVENT_QUEUE_SIZE 8 /*< The number of events each state machine can hold queued (FSM_ENABLE_EVENT_QUEUE). */
+#endif
+
+#ifndef FSM_ENABLE_TIMEOUTS
+#define FSM_ENABLE_TIMEOUTS 0 /*< States may declare a timeout event (see SM_TIMEOUT and finite_state_machine_timer.h). */
+#endif
+
+#ifndef FSM_ENABLE_TRACE
+#define FSM_ENABLE_TRACE 0 /*< Record every event handled in binary trace rings (see finite_state_machine_trace.h). */
+#endif
+
+#ifndef FSM_ENABLE_STATS
+#define FSM_ENABLE_STATS 0 /*< Per-state and per-transition counters (see finite_state_machine_stats.h). */
+#endif
+
+#ifndef FSM_ENABLE_STATS_TIMING
+#define FSM_ENABLE_STATS_TIMING 0 /*< Also count the cycles spent in guards and actions (needs FSM_ENABLE_STATS). */
+#endif
+
+#ifndef FSM_STATS_MAX_THREADS
+#define FSM_STATS_MAX_THREADS 8 /*< The number of threads with their own counters, further threads share them. */
+#endif
+
+/* Instrumentation hooks called by fsm_handle_event(), defined here to route them to your own code. Hooks left
+ * undefined call the built in counters when FSM_ENABLE_STATS is set and otherwise compile to nothing.
+ *
+ * FSM_HOOK_EVENT( state, event )                  An event is about to be handled.
+ * FSM_HOOK_UNMATCHED( state, event )              The state has no transition for the event.
+ * FSM_HOOK_GUARD_BEGIN( state, transition )       Before a guard is called (a statement, may declare variables).
+ * FSM_HOOK_GUARD_END( state, transition, passed ) After a guard returned.
+ * FSM_HOOK_ACTIONS_BEGIN( state, transition )     Before the exit, transition and entry actions (may declare variables).
+ * FSM_HOOK_ACTIONS_END( state, transition )       After the actions, the transition has been taken.
+ */
+
 #ifdef __cplusplus
 }
 #endif
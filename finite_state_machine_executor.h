@@ -0,0 +1,408 @@
+/*******************************************************************************
+MIT License
+
+Copyright (c) 2024 Julian Mitchell
+https://github.com/jupeos/fsm
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+
+#ifndef FINITE_STATE_MACHINE_EXECUTOR_H
+#define FINITE_STATE_MACHINE_EXECUTOR_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "finite_state_machine.h"
+#include "finite_state_machine_port.h"
+
+/**
+ * @file finite_state_machine_executor.h
+ * @author Julian Mitchell
+ * @date 25th Jan 2024
+ * @brief A multi-threaded executor for large populations of state machines.
+ *
+ * @details The executor owns a pool of worker threads that handle events for an array of state machine
+ * instances, typically sharing the same read-only state graph. Instances are divided between shards by
+ * instance ID (instance % shards) and each shard has a lock-free multiple producer queue and a home worker
+ * (shard % workers). A shard is only ever drained by one worker at a time so events for an instance are
+ * handled in the order they were posted, without locks around fsm_handle_event(). A worker with nothing
+ * to do on its home shards steals the drain of another shard with pending events.
+ *
+ * Requires POSIX threads, storage is allocated when the executor starts and freed when it stops.
+ *
+ * Example usage:
+ * @code
+ *    #include "finite_state_machine_executor.h"
+ *
+ *    static state_machine_t sessions[ 100000 ];
+ *    static fsm_executor_t executor;
+ *
+ *    void start( void )
+ *    {
+ *        for( size_t i = 0; i < 100000; ++i )
+ *        {
+ *            sessions[ i ].currentState = &doorClosedState;
+ *        }
+ *        fsm_executor_start( &executor, sessions, 100000, 4, 8, 1024 );
+ *    }
+ *
+ *    // Any thread.
+ *    void openFunc( size_t session )
+ *    {
+ *        event_t event = { .ID = EVENT_OPEN, .data = 0 };
+ *        fsm_executor_post( &executor, session, &event );
+ *    }
+ * @endcode
+ */
+
+#ifndef FSM_EXECUTOR_BATCH_SIZE
+#define FSM_EXECUTOR_BATCH_SIZE 64 /*< The most events a worker handles from a shard before looking at other shards. */
+#endif
+
+#ifndef FSM_EXECUTOR_IDLE_SPINS
+#define FSM_EXECUTOR_IDLE_SPINS 64 /*< Idle passes (yielding) before an idle worker starts sleeping between passes. */
+#endif
+
+#ifndef FSM_EXECUTOR_IDLE_SLEEP_NS
+#define FSM_EXECUTOR_IDLE_SLEEP_NS 50000 /*< How long an idle worker sleeps between passes. */
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief An event addressed to a state machine instance.
+ */
+typedef struct
+{
+    size_t instance; /*< The index of the target instance.*/
+    event_t event;   /*< The event.*/
+} fsm_executor_item_t;
+
+/**
+ * @brief A slot of a shard queue.
+ */
+typedef struct
+{
+    FSM_ATOMIC( size_t ) sequence; /*< Tells producers and the consumer whose turn it is to use the slot.*/
+    fsm_executor_item_t item;      /*< The queued event.*/
+} fsm_executor_slot_t;
+
+/**
+ * @brief A shard, a queue of events for a subset of the instances.
+ * @note The queue works like fsm_mpsc_queue_t, except the consumer is whichever worker holds *busy*.
+ */
+typedef struct
+{
+    FSM_ALIGNAS( FSM_CACHE_LINE_SIZE ) FSM_ATOMIC( size_t ) tail; /*< The next slot to claim, shared by producers.*/
+    FSM_ALIGNAS( FSM_CACHE_LINE_SIZE ) FSM_ATOMIC( bool ) busy;   /*< Set while a worker is draining the shard.*/
+    size_t head;                                                 /*< The next slot to read, owned by the worker holding busy.*/
+    fsm_executor_slot_t* slots;                                  /*< The slot storage.*/
+    size_t mask;                                                 /*< The capacity - 1.*/
+} fsm_executor_shard_t;
+
+struct fsm_executor;
+
+/**
+ * @brief A worker thread.
+ */
+typedef struct
+{
+    struct fsm_executor* executor; /*< The executor the worker belongs to.*/
+    size_t index;                  /*< The worker number, its home shards are index, index + numWorkers, ...*/
+    pthread_t thread;              /*< The thread.*/
+} fsm_executor_worker_t;
+
+/**
+ * @brief A sharded executor.
+ */
+typedef struct fsm_executor
+{
+    state_machine_t* instances;    /*< The state machine instances.*/
+    size_t numInstances;           /*< The number of instances.*/
+    fsm_executor_shard_t* shards;  /*< The shards.*/
+    size_t numShards;              /*< The number of shards.*/
+    fsm_executor_worker_t* workers; /*< The worker threads.*/
+    size_t numWorkers;             /*< The number of worker threads.*/
+    FSM_ATOMIC( bool ) running;    /*< Cleared to ask the workers to finish.*/
+} fsm_executor_t;
+
+/**
+ * @brief Post an event to an instance, may be called from any number of threads concurrently.
+ *
+ * @param executor The executor.
+ * @param instance The index of the target instance.
+ * @param event The event to copy into the instance's shard.
+ * @return true The event was queued.
+ * @return false The instance does not exist or its shard's queue is full.
+ */
+static inline bool fsm_executor_post( fsm_executor_t* executor, size_t instance, const event_t* event )
+{
+    if( instance >= executor->numInstances )
+    {
+        return false;
+    }
+
+    fsm_executor_shard_t* shard = &executor->shards[ instance % executor->numShards ];
+    size_t tail = fsm_atomic_load( &shard->tail, memory_order_relaxed );
+    for( ;; )
+    {
+        fsm_executor_slot_t* slot = &shard->slots[ tail & shard->mask ];
+        size_t sequence = fsm_atomic_load( &slot->sequence, memory_order_acquire );
+        intptr_t difference = ( intptr_t )sequence - ( intptr_t )tail;
+        if( difference == 0 )
+        {
+            // The slot is free, try to claim it (on failure tail is reloaded).
+            if( fsm_atomic_compare_exchange_weak( &shard->tail, &tail, tail + 1, memory_order_relaxed ) )
+            {
+                slot->item.instance = instance;
+                slot->item.event = *event;
+                fsm_atomic_store( &slot->sequence, tail + 1, memory_order_release );
+                return true;
+            }
+        }
+        else if( difference < 0 )
+        {
+            // Full.
+            return false;
+        }
+        else
+        {
+            // Another producer claimed the slot first.
+            tail = fsm_atomic_load( &shard->tail, memory_order_relaxed );
+        }
+    }
+}
+
+/**
+ * @brief Handle pending events of a shard, unless another worker is already doing so.
+ *
+ * @param executor The executor.
+ * @param shard The shard to drain.
+ * @return The number of events handled.
+ */
+static inline size_t fsm_executor_drain( fsm_executor_t* executor, fsm_executor_shard_t* shard )
+{
+    size_t handled = 0;
+    // Cheap check first so idle passes do not bounce the busy flag between cores.
+    if( !fsm_atomic_load( &shard->busy, memory_order_relaxed ) && !fsm_atomic_exchange( &shard->busy, true, memory_order_acquire ) )
+    {
+        while( handled < FSM_EXECUTOR_BATCH_SIZE )
+        {
+            // head is only read by the worker that holds busy.
+            fsm_executor_slot_t* slot = &shard->slots[ shard->head & shard->mask ];
+            if( fsm_atomic_load( &slot->sequence, memory_order_acquire ) != shard->head + 1 )
+            {
+                break;
+            }
+            fsm_handle_event( &executor->instances[ slot->item.instance ], &slot->item.event );
+            fsm_atomic_store( &slot->sequence, shard->head + shard->mask + 1, memory_order_release );
+            ++shard->head;
+            ++handled;
+        }
+        fsm_atomic_store( &shard->busy, false, memory_order_release );
+    }
+    return handled;
+}
+
+/**
+ * @brief The worker thread body.
+ *
+ * @param argument The fsm_executor_worker_t.
+ * @return NULL.
+ */
+static inline void* fsm_executor_worker( void* argument )
+{
+    fsm_executor_worker_t* worker = ( fsm_executor_worker_t* )argument;
+    fsm_executor_t* executor = worker->executor;
+    unsigned idlePasses = 0;
+    for( ;; )
+    {
+        bool running = fsm_atomic_load( &executor->running, memory_order_acquire );
+        size_t handled = 0;
+        for( size_t i = worker->index; i < executor->numShards; i += executor->numWorkers )
+        {
+            handled += fsm_executor_drain( executor, &executor->shards[ i ] );
+        }
+
+        if( !handled )
+        {
+            // Nothing at home, help with the first other shard that has work.
+            for( size_t i = 1; ( i < executor->numShards ) && !handled; ++i )
+            {
+                handled = fsm_executor_drain( executor, &executor->shards[ ( worker->index + i ) % executor->numShards ] );
+            }
+        }
+
+        if( handled )
+        {
+            idlePasses = 0;
+        }
+        else if( !running )
+        {
+            // Asked to finish and a full pass found nothing left.
+            break;
+        }
+        else if( ++idlePasses < FSM_EXECUTOR_IDLE_SPINS )
+        {
+            sched_yield();
+        }
+        else
+        {
+            struct timespec pause = { 0, FSM_EXECUTOR_IDLE_SLEEP_NS };
+            nanosleep( &pause, NULL );
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Free the storage of an executor whose workers have exited.
+ *
+ * @param executor The executor.
+ */
+static inline void fsm_executor_free( fsm_executor_t* executor )
+{
+    for( size_t i = 0; executor->shards && ( i < executor->numShards ); ++i )
+    {
+        free( executor->shards[ i ].slots );
+    }
+    free( executor->shards );
+    free( executor->workers );
+    executor->shards = NULL;
+    executor->workers = NULL;
+    executor->numShards = 0;
+    executor->numWorkers = 0;
+}
+
+/**
+ * @brief Stop an executor.
+ *
+ * @details Events already posted are handled before the workers exit, then all storage is freed.
+ * Producers must have stopped posting before this is called.
+ *
+ * @param executor The executor.
+ */
+static inline void fsm_executor_stop( fsm_executor_t* executor )
+{
+    fsm_atomic_store( &executor->running, false, memory_order_release );
+    for( size_t i = 0; i < executor->numWorkers; ++i )
+    {
+        pthread_join( executor->workers[ i ].thread, NULL );
+    }
+    fsm_executor_free( executor );
+}
+
+/**
+ * @brief Start an executor.
+ *
+ * @param executor The executor.
+ * @param instances The state machine instances, each with its initial state set.
+ * @param numInstances The number of instances.
+ * @param numWorkers The number of worker threads.
+ * @param shardsPerWorker The number of shards per worker, more shards make stealing finer grained.
+ * @param queueCapacity The capacity of each shard's queue, a power of two.
+ * @return true The workers are running.
+ * @return false Invalid arguments or out of resources, nothing is left allocated.
+ */
+static inline bool fsm_executor_start( fsm_executor_t* executor,
+                                       state_machine_t* instances,
+                                       size_t numInstances,
+                                       size_t numWorkers,
+                                       size_t shardsPerWorker,
+                                       size_t queueCapacity )
+{
+    if( !numWorkers || !shardsPerWorker || !queueCapacity || ( queueCapacity & ( queueCapacity - 1 ) ) )
+    {
+        return false;
+    }
+
+    executor->instances = instances;
+    executor->numInstances = numInstances;
+    executor->numShards = numWorkers * shardsPerWorker;
+    executor->numWorkers = numWorkers;
+    executor->shards = ( fsm_executor_shard_t* )aligned_alloc( FSM_CACHE_LINE_SIZE, executor->numShards * sizeof( fsm_executor_shard_t ) );
+    executor->workers = ( fsm_executor_worker_t* )calloc( numWorkers, sizeof( fsm_executor_worker_t ) );
+    fsm_atomic_init( &executor->running, true );
+
+    // Every shard owns no slots until its queue is allocated, so a failure part way through frees only those.
+    for( size_t i = 0; executor->shards && ( i < executor->numShards ); ++i )
+    {
+        executor->shards[ i ].slots = NULL;
+    }
+
+    bool retVal = executor->shards && executor->workers;
+    for( size_t i = 0; retVal && ( i < executor->numShards ); ++i )
+    {
+        fsm_executor_shard_t* shard = &executor->shards[ i ];
+        fsm_atomic_init( &shard->tail, ( size_t )0 );
+        fsm_atomic_init( &shard->busy, false );
+        shard->head = 0;
+        shard->mask = queueCapacity - 1;
+        shard->slots = ( fsm_executor_slot_t* )malloc( queueCapacity * sizeof( fsm_executor_slot_t ) );
+        if( shard->slots )
+        {
+            for( size_t j = 0; j < queueCapacity; ++j )
+            {
+                fsm_atomic_init( &shard->slots[ j ].sequence, j );
+            }
+        }
+        else
+        {
+            retVal = false;
+        }
+    }
+
+    size_t started = 0;
+    for( ; retVal && ( started < numWorkers ); ++started )
+    {
+        executor->workers[ started ].executor = executor;
+        executor->workers[ started ].index = started;
+        if( pthread_create( &executor->workers[ started ].thread, NULL, fsm_executor_worker, &executor->workers[ started ] ) != 0 )
+        {
+            retVal = false;
+            break;
+        }
+    }
+
+    if( !retVal )
+    {
+        // Nothing has been posted yet so the workers that did start exit straight away.
+        fsm_atomic_store( &executor->running, false, memory_order_release );
+        for( size_t i = 0; i < started; ++i )
+        {
+            pthread_join( executor->workers[ i ].thread, NULL );
+        }
+        fsm_executor_free( executor );
+    }
+    return retVal;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // FINITE_STATE_MACHINE_EXECUTOR_H
@@ -0,0 +1,549 @@
+/*******************************************************************************
+MIT License
+
+Copyright (c) 2024 Julian Mitchell
+https://github.com/jupeos/fsm
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+
+#ifndef FINITE_STATE_MACHINE_IMAGE_H
+#define FINITE_STATE_MACHINE_IMAGE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined( __unix__ ) || defined( __APPLE__ )
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define FSM_IMAGE_MMAP 1
+#else
+#define FSM_IMAGE_MMAP 0
+#endif
+
+#include "finite_state_machine.h"
+
+/**
+ * @file finite_state_machine_image.h
+ * @author Julian Mitchell
+ * @date 25th Jan 2024
+ * @brief A compact, position independent binary format for state graphs.
+ *
+ * @details An image holds a header, a table of states and a table of transitions. States and transitions
+ * refer to each other by index and to guards and actions by callback ID, resolved through a registry of
+ * function pointers supplied by the process using the image. An image contains no pointers so it is used
+ * in place, straight from a read-only mmap() of the file (many processes then share the same pages) or from
+ * flash, with no parsing or relocation. Each state's transitions are stored sorted by event ID and are
+ * binary searched, transitions with the same event ID keep their order so first match semantics hold.
+ * Sorting brings them together, so with FSM_ENABLE_GUARD_FALLTHROUGH a failed guard falls through to every later
+ * one, as after fsm_group_transitions(), even if the state listed others between them.
+ * Default transitions (SM_DEFAULT_TRANSITION) are stored as transitions for FSM_DEFAULT_EVENT and, with
+ * FSM_ENABLE_EVENT_FILTER, taken for events the state has no transition for.
+ *
+ * Images are written with fsm_image_write() from existing states, for example by a build step, and use
+ * 32 bit state data and event IDs in native byte order (an image of the other byte order is rejected).
+ * An image holds only the states' data, entry and exit actions and transitions. It cannot hold nested states
+ * (FSM_ENABLE_HIERARCHY) or state timeouts (FSM_ENABLE_TIMEOUTS), fsm_image_write() rejects states with either.
+ * fsm_image_handle_event() has no event queue, hooks, stats, trace or asynchronous actions.
+ * fsm_image_attach() only checks the header, call fsm_image_validate() once for images that are not trusted.
+ *
+ * Example usage:
+ * @code
+ *    #include "finite_state_machine_image.h"
+ *
+ *    // The callback IDs are the positions in these tables, 0 means none.
+ *    static void ( *const actions[] )( FSM_CALLBACK_PARAMS ) = { NULL, doorOpenedAction, doorClosedAction };
+ *    static const fsm_image_registry_t registry = { actions, 3, NULL, 0 };
+ *
+ *    fsm_image_file_t file;
+ *    fsm_image_open( &file, "door.fsm" );
+ *    fsm_image_validate( file.image, &registry );
+ *
+ *    fsm_image_machine_t fsm = { file.image, &registry, 0 };
+ *    event_t event = { .ID = EVENT_OPEN, .data = 0 };
+ *    fsm_image_handle_event( &fsm, &event );
+ * @endcode
+ */
+
+#define FSM_IMAGE_MAGIC   0x494d5346u /*< "FSMI" in little endian byte order.*/
+#define FSM_IMAGE_VERSION 1u
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief The header at the start of an image, offsets are from the start of the image.
+ */
+typedef struct
+{
+    uint32_t magic;             /*< FSM_IMAGE_MAGIC.*/
+    uint32_t version;           /*< FSM_IMAGE_VERSION.*/
+    uint32_t size;              /*< The size of the image in bytes.*/
+    uint32_t numStates;         /*< The number of states.*/
+    uint32_t numTransitions;    /*< The number of transitions.*/
+    uint32_t statesOffset;      /*< The offset of the state table.*/
+    uint32_t transitionsOffset; /*< The offset of the transition table.*/
+    uint32_t reserved;          /*< Zero.*/
+} fsm_image_header_t;
+
+/**
+ * @brief A state in an image.
+ */
+typedef struct
+{
+    int32_t data;             /*< User defined data.*/
+    uint16_t entryAction;     /*< The callback ID of the entry action (0 = none).*/
+    uint16_t exitAction;      /*< The callback ID of the exit action (0 = none).*/
+    uint32_t firstTransition; /*< The index of the state's first transition.*/
+    uint32_t numTransitions;  /*< The number of transitions.*/
+} fsm_image_state_t;
+
+/**
+ * @brief A transition in an image.
+ */
+typedef struct
+{
+    int32_t eventID;    /*< The event that triggers this transition.*/
+    uint32_t nextState; /*< The index of the state to transition to.*/
+    uint16_t guard;     /*< The callback ID of the guard (0 = none).*/
+    uint16_t action;    /*< The callback ID of the action (0 = none).*/
+} fsm_image_transition_t;
+
+/**
+ * @brief The callbacks an image refers to, ID n is entry n of a table and entry 0 is unused.
+ */
+typedef struct
+{
+    void ( *const *actions )( FSM_CALLBACK_PARAMS ); /*< Entry, exit and transition actions.*/
+    size_t numActions;                               /*< The number of entries in actions.*/
+    bool ( *const *guards )( FSM_CALLBACK_PARAMS );  /*< Guards.*/
+    size_t numGuards;                                /*< The number of entries in guards.*/
+} fsm_image_registry_t;
+
+/**
+ * @brief A state machine whose states are in an image.
+ */
+typedef struct
+{
+    const fsm_image_header_t* image;      /*< The image.*/
+    const fsm_image_registry_t* registry; /*< The callbacks the image refers to.*/
+    uint32_t currentState;                /*< The index of the current state.*/
+#if FSM_ENABLE_CONTEXT
+    void* context; /*< User data passed to every guard and action.*/
+#endif
+} fsm_image_machine_t;
+
+/**
+ * @brief Get the state table of an image.
+ *
+ * @param image The image.
+ * @return The states.
+ */
+static inline const fsm_image_state_t* fsm_image_states( const fsm_image_header_t* image )
+{
+    return ( const fsm_image_state_t* )( ( const char* )image + image->statesOffset );
+}
+
+/**
+ * @brief Get the transition table of an image.
+ *
+ * @param image The image.
+ * @return The transitions.
+ */
+static inline const fsm_image_transition_t* fsm_image_transitions( const fsm_image_header_t* image )
+{
+    return ( const fsm_image_transition_t* )( ( const char* )image + image->transitionsOffset );
+}
+
+/**
+ * @brief Get the size of the image of a state graph.
+ *
+ * @param numStates The number of states.
+ * @param numTransitions The total number of transitions.
+ * @return The size in bytes.
+ */
+static inline size_t fsm_image_size( size_t numStates, size_t numTransitions )
+{
+    return sizeof( fsm_image_header_t ) + ( numStates * sizeof( fsm_image_state_t ) ) + ( numTransitions * sizeof( fsm_image_transition_t ) );
+}
+
+/**
+ * @brief Find the callback ID of an action.
+ *
+ * @param registry The registry.
+ * @param action The action (optional).
+ * @param id Receives the ID, 0 for no action.
+ * @return true The action has an ID.
+ */
+static inline bool fsm_image_action_id( const fsm_image_registry_t* registry, void ( *action )( FSM_CALLBACK_PARAMS ), uint16_t* id )
+{
+    *id = 0;
+    for( size_t i = 1; action && ( i < registry->numActions ) && ( i <= UINT16_MAX ); ++i )
+    {
+        if( registry->actions[ i ] == action )
+        {
+            *id = ( uint16_t )i;
+            break;
+        }
+    }
+    return !action || *id;
+}
+
+/**
+ * @brief Find the callback ID of a guard.
+ *
+ * @param registry The registry.
+ * @param guard The guard (optional).
+ * @param id Receives the ID, 0 for no guard.
+ * @return true The guard has an ID.
+ */
+static inline bool fsm_image_guard_id( const fsm_image_registry_t* registry, bool ( *guard )( FSM_CALLBACK_PARAMS ), uint16_t* id )
+{
+    *id = 0;
+    for( size_t i = 1; guard && ( i < registry->numGuards ) && ( i <= UINT16_MAX ); ++i )
+    {
+        if( registry->guards[ i ] == guard )
+        {
+            *id = ( uint16_t )i;
+            break;
+        }
+    }
+    return !guard || *id;
+}
+
+/**
+ * @brief Write the image of a state graph.
+ *
+ * @details State n of the image is states[ n ], which is also the index to start an fsm_image_machine_t in.
+ *
+ * @param states The states of the graph, every next state must be one of them.
+ * @param numStates The number of states.
+ * @param registry The callbacks, every guard and action of the states must be in it.
+ * @param buffer Receives the image, aligned for uint32_t.
+ * @param capacity The size of buffer, see fsm_image_size().
+ * @return The size of the image or 0 if the buffer is too small, a next state or callback is missing or a state
+ * is nested or has a timeout.
+ */
+static inline size_t fsm_image_write( state_t* const* states, size_t numStates, const fsm_image_registry_t* registry, void* buffer, size_t capacity )
+{
+    size_t numTransitions = 0;
+    for( size_t i = 0; i < numStates; ++i )
+    {
+        numTransitions += states[ i ]->numTransitions;
+    }
+
+    size_t size = fsm_image_size( numStates, numTransitions );
+    if( ( size > capacity ) || ( size > UINT32_MAX ) )
+    {
+        return 0;
+    }
+
+    memset( buffer, 0, size );
+    fsm_image_header_t* image = ( fsm_image_header_t* )buffer;
+    image->magic = FSM_IMAGE_MAGIC;
+    image->version = FSM_IMAGE_VERSION;
+    image->size = ( uint32_t )size;
+    image->numStates = ( uint32_t )numStates;
+    image->numTransitions = ( uint32_t )numTransitions;
+    image->statesOffset = ( uint32_t )sizeof( fsm_image_header_t );
+    image->transitionsOffset = ( uint32_t )( sizeof( fsm_image_header_t ) + ( numStates * sizeof( fsm_image_state_t ) ) );
+
+    fsm_image_state_t* imageStates = ( fsm_image_state_t* )( ( char* )buffer + image->statesOffset );
+    fsm_image_transition_t* imageTransitions = ( fsm_image_transition_t* )( ( char* )buffer + image->transitionsOffset );
+    bool retVal = true;
+    uint32_t first = 0;
+    for( size_t i = 0; retVal && ( i < numStates ); ++i )
+    {
+        const state_t* state = states[ i ];
+        fsm_image_state_t* imageState = &imageStates[ i ];
+        imageState->data = ( int32_t )state->data;
+        imageState->firstTransition = first;
+        imageState->numTransitions = ( uint32_t )state->numTransitions;
+        retVal = fsm_image_action_id( registry, state->entryAction, &imageState->entryAction ) &&
+                 fsm_image_action_id( registry, state->exitAction, &imageState->exitAction );
+#if FSM_ENABLE_HIERARCHY
+        // The transitions a nested state inherits and its enclosing states' actions are not in the image.
+        retVal = retVal && !state->parent;
+#endif
+#if FSM_ENABLE_TIMEOUTS
+        retVal = retVal && !state->timeoutTicks;
+#endif
+
+        for( size_t j = 0; retVal && ( j < state->numTransitions ); ++j )
+        {
+            const transition_t* transition = &state->transitions[ j ];
+            fsm_image_transition_t imageTransition = { ( int32_t )transition->eventID, ( uint32_t )numStates, 0, 0 };
+            for( size_t k = 0; k < numStates; ++k )
+            {
+                if( states[ k ] == transition->nextState )
+                {
+                    imageTransition.nextState = ( uint32_t )k;
+                    break;
+                }
+            }
+            retVal = ( imageTransition.nextState < numStates ) && fsm_image_guard_id( registry, transition->guard, &imageTransition.guard ) &&
+                     fsm_image_action_id( registry, transition->action, &imageTransition.action );
+
+            // Insert in event ID order, after any transitions with the same event ID.
+            size_t k = j;
+            while( ( k > 0 ) && ( imageTransitions[ first + k - 1 ].eventID > imageTransition.eventID ) )
+            {
+                imageTransitions[ first + k ] = imageTransitions[ first + k - 1 ];
+                --k;
+            }
+            imageTransitions[ first + k ] = imageTransition;
+        }
+        first += ( uint32_t )state->numTransitions;
+    }
+    return retVal ? size : 0;
+}
+
+/**
+ * @brief Use an image in place, O(1).
+ *
+ * @details Checks the header: the magic number (which also rejects the other byte order), the version and
+ * that the tables fit in the data.
+ *
+ * @param data The image, aligned for uint32_t.
+ * @param size The number of bytes available.
+ * @return The image or NULL if the header is not valid.
+ */
+static inline const fsm_image_header_t* fsm_image_attach( const void* data, size_t size )
+{
+    const fsm_image_header_t* image = ( const fsm_image_header_t* )data;
+    if( !data || ( size < sizeof( fsm_image_header_t ) ) || ( ( uintptr_t )data % sizeof( uint32_t ) ) )
+    {
+        return NULL;
+    }
+
+    uint64_t statesEnd = ( uint64_t )image->statesOffset + ( ( uint64_t )image->numStates * sizeof( fsm_image_state_t ) );
+    uint64_t transitionsEnd = ( uint64_t )image->transitionsOffset + ( ( uint64_t )image->numTransitions * sizeof( fsm_image_transition_t ) );
+    bool valid = ( image->magic == FSM_IMAGE_MAGIC ) && ( image->version == FSM_IMAGE_VERSION ) && ( image->size <= size ) &&
+                 ( image->statesOffset >= sizeof( fsm_image_header_t ) ) && ( ( image->statesOffset % sizeof( uint32_t ) ) == 0 ) &&
+                 ( image->transitionsOffset >= sizeof( fsm_image_header_t ) ) && ( ( image->transitionsOffset % sizeof( uint32_t ) ) == 0 ) &&
+                 ( statesEnd <= image->size ) && ( transitionsEnd <= image->size );
+    return valid ? image : NULL;
+}
+
+/**
+ * @brief Check every state and transition of an image against a registry, O(states + transitions).
+ *
+ * @param image The image.
+ * @param registry The callbacks the image will be used with.
+ * @return true Every index and callback ID is in range (ID 0, none, always is) and each state's transitions are
+ * in event ID order.
+ */
+static inline bool fsm_image_validate( const fsm_image_header_t* image, const fsm_image_registry_t* registry )
+{
+    const fsm_image_state_t* states = fsm_image_states( image );
+    const fsm_image_transition_t* transitions = fsm_image_transitions( image );
+    for( uint32_t i = 0; i < image->numStates; ++i )
+    {
+        const fsm_image_state_t* state = &states[ i ];
+        if( ( state->entryAction && ( state->entryAction >= registry->numActions ) ) || ( state->exitAction && ( state->exitAction >= registry->numActions ) ) ||
+            ( state->firstTransition > image->numTransitions ) || ( state->numTransitions > ( image->numTransitions - state->firstTransition ) ) )
+        {
+            return false;
+        }
+
+        for( uint32_t j = state->firstTransition; j < ( state->firstTransition + state->numTransitions ); ++j )
+        {
+            const fsm_image_transition_t* transition = &transitions[ j ];
+            if( ( transition->nextState >= image->numStates ) || ( transition->guard && ( transition->guard >= registry->numGuards ) ) ||
+                ( transition->action && ( transition->action >= registry->numActions ) ) || ( ( j > state->firstTransition ) && ( transitions[ j - 1 ].eventID > transition->eventID ) ) )
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Find the first transition of an image state for an event.
+ *
+ * @param image The image.
+ * @param state The state.
+ * @param eventID The event ID.
+ * @return The transition or NULL if there is none.
+ */
+static inline const fsm_image_transition_t* fsm_image_find_transition( const fsm_image_header_t* image, const fsm_image_state_t* state, event_id_t eventID )
+{
+    const fsm_image_transition_t* transitions = fsm_image_transitions( image ) + state->firstTransition;
+    size_t low = 0;
+    size_t high = state->numTransitions;
+    while( low < high )
+    {
+        size_t mid = low + ( ( high - low ) / 2 );
+        if( transitions[ mid ].eventID < ( int32_t )eventID )
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return ( ( low < state->numTransitions ) && ( transitions[ low ].eventID == ( int32_t )eventID ) ) ? &transitions[ low ] : NULL;
+}
+
+/**
+ * @brief Image state machine event handler.
+ *
+ * @details Dispatches as fsm_handle_event() does for flat states: the first transition for the event (or,
+ * with FSM_ENABLE_EVENT_FILTER, the default transition) is taken if its guard passes, with guard fall-through
+ * as described above. Events are not queued and no hooks, stats or trace records are produced.
+ *
+ * @param fsm The state machine instance.
+ * @param event The event to process.
+ * @return true A successful transistion to another state.
+ * @return false No valid transition found or the guard condition failed.
+ */
+static inline bool fsm_image_handle_event( fsm_image_machine_t* fsm, event_t* event )
+{
+    const fsm_image_registry_t* registry = fsm->registry;
+    const fsm_image_state_t* states = fsm_image_states( fsm->image );
+    const fsm_image_state_t* state = &states[ fsm->currentState ];
+    const fsm_image_transition_t* transition = fsm_image_find_transition( fsm->image, state, event->ID );
+#if FSM_ENABLE_EVENT_FILTER
+    // Events no transition is for take the state's default transition, which has no alternatives.
+    if( !transition )
+    {
+        transition = fsm_image_find_transition( fsm->image, state, FSM_DEFAULT_EVENT );
+    }
+#endif
+    if( !transition )
+    {
+        return false;
+    }
+
+#if FSM_ENABLE_GUARD_FALLTHROUGH
+    // A failed guard tries the alternatives that follow for the same event.
+    const fsm_image_transition_t* end = fsm_image_transitions( fsm->image ) + state->firstTransition + state->numTransitions;
+    while( transition->guard && !FSM_INVOKE( registry->guards[ transition->guard ], fsm->context, ( data_t )state->data, event ) )
+    {
+        if( ( ++transition == end ) || ( transition->eventID != ( int32_t )event->ID ) )
+        {
+            return false;
+        }
+    }
+#else
+    if( transition->guard && !FSM_INVOKE( registry->guards[ transition->guard ], fsm->context, ( data_t )state->data, event ) )
+    {
+        return false;
+    }
+#endif
+
+    // Perform the exit action, the transition action, move to the next state then perform its entry action.
+    if( state->exitAction )
+    {
+        FSM_INVOKE( registry->actions[ state->exitAction ], fsm->context, ( data_t )state->data, event );
+    }
+    if( transition->action )
+    {
+        FSM_INVOKE( registry->actions[ transition->action ], fsm->context, ( data_t )state->data, event );
+    }
+    fsm->currentState = transition->nextState;
+    const fsm_image_state_t* next = &states[ transition->nextState ];
+    if( next->entryAction )
+    {
+        FSM_INVOKE( registry->actions[ next->entryAction ], fsm->context, ( data_t )next->data, event );
+    }
+    return true;
+}
+
+#if FSM_IMAGE_MMAP
+/**
+ * @brief An image mapped from a file.
+ */
+typedef struct
+{
+    const fsm_image_header_t* image; /*< The image, NULL if the file could not be used.*/
+    void* base;                      /*< The start of the mapping.*/
+    size_t length;                   /*< The length of the mapping.*/
+} fsm_image_file_t;
+
+/**
+ * @brief Map an image file read-only, processes mapping the same file share its pages.
+ *
+ * @param file Receives the mapping.
+ * @param path The file.
+ * @return true The image is mapped and its header is valid (see fsm_image_attach()).
+ */
+static inline bool fsm_image_open( fsm_image_file_t* file, const char* path )
+{
+    file->image = NULL;
+    file->base = NULL;
+    file->length = 0;
+
+    int fd = open( path, O_RDONLY );
+    if( fd < 0 )
+    {
+        return false;
+    }
+
+    struct stat info;
+    if( ( fstat( fd, &info ) == 0 ) && ( info.st_size > 0 ) )
+    {
+        void* base = mmap( NULL, ( size_t )info.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+        if( base != MAP_FAILED )
+        {
+            file->base = base;
+            file->length = ( size_t )info.st_size;
+            file->image = fsm_image_attach( base, file->length );
+        }
+    }
+    close( fd );
+
+    if( file->base && !file->image )
+    {
+        munmap( file->base, file->length );
+        file->base = NULL;
+        file->length = 0;
+    }
+    return file->image != NULL;
+}
+
+/**
+ * @brief Unmap an image file, no state machine may still be using it.
+ *
+ * @param file The mapping.
+ */
+static inline void fsm_image_close( fsm_image_file_t* file )
+{
+    if( file->base )
+    {
+        munmap( file->base, file->length );
+    }
+    file->image = NULL;
+    file->base = NULL;
+    file->length = 0;
+}
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
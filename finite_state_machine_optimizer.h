@@ -0,0 +1,630 @@
+/*******************************************************************************
+MIT License
+
+Copyright (c) 2024 Julian Mitchell
+https://github.com/jupeos/fsm
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+
+
+#ifndef FINITE_STATE_MACHINE_OPTIMIZER_H
+#define FINITE_STATE_MACHINE_OPTIMIZER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "finite_state_machine.h"
+#include "finite_state_machine_builder.h"
+
+/**
+ * @file finite_state_machine_optimizer.h
+ * @author Julian Mitchell
+ * @date 25th Jan 2024
+ * @brief Minimise a state graph and rebuild it as one flat table.
+ *
+ * @details fsm_optimize_graph() takes a table of states and the states instances start in, and builds (see
+ * finite_state_machine_builder.h) a graph that behaves the same for every sequence of events with:
+ * - no unreachable states, those no chain of transitions leads to from a start state (the enclosing states of
+ *   reachable states are kept, FSM_ENABLE_HIERARCHY);
+ * - no transitions that can never be taken under first match, see fsm_transition_shadowed();
+ * - one state for each set of equivalent states, states with the same data, actions, guards, options and
+ *   transitions (compared in order) leading to equivalent states. States that enclose others are not merged
+ *   as their entry and exit actions depend on which of them a transition crosses.
+ *
+ * Equivalence is found by partition refinement, starting from states grouped by their own fields and splitting
+ * groups until every member's transitions lead to the same groups. Each pass sorts the states, so a graph is
+ * optimised in O( passes * n log n ) time, the number of passes being the length of the longest chain of states
+ * told apart only by where they lead (a few for most graphs). The report gives what was removed and where each
+ * state went.
+ *
+ * Example usage:
+ * @code
+ *    #include "finite_state_machine_optimizer.h"
+ *
+ *    size_t start = 0;
+ *    size_t map[ NUM_STATES ];
+ *    fsm_optimize_report_t report = { .stateMap = map };
+ *    fsm_graph_t* graph = fsm_optimize_graph( states, NUM_STATES, &start, 1, &report, NULL );
+ *
+ *    state_machine_t fsm = { .currentState = &graph->states[ map[ start ] ] };
+ * @endcode
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief What was removed from a graph.
+ */
+typedef enum
+{
+    FSM_OPTIMIZE_UNREACHABLE, /*< An unreachable state.*/
+    FSM_OPTIMIZE_MERGED,      /*< A state equivalent to an earlier one in the table.*/
+    FSM_OPTIMIZE_SHADOWED,    /*< A transition that can never be taken.*/
+} fsm_optimize_removal_t;
+
+/**
+ * @brief The result of optimising a graph.
+ */
+typedef struct
+{
+    size_t unreachableStates;   /*< The number of unreachable states removed.*/
+    size_t mergedStates;        /*< The number of states merged into an equivalent state.*/
+    size_t shadowedTransitions; /*< The number of transitions of the states kept that could never be taken.*/
+    size_t numStates;           /*< The number of states in the optimised graph.*/
+    size_t numTransitions;      /*< The number of transitions in the optimised graph.*/
+    size_t* stateMap;           /*< The number of each table state in the optimised graph, SIZE_MAX if unreachable (optional, set by the caller).*/
+} fsm_optimize_report_t;
+
+/**
+ * @brief A state and its index in the table, for looking states up by address.
+ */
+typedef struct
+{
+    const state_t* state; /*< The state.*/
+    size_t index;         /*< Its index in the table.*/
+} fsm_optimize_entry_t;
+
+/**
+ * @brief A state's place in a refinement pass.
+ */
+typedef struct
+{
+    size_t group;    /*< The state's group.*/
+    uint64_t hash;   /*< A hash of what distinguishes the state within its group.*/
+    size_t index;    /*< The state's index in the table.*/
+    size_t newGroup; /*< The state's group after the pass.*/
+} fsm_optimize_key_t;
+
+/**
+ * @brief Working storage of fsm_optimize_graph().
+ */
+typedef struct
+{
+    state_t* const* states;         /*< The state table.*/
+    size_t numStates;               /*< The number of states in the table.*/
+    fsm_optimize_entry_t* byState;  /*< The states in address order.*/
+    size_t* first;                  /*< The position of each state's first transition in *kept*.*/
+    bool* kept;                     /*< Whether each transition can be taken.*/
+    size_t* targets;                /*< The table index of each transition's next state.*/
+    size_t* parents;                /*< The table index of each state's enclosing state (SIZE_MAX = none).*/
+    bool* enclosing;                /*< The state encloses others.*/
+    size_t* groups;                 /*< The group of each reachable state (SIZE_MAX = unreachable).*/
+    fsm_optimize_key_t* keys;       /*< The reachable states ordered for a refinement pass.*/
+} fsm_optimizer_t;
+
+/**
+ * @brief Order lookup entries by state address, see qsort().
+ */
+static inline int fsm_optimize_compare_entries( const void* a, const void* b )
+{
+    uintptr_t x = ( uintptr_t )( ( const fsm_optimize_entry_t* )a )->state;
+    uintptr_t y = ( uintptr_t )( ( const fsm_optimize_entry_t* )b )->state;
+    return ( x > y ) - ( x < y );
+}
+
+/**
+ * @brief Order refinement keys by group, hash then table index, see qsort().
+ */
+static inline int fsm_optimize_compare_keys( const void* a, const void* b )
+{
+    const fsm_optimize_key_t* x = ( const fsm_optimize_key_t* )a;
+    const fsm_optimize_key_t* y = ( const fsm_optimize_key_t* )b;
+    if( x->group != y->group )
+    {
+        return ( x->group > y->group ) - ( x->group < y->group );
+    }
+    if( x->hash != y->hash )
+    {
+        return ( x->hash > y->hash ) - ( x->hash < y->hash );
+    }
+    return ( x->index > y->index ) - ( x->index < y->index );
+}
+
+/**
+ * @brief Find a state in the table.
+ *
+ * @return The index of the state or SIZE_MAX if it is not in the table.
+ */
+static inline size_t fsm_optimize_index_of( const fsm_optimizer_t* optimizer, const state_t* state )
+{
+    size_t low = 0;
+    size_t high = optimizer->numStates;
+    while( low < high )
+    {
+        size_t mid = low + ( ( high - low ) / 2 );
+        if( ( uintptr_t )optimizer->byState[ mid ].state < ( uintptr_t )state )
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return ( ( low < optimizer->numStates ) && ( optimizer->byState[ low ].state == state ) ) ? optimizer->byState[ low ].index : SIZE_MAX;
+}
+
+/**
+ * @brief Mix a value into a hash.
+ */
+static inline uint64_t fsm_optimize_mix( uint64_t hash, uint64_t value )
+{
+    hash ^= value + 0x9e3779b97f4a7c15ull + ( hash << 6 ) + ( hash >> 2 );
+    return hash * 0xff51afd7ed558ccdull;
+}
+
+/**
+ * @brief Hash the fields of a state that must match for it to be equivalent to another, or with *refine* the
+ * groups its transitions lead to.
+ */
+static inline uint64_t fsm_optimize_hash( const fsm_optimizer_t* optimizer, size_t index, bool refine )
+{
+    const state_t* state = optimizer->states[ index ];
+    const size_t first = optimizer->first[ index ];
+    uint64_t hash = 0;
+    if( !refine )
+    {
+        hash = fsm_optimize_mix( hash, ( uint64_t )state->data );
+        hash = fsm_optimize_mix( hash, ( uint64_t )( uintptr_t )state->entryAction );
+        hash = fsm_optimize_mix( hash, ( uint64_t )( uintptr_t )state->exitAction );
+        hash = fsm_optimize_mix( hash, optimizer->enclosing[ index ] ? index : SIZE_MAX );
+        hash = fsm_optimize_mix( hash, optimizer->parents[ index ] );
+    }
+    for( size_t i = 0; i < state->numTransitions; ++i )
+    {
+        if( optimizer->kept[ first + i ] )
+        {
+            const transition_t* transition = &state->transitions[ i ];
+            if( refine )
+            {
+                hash = fsm_optimize_mix( hash, optimizer->groups[ optimizer->targets[ first + i ] ] );
+            }
+            else
+            {
+                hash = fsm_optimize_mix( hash, ( uint64_t )transition->eventID );
+                hash = fsm_optimize_mix( hash, ( uint64_t )( uintptr_t )transition->guard );
+                hash = fsm_optimize_mix( hash, ( uint64_t )( uintptr_t )transition->action );
+            }
+        }
+    }
+    return hash;
+}
+
+/**
+ * @brief Compare what fsm_optimize_hash() hashes for two states.
+ */
+static inline bool fsm_optimize_equal( const fsm_optimizer_t* optimizer, size_t a, size_t b, bool refine )
+{
+    const state_t* x = optimizer->states[ a ];
+    const state_t* y = optimizer->states[ b ];
+    if( !refine )
+    {
+        if( ( x->data != y->data ) || ( x->entryAction != y->entryAction ) || ( x->exitAction != y->exitAction ) ||
+            optimizer->enclosing[ a ] || optimizer->enclosing[ b ] || ( optimizer->parents[ a ] != optimizer->parents[ b ] ) )
+        {
+            return false;
+        }
+#if FSM_ENABLE_INDEXED_DISPATCH
+        if( x->eventIndexCapacity != y->eventIndexCapacity )
+        {
+            return false;
+        }
+#endif
+#if FSM_ENABLE_TIMEOUTS
+        if( ( x->timeoutTicks != y->timeoutTicks ) || ( x->timeoutEvent != y->timeoutEvent ) )
+        {
+            return false;
+        }
+#endif
+    }
+
+    // Walk the transitions that can be taken of both states in step.
+    size_t i = 0;
+    size_t j = 0;
+    for( ;; )
+    {
+        while( ( i < x->numTransitions ) && !optimizer->kept[ optimizer->first[ a ] + i ] )
+        {
+            ++i;
+        }
+        while( ( j < y->numTransitions ) && !optimizer->kept[ optimizer->first[ b ] + j ] )
+        {
+            ++j;
+        }
+        if( ( i == x->numTransitions ) || ( j == y->numTransitions ) )
+        {
+            return ( i == x->numTransitions ) && ( j == y->numTransitions );
+        }
+        if( refine )
+        {
+            if( optimizer->groups[ optimizer->targets[ optimizer->first[ a ] + i ] ] !=
+                optimizer->groups[ optimizer->targets[ optimizer->first[ b ] + j ] ] )
+            {
+                return false;
+            }
+        }
+        else if( ( x->transitions[ i ].eventID != y->transitions[ j ].eventID ) || ( x->transitions[ i ].guard != y->transitions[ j ].guard ) ||
+                 ( x->transitions[ i ].action != y->transitions[ j ].action ) )
+        {
+            return false;
+        }
+        ++i;
+        ++j;
+    }
+}
+
+/**
+ * @brief Split the groups of the reachable states, every state whose fields (or with *refine* whose
+ * transitions' groups) differ from the first of its group moves to a new group.
+ *
+ * @param optimizer The optimizer.
+ * @param count The number of reachable states.
+ * @param refine Split by transition groups rather than by fields.
+ * @return The number of groups.
+ */
+static inline size_t fsm_optimize_split( fsm_optimizer_t* optimizer, size_t count, bool refine )
+{
+    for( size_t i = 0; i < count; ++i )
+    {
+        fsm_optimize_key_t* key = &optimizer->keys[ i ];
+        key->group = refine ? optimizer->groups[ key->index ] : 0;
+        key->hash = fsm_optimize_hash( optimizer, key->index, refine );
+    }
+    qsort( optimizer->keys, count, sizeof( fsm_optimize_key_t ), fsm_optimize_compare_keys );
+
+    // New groups are numbered after the pass so each state is compared against the groups it started with.
+    size_t groups = 0;
+    size_t leader = 0;
+    for( size_t i = 0; i < count; ++i )
+    {
+        const fsm_optimize_key_t* key = &optimizer->keys[ i ];
+        const fsm_optimize_key_t* first = &optimizer->keys[ leader ];
+        if( ( i == 0 ) || ( key->group != first->group ) || ( key->hash != first->hash ) ||
+            !fsm_optimize_equal( optimizer, first->index, key->index, refine ) )
+        {
+            // Hash collisions only ever split a group further, never merge states that differ.
+            leader = i;
+            ++groups;
+        }
+        optimizer->keys[ i ].newGroup = groups - 1;
+    }
+    for( size_t i = 0; i < count; ++i )
+    {
+        optimizer->groups[ optimizer->keys[ i ].index ] = optimizer->keys[ i ].newGroup;
+    }
+    return groups;
+}
+
+/**
+ * @brief Free the working storage of an optimizer.
+ */
+static inline void fsm_optimizer_free( fsm_optimizer_t* optimizer )
+{
+    free( optimizer->byState );
+    free( optimizer->first );
+    free( optimizer->kept );
+    free( optimizer->targets );
+    free( optimizer->parents );
+    free( optimizer->enclosing );
+    free( optimizer->groups );
+    free( optimizer->keys );
+}
+
+/**
+ * @brief Add a state to the reachable states if it is not already one.
+ */
+static inline void fsm_optimize_reach( fsm_optimizer_t* optimizer, size_t index, size_t* reached )
+{
+    if( optimizer->groups[ index ] == SIZE_MAX )
+    {
+        optimizer->groups[ index ] = 0;
+        optimizer->keys[ ( *reached )++ ].index = index;
+    }
+}
+
+/**
+ * @brief Find the states reachable from the start states, groups[] marks them (0) and keys[] lists them.
+ *
+ * @return The number of reachable states or SIZE_MAX if a start state is invalid or a reachable state leads to
+ * (or is nested in) a state not in the table.
+ */
+static inline size_t fsm_optimize_find_reachable( fsm_optimizer_t* optimizer, const size_t* starts, size_t numStarts )
+{
+    size_t reached = 0;
+    for( size_t i = 0; i < ( starts ? numStarts : optimizer->numStates ); ++i )
+    {
+        size_t start = starts ? starts[ i ] : i;
+        if( start >= optimizer->numStates )
+        {
+            return SIZE_MAX;
+        }
+        fsm_optimize_reach( optimizer, start, &reached );
+    }
+
+    // keys[] is also the work list.
+    for( size_t next = 0; next < reached; ++next )
+    {
+        size_t index = optimizer->keys[ next ].index;
+        const state_t* state = optimizer->states[ index ];
+        size_t parent = optimizer->parents[ index ];
+#if FSM_ENABLE_HIERARCHY
+        if( state->parent && ( parent == SIZE_MAX ) )
+        {
+            return SIZE_MAX;
+        }
+#endif
+        if( parent != SIZE_MAX )
+        {
+            // An enclosing state handles the events its nested states do not.
+            optimizer->enclosing[ parent ] = true;
+            fsm_optimize_reach( optimizer, parent, &reached );
+        }
+        for( size_t t = 0; t < state->numTransitions; ++t )
+        {
+            size_t target = optimizer->targets[ optimizer->first[ index ] + t ];
+            if( optimizer->kept[ optimizer->first[ index ] + t ] )
+            {
+                if( target == SIZE_MAX )
+                {
+                    return SIZE_MAX;
+                }
+                fsm_optimize_reach( optimizer, target, &reached );
+            }
+        }
+    }
+    return reached;
+}
+
+/**
+ * @brief Group the reachable states into equivalent sets and build a graph with one state for each.
+ *
+ * @param optimizer The optimizer, groups[] is replaced by the new state numbers.
+ * @param reached The number of reachable states.
+ * @param report Receives what was removed (optional).
+ * @param onRemoved Called for each state or transition removed (optional).
+ * @return The graph or NULL if out of memory.
+ */
+static inline fsm_graph_t* fsm_optimize_build( fsm_optimizer_t* optimizer,
+                                               size_t reached,
+                                               fsm_optimize_report_t* report,
+                                               void ( *onRemoved )( fsm_optimize_removal_t removal,
+                                                                    const state_t* state,
+                                                                    const transition_t* transition ) )
+{
+    state_t* const* states = optimizer->states;
+    const size_t numStates = optimizer->numStates;
+
+    // Group by the states' own fields, then split until every group's transitions agree.
+    size_t numGroups = fsm_optimize_split( optimizer, reached, false );
+    for( size_t previous = 0; numGroups != previous; )
+    {
+        previous = numGroups;
+        numGroups = fsm_optimize_split( optimizer, reached, true );
+    }
+
+    // Number the groups in table order of their first state, the keys are no longer needed.
+    size_t* numbers = ( size_t* )optimizer->keys;
+    for( size_t g = 0; g < numGroups; ++g )
+    {
+        numbers[ g ] = SIZE_MAX;
+    }
+    fsm_builder_t builder;
+    fsm_builder_init( &builder );
+    fsm_optimize_report_t result = { 0, 0, 0, 0, 0, NULL };
+    for( size_t i = 0; i < numStates; ++i )
+    {
+        size_t group = optimizer->groups[ i ];
+        if( group == SIZE_MAX )
+        {
+            ++result.unreachableStates;
+            if( onRemoved )
+            {
+                onRemoved( FSM_OPTIMIZE_UNREACHABLE, states[ i ], NULL );
+            }
+        }
+        else if( numbers[ group ] != SIZE_MAX )
+        {
+            ++result.mergedStates;
+            if( onRemoved )
+            {
+                onRemoved( FSM_OPTIMIZE_MERGED, states[ i ], NULL );
+            }
+        }
+        else
+        {
+            numbers[ group ] = fsm_builder_add_state( &builder, states[ i ]->data, states[ i ]->entryAction, states[ i ]->exitAction );
+            if( numbers[ group ] != SIZE_MAX )
+            {
+                // Carry the state's options, the builder sets the fields that refer to storage or other states.
+                *fsm_builder_state( &builder, numbers[ group ] ) = *states[ i ];
+            }
+            for( size_t t = 0; t < states[ i ]->numTransitions; ++t )
+            {
+                if( !optimizer->kept[ optimizer->first[ i ] + t ] )
+                {
+                    ++result.shadowedTransitions;
+                    if( onRemoved )
+                    {
+                        onRemoved( FSM_OPTIMIZE_SHADOWED, states[ i ], &states[ i ]->transitions[ t ] );
+                    }
+                }
+            }
+        }
+    }
+    for( size_t i = 0; i < numStates; ++i )
+    {
+        size_t group = optimizer->groups[ i ];
+        optimizer->groups[ i ] = ( group == SIZE_MAX ) ? SIZE_MAX : numbers[ group ];
+    }
+
+    // Add the transitions of the first state of each group, which appear in the order they were numbered.
+    size_t added = 0;
+    for( size_t i = 0; i < numStates; ++i )
+    {
+        size_t number = optimizer->groups[ i ];
+        if( ( number != SIZE_MAX ) && ( number == added ) )
+        {
+            ++added;
+            for( size_t t = 0; t < states[ i ]->numTransitions; ++t )
+            {
+                if( optimizer->kept[ optimizer->first[ i ] + t ] )
+                {
+                    const transition_t* transition = &states[ i ]->transitions[ t ];
+                    fsm_builder_add_transition( &builder, number, transition->eventID, optimizer->groups[ optimizer->targets[ optimizer->first[ i ] + t ] ],
+                                                transition->guard, transition->action );
+                }
+            }
+#if FSM_ENABLE_HIERARCHY
+            if( optimizer->parents[ i ] != SIZE_MAX )
+            {
+                fsm_builder_set_parent( &builder, number, optimizer->groups[ optimizer->parents[ i ] ] );
+            }
+#endif
+        }
+    }
+
+    fsm_graph_t* graph = fsm_builder_build( &builder );
+    fsm_builder_free( &builder );
+    if( graph && report )
+    {
+        result.numStates = graph->numStates;
+        result.numTransitions = graph->numTransitions;
+        result.stateMap = report->stateMap;
+        if( result.stateMap )
+        {
+            memcpy( result.stateMap, optimizer->groups, numStates * sizeof( size_t ) );
+        }
+        *report = result;
+    }
+    return graph;
+}
+
+/**
+ * @brief Build a minimal equivalent of a state graph.
+ *
+ * @details The states are not changed. In the new graph states keep the order of the first of each merged set
+ * in the table, transitions keep their order and each state keeps its options (such as an event lookup table
+ * or timeout); keys are packed, nested states initialised and lookup tables built as by fsm_builder_build().
+ *
+ * @param states The state table, every state reachable from the start states must be listed.
+ * @param numStates The number of states in the table.
+ * @param starts The indices of the states instances may start in (NULL for every state in the table).
+ * @param numStarts The number of start states.
+ * @param report Receives what was removed (optional).
+ * @param onRemoved Called for each state or transition removed, with the transition NULL for states (optional).
+ * @return The graph, to be freed with fsm_graph_free(), or NULL if out of memory, a start state is invalid or a
+ * reachable state leads to (or is nested in) a state not in the table.
+ */
+static inline fsm_graph_t* fsm_optimize_graph( state_t* const* states,
+                                               size_t numStates,
+                                               const size_t* starts,
+                                               size_t numStarts,
+                                               fsm_optimize_report_t* report,
+                                               void ( *onRemoved )( fsm_optimize_removal_t removal,
+                                                                    const state_t* state,
+                                                                    const transition_t* transition ) )
+{
+    fsm_optimizer_t optimizer = { states, numStates, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL };
+    fsm_graph_t* graph = NULL;
+
+    size_t numTransitions = 0;
+    for( size_t i = 0; i < numStates; ++i )
+    {
+        numTransitions += states[ i ]->numTransitions;
+    }
+    optimizer.byState = ( fsm_optimize_entry_t* )malloc( ( numStates + 1 ) * sizeof( fsm_optimize_entry_t ) );
+    optimizer.first = ( size_t* )malloc( ( numStates + 1 ) * sizeof( size_t ) );
+    optimizer.kept = ( bool* )malloc( numTransitions + 1 );
+    optimizer.targets = ( size_t* )malloc( ( numTransitions + 1 ) * sizeof( size_t ) );
+    optimizer.parents = ( size_t* )malloc( ( numStates + 1 ) * sizeof( size_t ) );
+    optimizer.enclosing = ( bool* )calloc( numStates + 1, sizeof( bool ) );
+    optimizer.groups = ( size_t* )malloc( ( numStates + 1 ) * sizeof( size_t ) );
+    optimizer.keys = ( fsm_optimize_key_t* )malloc( ( numStates + 1 ) * sizeof( fsm_optimize_key_t ) );
+    if( optimizer.byState && optimizer.first && optimizer.kept && optimizer.targets && optimizer.parents && optimizer.enclosing &&
+        optimizer.groups && optimizer.keys )
+    {
+        for( size_t i = 0; i < numStates; ++i )
+        {
+            optimizer.byState[ i ].state = states[ i ];
+            optimizer.byState[ i ].index = i;
+        }
+        qsort( optimizer.byState, numStates, sizeof( fsm_optimize_entry_t ), fsm_optimize_compare_entries );
+
+        // Resolve next and enclosing states to table indices and mark the transitions that can be taken.
+        size_t position = 0;
+        for( size_t i = 0; i < numStates; ++i )
+        {
+            const state_t* state = states[ i ];
+            optimizer.first[ i ] = position;
+            optimizer.groups[ i ] = SIZE_MAX;
+            optimizer.parents[ i ] = SIZE_MAX;
+#if FSM_ENABLE_HIERARCHY
+            if( state->parent )
+            {
+                optimizer.parents[ i ] = fsm_optimize_index_of( &optimizer, state->parent );
+            }
+#endif
+            for( size_t t = 0; t < state->numTransitions; ++t, ++position )
+            {
+                optimizer.kept[ position ] = !fsm_transition_shadowed( state, t );
+                optimizer.targets[ position ] = fsm_optimize_index_of( &optimizer, state->transitions[ t ].nextState );
+            }
+        }
+
+        size_t reached = fsm_optimize_find_reachable( &optimizer, starts, numStarts );
+        if( reached != SIZE_MAX )
+        {
+            graph = fsm_optimize_build( &optimizer, reached, report, onRemoved );
+        }
+    }
+    fsm_optimizer_free( &optimizer );
+    return graph;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,423 @@
+/*******************************************************************************
+MIT License
+
+Copyright (c) 2024 Julian Mitchell
+https://github.com/jupeos/fsm
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+
+#ifndef FINITE_STATE_MACHINE_POPULATION_H
+#define FINITE_STATE_MACHINE_POPULATION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "finite_state_machine.h"
+
+/**
+ * @file finite_state_machine_population.h
+ * @author Julian Mitchell
+ * @date 25th Jan 2024
+ * @brief Compact storage for very large numbers of state machine instances.
+ *
+ * @details Rather than a state_machine_t (a state_t pointer) per instance, a population keeps each
+ * instance's current state as an fsm_state_index_t into a table of the states of one graph, in a single
+ * contiguous array. With the default uint8_t index a million instances take 1MB instead of 8MB.
+ *
+ * fsm_population_apply() moves every instance in a given state through one transition at once. The
+ * transition and its guard are resolved once for the whole group, when the states and transition have no
+ * actions the update is a branch-free loop over the array that compilers vectorise.
+ *
+ * Transitions are chosen and performed as by fsm_handle_event(): guards in the same order (with
+ * FSM_ENABLE_GUARD_FALLTHROUGH the alternatives that follow a failed guard, with FSM_ENABLE_HIERARCHY the
+ * enclosing states, with FSM_ENABLE_EVENT_FILTER default transitions) and the same exit and entry actions.
+ * Guards and actions receive the state data and the event exactly as in fsm_handle_event(), so they cannot
+ * tell instances apart. With FSM_ENABLE_CONTEXT they receive the population's context. Instances have no
+ * event queue, timeout, trace ring or asynchronous actions, and the FSM_HOOK_ macros are not called.
+ *
+ * Example usage:
+ * @code
+ *    #include "finite_state_machine_population.h"
+ *
+ *    static state_t* states[] = { &doorOpenState, &doorClosedState };
+ *    static fsm_state_index_t doors[ 1000000 ];
+ *    static fsm_population_t population;
+ *
+ *    void init( void )
+ *    {
+ *        fsm_population_init( &population, states, 2, doors, 1000000, 1 );
+ *    }
+ *
+ *    void openAll( void )
+ *    {
+ *        event_t event = { .ID = EVENT_OPEN, .data = 0 };
+ *        fsm_population_apply( &population, 1, &event );
+ *    }
+ * @endcode
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief A population of state machine instances sharing one state graph.
+ */
+typedef struct
+{
+    state_t* const* states;     /*< The state table, every state reachable by an instance must be listed.*/
+    size_t numStates;           /*< The number of states in the table.*/
+    fsm_state_index_t* current; /*< The current state of each instance, as an index into *states*.*/
+    size_t count;               /*< The number of instances.*/
+#if FSM_ENABLE_CONTEXT
+    void* context; /*< User data passed to every guard and action (shared by all the instances).*/
+#endif
+} fsm_population_t;
+
+/**
+ * @brief Initialise a population with every instance in the same state.
+ *
+ * @param population The population.
+ * @param states The state table.
+ * @param numStates The number of states in the table.
+ * @param current Storage for *count* instance states.
+ * @param count The number of instances.
+ * @param initialState The index of the initial state.
+ * @return true The population is ready for use.
+ * @return false The table has more states than fsm_state_index_t can index or the initial state is invalid.
+ */
+static inline bool fsm_population_init( fsm_population_t* population,
+                                        state_t* const* states,
+                                        size_t numStates,
+                                        fsm_state_index_t* current,
+                                        size_t count,
+                                        fsm_state_index_t initialState )
+{
+    bool retVal = false;
+    if( ( numStates - 1 == ( size_t )( fsm_state_index_t )( numStates - 1 ) ) && ( initialState < numStates ) )
+    {
+        population->states = states;
+        population->numStates = numStates;
+        population->current = current;
+        population->count = count;
+#if FSM_ENABLE_CONTEXT
+        population->context = NULL;
+#endif
+        for( size_t i = 0; i < count; ++i )
+        {
+            current[ i ] = initialState;
+        }
+        retVal = true;
+    }
+    return retVal;
+}
+
+/**
+ * @brief Find a state in the state table.
+ *
+ * @param population The population.
+ * @param state The state to look for.
+ * @return The index of the state or *numStates* if it is not in the table.
+ */
+static inline size_t fsm_population_index_of( const fsm_population_t* population, const state_t* state )
+{
+    size_t index = 0;
+    while( ( index < population->numStates ) && ( population->states[ index ] != state ) )
+    {
+        ++index;
+    }
+    return index;
+}
+
+/**
+ * @brief Get the current state of an instance.
+ *
+ * @param population The population.
+ * @param instance The instance.
+ * @return The current state.
+ */
+static inline state_t* fsm_population_state( const fsm_population_t* population, size_t instance )
+{
+    return population->states[ population->current[ instance ] ];
+}
+
+/**
+ * @brief Evaluate a transition's guard.
+ *
+ * @param population The population.
+ * @param owner The state that owns the transition.
+ * @param transition The transition.
+ * @param event The event being processed.
+ * @return true The transition has no guard or it passed.
+ */
+static inline bool fsm_population_guard( const fsm_population_t* population, const state_t* owner, const transition_t* transition, event_t* event )
+{
+#if !FSM_ENABLE_CONTEXT
+    ( void )population;
+#endif
+    return !transition->guard || FSM_INVOKE( transition->guard, population->context, owner->data, event );
+}
+
+/**
+ * @brief Choose the transition instances in a state take for an event, evaluating guards as fsm_handle_event() does.
+ *
+ * @param population The population.
+ * @param state The current state of the instances.
+ * @param event The event being processed.
+ * @param owner Receives the state that owns the transition, the current state or one of its enclosing states.
+ * @return The transition or NULL if there is none or every guard failed.
+ */
+static inline transition_t* fsm_population_resolve( const fsm_population_t* population, state_t* state, event_t* event, state_t** owner )
+{
+    transition_t* retVal = NULL;
+    bool matched = false;
+#if FSM_ENABLE_HIERARCHY
+    // Events the current state does not take are passed to the enclosing states in turn.
+    for( state_t* candidate = state; candidate && !retVal; candidate = candidate->parent )
+#else
+    state_t* candidate = state;
+#endif
+    {
+        transition_t* transition = fsm_find_transition( candidate, event->ID );
+        if( transition )
+        {
+            matched = true;
+            retVal = fsm_population_guard( population, candidate, transition, event ) ? transition : NULL;
+#if FSM_ENABLE_GUARD_FALLTHROUGH
+            // The guard failed, try the alternatives that follow for the same event.
+            const transition_t* end = &candidate->transitions[ candidate->numTransitions ];
+            while( !retVal && ( ++transition < end ) && ( transition->eventID == event->ID ) )
+            {
+                retVal = fsm_population_guard( population, candidate, transition, event ) ? transition : NULL;
+            }
+#endif
+            *owner = candidate;
+        }
+    }
+
+#if FSM_ENABLE_EVENT_FILTER
+    // Events no transition is for take the default transition of the innermost state that has one.
+#if FSM_ENABLE_HIERARCHY
+    for( state_t* candidate = state; candidate && !matched; candidate = candidate->parent )
+#else
+    if( !matched )
+#endif
+    {
+        if( candidate->defaultTransition )
+        {
+            transition_t* transition = &candidate->transitions[ candidate->defaultTransition - 1 ];
+            matched = true;
+            retVal = fsm_population_guard( population, candidate, transition, event ) ? transition : NULL;
+            *owner = candidate;
+        }
+    }
+#else
+    ( void )matched;
+#endif
+    return retVal;
+}
+
+/**
+ * @brief Check whether taking a transition performs any actions.
+ *
+ * @param state The current state.
+ * @param owner The state that owns the transition.
+ * @param transition The transition.
+ * @return true An exit, transition or entry action is performed.
+ */
+static inline bool fsm_population_has_actions( const state_t* state, const state_t* owner, const transition_t* transition )
+{
+    bool retVal = transition->action != NULL;
+#if FSM_ENABLE_HIERARCHY
+    size_t shared = owner->lcaDepths ? owner->lcaDepths[ transition - owner->transitions ] : 0;
+    for( size_t i = shared; !retVal && ( i <= state->depth ); ++i )
+    {
+        const state_t* exited = state->path[ i ] ? state->path[ i ] : state;
+        retVal = exited->exitAction != NULL;
+    }
+    const state_t* next = transition->nextState;
+    for( size_t i = shared; !retVal && ( i <= next->depth ); ++i )
+    {
+        const state_t* entered = next->path[ i ] ? next->path[ i ] : next;
+        retVal = entered->entryAction != NULL;
+    }
+#else
+    ( void )owner;
+    retVal = retVal || state->exitAction || transition->nextState->entryAction;
+#endif
+    return retVal;
+}
+
+/**
+ * @brief Perform the exit actions and the action of a transition for one instance.
+ *
+ * @param population The population.
+ * @param state The instance's current state.
+ * @param owner The state that owns the transition.
+ * @param transition The transition.
+ * @param event The event being processed.
+ */
+static inline void fsm_population_exit( const fsm_population_t* population, state_t* state, state_t* owner, const transition_t* transition, event_t* event )
+{
+#if !FSM_ENABLE_CONTEXT
+    ( void )population;
+#endif
+#if FSM_ENABLE_HIERARCHY
+    // Perform the exit actions from the current state up to the least common ancestor.
+    size_t shared = owner->lcaDepths ? owner->lcaDepths[ transition - owner->transitions ] : 0;
+    for( size_t i = ( size_t )state->depth + 1; i-- > shared; )
+    {
+        state_t* exited = state->path[ i ] ? state->path[ i ] : state;
+        if( exited->exitAction )
+        {
+            FSM_INVOKE( exited->exitAction, population->context, exited->data, event );
+        }
+    }
+#else
+    if( state->exitAction )
+    {
+        FSM_INVOKE( state->exitAction, population->context, state->data, event );
+    }
+#endif
+    if( transition->action )
+    {
+        FSM_INVOKE( transition->action, population->context, owner->data, event );
+    }
+}
+
+/**
+ * @brief Perform the entry actions of a transition for one instance.
+ *
+ * @param population The population.
+ * @param owner The state that owns the transition.
+ * @param transition The transition.
+ * @param event The event being processed.
+ */
+static inline void fsm_population_enter( const fsm_population_t* population, const state_t* owner, const transition_t* transition, event_t* event )
+{
+#if !FSM_ENABLE_CONTEXT
+    ( void )population;
+#endif
+#if FSM_ENABLE_HIERARCHY
+    // Perform the entry actions from below the least common ancestor down to the next state.
+    state_t* next = transition->nextState;
+    size_t shared = owner->lcaDepths ? owner->lcaDepths[ transition - owner->transitions ] : 0;
+    for( size_t i = shared; i <= next->depth; ++i )
+    {
+        state_t* entered = next->path[ i ] ? next->path[ i ] : next;
+        if( entered->entryAction )
+        {
+            FSM_INVOKE( entered->entryAction, population->context, entered->data, event );
+        }
+    }
+#else
+    ( void )owner;
+    if( transition->nextState->entryAction )
+    {
+        FSM_INVOKE( transition->nextState->entryAction, population->context, transition->nextState->data, event );
+    }
+#endif
+}
+
+/**
+ * @brief Handle an event for one instance, see fsm_handle_event().
+ *
+ * @param population The population.
+ * @param instance The instance.
+ * @param event The event to process.
+ * @return true A successful transistion to another state.
+ * @return false No valid transition found, the guard condition failed or the next state is not in the table.
+ */
+static inline bool fsm_population_handle_event( fsm_population_t* population, size_t instance, event_t* event )
+{
+    bool retVal = false;
+    state_t* state = population->states[ population->current[ instance ] ];
+    state_t* owner = state;
+    transition_t* transition = fsm_population_resolve( population, state, event, &owner );
+    size_t next = transition ? fsm_population_index_of( population, transition->nextState ) : population->numStates;
+    if( next < population->numStates )
+    {
+        fsm_population_exit( population, state, owner, transition, event );
+        population->current[ instance ] = ( fsm_state_index_t )next;
+        fsm_population_enter( population, owner, transition, event );
+        retVal = true;
+    }
+    return retVal;
+}
+
+/**
+ * @brief Apply an event to every instance in a given state.
+ *
+ * @details The transition is looked up and its guards evaluated once for the whole group. Actions are then
+ * performed once per instance that moves, in instance order.
+ *
+ * @param population The population.
+ * @param stateIndex The index of the state whose instances receive the event.
+ * @param event The event to process.
+ * @return The number of instances that made the transition.
+ */
+static inline size_t fsm_population_apply( fsm_population_t* population, fsm_state_index_t stateIndex, event_t* event )
+{
+    size_t moved = 0;
+    state_t* state = population->states[ stateIndex ];
+    state_t* owner = state;
+    transition_t* transition = fsm_population_resolve( population, state, event, &owner );
+    size_t next = transition ? fsm_population_index_of( population, transition->nextState ) : population->numStates;
+    if( next >= population->numStates )
+    {
+        return 0;
+    }
+
+    const fsm_state_index_t from = stateIndex;
+    const fsm_state_index_t to = ( fsm_state_index_t )next;
+    fsm_state_index_t* current = population->current;
+    const size_t count = population->count;
+    if( !fsm_population_has_actions( state, owner, transition ) )
+    {
+        // No side effects, a compare and select over the whole array.
+        for( size_t i = 0; i < count; ++i )
+        {
+            fsm_state_index_t match = ( fsm_state_index_t )( current[ i ] == from );
+            moved += match;
+            current[ i ] = match ? to : current[ i ];
+        }
+    }
+    else
+    {
+        for( size_t i = 0; i < count; ++i )
+        {
+            if( current[ i ] == from )
+            {
+                fsm_population_exit( population, state, owner, transition, event );
+                current[ i ] = to;
+                fsm_population_enter( population, owner, transition, event );
+                ++moved;
+            }
+        }
+    }
+    return moved;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // FINITE_STATE_MACHINE_POPULATION_H
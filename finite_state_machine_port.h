@@ -0,0 +1,136 @@
+/*******************************************************************************
+MIT License
+
+Copyright (c) 2024 Julian Mitchell
+https://github.com/jupeos/fsm
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+
+#ifndef FINITE_STATE_MACHINE_PORT_H
+#define FINITE_STATE_MACHINE_PORT_H
+
+/**
+ * @file finite_state_machine_port.h
+ * @author Julian Mitchell
+ * @date 25th Jan 2024
+ * @brief Portability helpers for the companion modules of finite_state_machine.h.
+ *
+ * @details Wraps C11 atomics (or std::atomic when compiled as C++), alignment, thread local storage, a
+ * cycle counter and bit scanning so the lock-free modules can be shared between C and C++ translation units. The core state
+ * machine only needs it for optional features.
+ */
+
+#ifdef __cplusplus
+#include <atomic>
+#include <cstddef>
+
+#define FSM_ATOMIC( TYPE ) std::atomic< TYPE >
+#define FSM_ALIGNAS( SIZE ) alignas( SIZE )
+#define FSM_THREAD_LOCAL    thread_local
+
+#define fsm_atomic_init( OBJECT, VALUE )                                    std::atomic_init( OBJECT, VALUE )
+#define fsm_atomic_load( OBJECT, ORDER )                                    std::atomic_load_explicit( OBJECT, std::ORDER )
+#define fsm_atomic_store( OBJECT, VALUE, ORDER )                            std::atomic_store_explicit( OBJECT, VALUE, std::ORDER )
+#define fsm_atomic_exchange( OBJECT, VALUE, ORDER )                         std::atomic_exchange_explicit( OBJECT, VALUE, std::ORDER )
+#define fsm_atomic_fetch_add( OBJECT, VALUE, ORDER )                        std::atomic_fetch_add_explicit( OBJECT, VALUE, std::ORDER )
+#define fsm_atomic_compare_exchange_weak( OBJECT, EXPECTED, VALUE, ORDER ) \
+    std::atomic_compare_exchange_weak_explicit( OBJECT, EXPECTED, VALUE, std::ORDER, std::memory_order_relaxed )
+#define fsm_atomic_thread_fence( ORDER ) std::atomic_thread_fence( std::ORDER )
+#else
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+#define FSM_ATOMIC( TYPE ) _Atomic( TYPE )
+#define FSM_ALIGNAS( SIZE ) _Alignas( SIZE )
+#define FSM_THREAD_LOCAL    _Thread_local
+
+#define fsm_atomic_init( OBJECT, VALUE )                                    atomic_init( OBJECT, VALUE )
+#define fsm_atomic_load( OBJECT, ORDER )                                    atomic_load_explicit( OBJECT, ORDER )
+#define fsm_atomic_store( OBJECT, VALUE, ORDER )                            atomic_store_explicit( OBJECT, VALUE, ORDER )
+#define fsm_atomic_exchange( OBJECT, VALUE, ORDER )                         atomic_exchange_explicit( OBJECT, VALUE, ORDER )
+#define fsm_atomic_fetch_add( OBJECT, VALUE, ORDER )                        atomic_fetch_add_explicit( OBJECT, VALUE, ORDER )
+#define fsm_atomic_compare_exchange_weak( OBJECT, EXPECTED, VALUE, ORDER ) \
+    atomic_compare_exchange_weak_explicit( OBJECT, EXPECTED, VALUE, ORDER, memory_order_relaxed )
+#define fsm_atomic_thread_fence( ORDER ) atomic_thread_fence( ORDER )
+#endif
+
+#ifndef FSM_CACHE_LINE_SIZE
+#define FSM_CACHE_LINE_SIZE 64 /*< Used to keep data written by different threads on separate cache lines. */
+#endif
+
+#include <stdint.h>
+#include <time.h>
+#if defined( _MSC_VER ) && ( defined( _M_X64 ) || defined( _M_IX86 ) )
+#include <intrin.h>
+#elif defined( __x86_64__ ) || defined( __i386__ )
+#include <x86intrin.h>
+#endif
+
+/**
+ * @brief Read a cheap, monotonic, high resolution counter.
+ *
+ * @details The time stamp counter on x86, the virtual counter on AArch64, otherwise nanoseconds from timespec_get().
+ * Only differences between readings on the same machine are meaningful.
+ *
+ * @return The counter value.
+ */
+static inline uint64_t fsm_cycles( void )
+{
+#if ( defined( _MSC_VER ) && ( defined( _M_X64 ) || defined( _M_IX86 ) ) ) || defined( __x86_64__ ) || defined( __i386__ )
+    return ( uint64_t )__rdtsc();
+#elif defined( __aarch64__ )
+    uint64_t value;
+    __asm__ __volatile__( "mrs %0, cntvct_el0" : "=r"( value ) );
+    return value;
+#else
+    struct timespec now;
+    timespec_get( &now, TIME_UTC );
+    return ( ( uint64_t )now.tv_sec * 1000000000u ) + ( uint64_t )now.tv_nsec;
+#endif
+}
+
+/**
+ * @brief Find the lowest set bit of a mask, for example the first matching lane of a vector compare.
+ *
+ * @param mask The mask, not zero.
+ * @return The index of the lowest set bit.
+ */
+static inline unsigned fsm_first_set( uint64_t mask )
+{
+#if defined( __GNUC__ ) || defined( __clang__ )
+    return ( unsigned )__builtin_ctzll( mask );
+#elif defined( _MSC_VER ) && defined( _M_X64 )
+    unsigned long index;
+    _BitScanForward64( &index, mask );
+    return ( unsigned )index;
+#else
+    unsigned index = 0;
+    while( !( mask & 1u ) )
+    {
+        mask >>= 1;
+        ++index;
+    }
+    return index;
+#endif
+}
+
+#endif  // FINITE_STATE_MACHINE_PORT_H
@@ -0,0 +1,279 @@
+/*******************************************************************************
+MIT License
+
+Copyright (c) 2024 Julian Mitchell
+https://github.com/jupeos/fsm
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+
+
+#ifndef FINITE_STATE_MACHINE_PROFILE_H
+#define FINITE_STATE_MACHINE_PROFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "finite_state_machine.h"
+
+/**
+ * @file finite_state_machine_profile.h
+ * @author Julian Mitchell
+ * @date 25th Jan 2024
+ * @brief Profile guided ordering of transitions, so the events a state receives most are found first.
+ *
+ * @details With FSM_ENABLE_STATS each transition counts how often it is considered (taken or blocked by its
+ * guard). fsm_profile_order() ranks a state's events by how often they were handled there and
+ * fsm_profile_reorder() moves their transitions into that order with fsm_reorder_transitions(), keeping the
+ * relative order of transitions for the same event. Run a representative load, then reorder at a quiet point
+ * (reordering is not thread safe with respect to event handling).
+ *
+ * fsm_profile_dump() writes the learned order of a table of states as text, one line per state of the state's
+ * index then its event IDs hottest first, and fsm_profile_load() applies such a file, with or without
+ * FSM_ENABLE_STATS, so a build can start in the order a profiling run learned:
+ * @code
+ *    fsm-profile 1
+ *    0 7 3 1
+ *    1 2 4
+ * @endcode
+ */
+
+#define FSM_PROFILE_VERSION 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if FSM_ENABLE_STATS
+/**
+ * @brief Get how often a transition has been considered, summed over all thread slots.
+ *
+ * @param state The state that owns the transition.
+ * @param index The index of the transition.
+ * @return The times it was taken or blocked by its guard.
+ */
+static inline uint64_t fsm_profile_hits( const state_t* state, size_t index )
+{
+    uint64_t hits = 0;
+    for( size_t slot = 0; state->transitionStats && ( slot < FSM_STATS_MAX_THREADS ); ++slot )
+    {
+        const fsm_transition_stats_t* stats = &state->transitionStats[ ( slot * state->numTransitions ) + index ];
+        hits += fsm_stats_read( &stats->taken ) + fsm_stats_read( &stats->guardRejections );
+    }
+    return hits;
+}
+
+/**
+ * @brief Rank the events of a state by how often they were handled in it.
+ *
+ * @details An event is handled as often as its first transition is considered. Events with equal counts keep
+ * the order of their first transitions.
+ *
+ * @param state The state.
+ * @param order Receives the event IDs, most frequent first, room for *numTransitions* entries.
+ * @param hits Receives the number of times each event was handled, room for *numTransitions* entries.
+ * @return The number of events.
+ */
+static inline size_t fsm_profile_order( const state_t* state, event_id_t* order, uint64_t* hits )
+{
+    size_t count = 0;
+    for( size_t i = 0; i < state->numTransitions; ++i )
+    {
+        event_id_t eventID = state->transitions[ i ].eventID;
+        size_t j = 0;
+        while( ( j < count ) && ( order[ j ] != eventID ) )
+        {
+            ++j;
+        }
+
+        if( j == count )
+        {
+            // Insert after events handled at least as often, a stable insertion sort.
+            uint64_t eventHits = fsm_profile_hits( state, i );
+            size_t k = count++;
+            while( ( k > 0 ) && ( hits[ k - 1 ] < eventHits ) )
+            {
+                order[ k ] = order[ k - 1 ];
+                hits[ k ] = hits[ k - 1 ];
+                --k;
+            }
+            order[ k ] = eventID;
+            hits[ k ] = eventHits;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Reorder the transitions of a state so its most frequent events come first.
+ *
+ * @param state The state.
+ * @return true The state was reordered.
+ * @return false Out of memory, or with guard fall-through the transitions for an event are apart (see
+ * fsm_reorder_transitions()). The state is unchanged.
+ */
+static inline bool fsm_profile_reorder( state_t* state )
+{
+    bool retVal = false;
+    event_id_t* order = ( event_id_t* )malloc( ( state->numTransitions + 1 ) * sizeof( event_id_t ) );
+    uint64_t* hits = ( uint64_t* )malloc( ( state->numTransitions + 1 ) * sizeof( uint64_t ) );
+    if( order && hits )
+    {
+        size_t count = fsm_profile_order( state, order, hits );
+        retVal = fsm_reorder_transitions( state, order, count );
+    }
+    free( order );
+    free( hits );
+    return retVal;
+}
+
+/**
+ * @brief Write the learned event order of a table of states, for fsm_profile_load().
+ *
+ * @param states The state table.
+ * @param numStates The number of states in the table.
+ * @param file A file open for writing.
+ * @return true The order was written.
+ */
+static inline bool fsm_profile_dump( state_t* const* states, size_t numStates, FILE* file )
+{
+    size_t maxTransitions = 0;
+    for( size_t i = 0; i < numStates; ++i )
+    {
+        maxTransitions = ( states[ i ]->numTransitions > maxTransitions ) ? states[ i ]->numTransitions : maxTransitions;
+    }
+
+    event_id_t* order = ( event_id_t* )malloc( ( maxTransitions + 1 ) * sizeof( event_id_t ) );
+    uint64_t* hits = ( uint64_t* )malloc( ( maxTransitions + 1 ) * sizeof( uint64_t ) );
+    bool retVal = order && hits && ( fprintf( file, "fsm-profile %d\n", FSM_PROFILE_VERSION ) > 0 );
+    for( size_t i = 0; retVal && ( i < numStates ); ++i )
+    {
+        size_t count = fsm_profile_order( states[ i ], order, hits );
+        retVal = fprintf( file, "%zu", i ) > 0;
+        for( size_t j = 0; retVal && ( j < count ); ++j )
+        {
+            retVal = fprintf( file, " %lld", ( long long )order[ j ] ) > 0;
+        }
+        retVal = retVal && ( fputc( '\n', file ) != EOF );
+    }
+    free( order );
+    free( hits );
+    return retVal;
+}
+#endif
+
+/**
+ * @brief Read the next number on a line of a profile.
+ *
+ * @param file The file.
+ * @param value Receives the number.
+ * @return 1 for a number, 0 at the end of a line, -1 at the end of the file and -2 if the text is not a number.
+ */
+static inline int fsm_profile_scan( FILE* file, long long* value )
+{
+    int c = getc( file );
+    while( ( c == ' ' ) || ( c == '\t' ) || ( c == '\r' ) )
+    {
+        c = getc( file );
+    }
+    if( c == '\n' )
+    {
+        return 0;
+    }
+    if( c == EOF )
+    {
+        return -1;
+    }
+    ungetc( c, file );
+    return ( fscanf( file, "%lld", value ) == 1 ) ? 1 : -2;
+}
+
+/**
+ * @brief Reorder the transitions of a table of states as written by fsm_profile_dump().
+ *
+ * @details States not listed are unchanged. Events a state has no transition for are ignored, so a profile
+ * still applies to a graph that has changed a little since.
+ *
+ * @param states The state table, in the same order as when the profile was written.
+ * @param numStates The number of states in the table.
+ * @param file A file open for reading.
+ * @return true Every state listed was reordered.
+ * @return false The file is not a profile, lists a state not in the table or a state could not be reordered
+ * (see fsm_reorder_transitions()), the states before it were reordered.
+ */
+static inline bool fsm_profile_load( state_t* const* states, size_t numStates, FILE* file )
+{
+    size_t maxTransitions = 0;
+    for( size_t i = 0; i < numStates; ++i )
+    {
+        maxTransitions = ( states[ i ]->numTransitions > maxTransitions ) ? states[ i ]->numTransitions : maxTransitions;
+    }
+
+    int version = 0;
+    event_id_t* order = ( event_id_t* )malloc( ( maxTransitions + 1 ) * sizeof( event_id_t ) );
+    bool retVal = order && ( fscanf( file, "fsm-profile %d", &version ) == 1 ) && ( version == FSM_PROFILE_VERSION );
+    long long value;
+    int scanned = retVal ? fsm_profile_scan( file, &value ) : -1;
+    while( retVal && ( scanned != -1 ) )
+    {
+        // Each line is a state index then its events, blank lines are skipped.
+        scanned = fsm_profile_scan( file, &value );
+        if( scanned == 1 )
+        {
+            retVal = ( value >= 0 ) && ( ( unsigned long long )value < numStates );
+            state_t* state = retVal ? states[ value ] : NULL;
+            size_t count = 0;
+            while( retVal && ( ( scanned = fsm_profile_scan( file, &value ) ) == 1 ) )
+            {
+                event_id_t eventID = ( event_id_t )value;
+                size_t i = 0;
+                while( ( i < state->numTransitions ) && ( state->transitions[ i ].eventID != eventID ) )
+                {
+                    ++i;
+                }
+                size_t j = 0;
+                while( ( j < count ) && ( order[ j ] != eventID ) )
+                {
+                    ++j;
+                }
+                if( ( i < state->numTransitions ) && ( j == count ) )
+                {
+                    order[ count++ ] = eventID;
+                }
+            }
+            retVal = retVal && ( scanned != -2 ) && fsm_reorder_transitions( state, order, count );
+        }
+        else
+        {
+            retVal = scanned != -2;
+        }
+    }
+    free( order );
+    return retVal;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,367 @@
+/*******************************************************************************
+MIT License
+
+Copyright (c) 2024 Julian Mitchell
+https://github.com/jupeos/fsm
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+
+#ifndef FINITE_STATE_MACHINE_QUEUE_H
+#define FINITE_STATE_MACHINE_QUEUE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "finite_state_machine.h"
+#include "finite_state_machine_port.h"
+
+/**
+ * @file finite_state_machine_queue.h
+ * @author Julian Mitchell
+ * @date 25th Jan 2024
+ * @brief Bounded lock-free event queues feeding a state machine.
+ *
+ * @details A state machine is owned by a single consumer thread which drains a queue with fsm_run_queue(),
+ * producers on other threads (or in interrupt handlers) post events without taking a lock.
+ * - fsm_spsc_queue_t : a single producer, single consumer ring.
+ * - fsm_mpsc_queue_t : any number of producers, single consumer.
+ *
+ * Both queues use caller supplied storage whose capacity must be a power of two. Posting to a full queue
+ * fails rather than blocking.
+ *
+ * Example usage:
+ * @code
+ *    #include "finite_state_machine_queue.h"
+ *
+ *    static fsm_queue_slot_t slots[ 256 ];
+ *    static fsm_mpsc_queue_t queue;
+ *
+ *    void init( void )
+ *    {
+ *        fsm_mpsc_init( &queue, slots, 256 );
+ *    }
+ *
+ *    // Any thread.
+ *    void openFunc( void )
+ *    {
+ *        event_t event = { .ID = EVENT_OPEN, .data = 0 };
+ *        fsm_mpsc_push( &queue, &event );
+ *    }
+ *
+ *    // The thread that owns fsm.
+ *    void poll( void )
+ *    {
+ *        fsm_run_queue( &fsm, &queue, SIZE_MAX );
+ *    }
+ * @endcode
+ */
+
+#ifndef FSM_QUEUE_BATCH_SIZE
+#define FSM_QUEUE_BATCH_SIZE 32 /*< The number of events popped before being passed to fsm_handle_events(). */
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief A single producer, single consumer event queue.
+ * @note The producer and consumer indices are kept on separate cache lines.
+ */
+typedef struct
+{
+    FSM_ALIGNAS( FSM_CACHE_LINE_SIZE ) FSM_ATOMIC( size_t ) tail; /*< The next slot to write, written by the producer.*/
+    size_t headCache;                                            /*< The producer's last view of head.*/
+    FSM_ALIGNAS( FSM_CACHE_LINE_SIZE ) FSM_ATOMIC( size_t ) head; /*< The next slot to read, written by the consumer.*/
+    size_t tailCache;                                            /*< The consumer's last view of tail.*/
+    FSM_ALIGNAS( FSM_CACHE_LINE_SIZE ) event_t* events;           /*< The event storage.*/
+    size_t mask;                                                 /*< The capacity - 1.*/
+} fsm_spsc_queue_t;
+
+/**
+ * @brief A slot of a multiple producer queue.
+ */
+typedef struct
+{
+    FSM_ATOMIC( size_t ) sequence; /*< Tells producers and the consumer whose turn it is to use the slot.*/
+    event_t event;                 /*< The queued event.*/
+} fsm_queue_slot_t;
+
+/**
+ * @brief A multiple producer, single consumer event queue.
+ * @note A bounded queue in which producers claim slots with a compare and swap on tail.
+ */
+typedef struct
+{
+    FSM_ALIGNAS( FSM_CACHE_LINE_SIZE ) FSM_ATOMIC( size_t ) tail; /*< The next slot to claim, shared by producers.*/
+    FSM_ALIGNAS( FSM_CACHE_LINE_SIZE ) size_t head;               /*< The next slot to read, owned by the consumer.*/
+    FSM_ALIGNAS( FSM_CACHE_LINE_SIZE ) fsm_queue_slot_t* slots;   /*< The slot storage.*/
+    size_t mask;                                                 /*< The capacity - 1.*/
+} fsm_mpsc_queue_t;
+
+/**
+ * @brief Initialise a single producer, single consumer queue.
+ *
+ * @param queue The queue.
+ * @param events Storage for *capacity* events.
+ * @param capacity The maximum number of queued events, a power of two.
+ * @return true The queue is ready for use.
+ * @return false The capacity is not a power of two.
+ */
+static inline bool fsm_spsc_init( fsm_spsc_queue_t* queue, event_t* events, size_t capacity )
+{
+    bool retVal = false;
+    if( capacity && !( capacity & ( capacity - 1 ) ) )
+    {
+        fsm_atomic_init( &queue->tail, ( size_t )0 );
+        fsm_atomic_init( &queue->head, ( size_t )0 );
+        queue->headCache = 0;
+        queue->tailCache = 0;
+        queue->events = events;
+        queue->mask = capacity - 1;
+        retVal = true;
+    }
+    return retVal;
+}
+
+/**
+ * @brief Post an event, called by the producer only.
+ *
+ * @param queue The queue.
+ * @param event The event to copy into the queue.
+ * @return true The event was queued.
+ * @return false The queue is full.
+ */
+static inline bool fsm_spsc_push( fsm_spsc_queue_t* queue, const event_t* event )
+{
+    bool retVal = false;
+    size_t tail = fsm_atomic_load( &queue->tail, memory_order_relaxed );
+    if( tail - queue->headCache > queue->mask )
+    {
+        // Looks full, refresh our view of the consumer.
+        queue->headCache = fsm_atomic_load( &queue->head, memory_order_acquire );
+    }
+
+    if( tail - queue->headCache <= queue->mask )
+    {
+        queue->events[ tail & queue->mask ] = *event;
+        fsm_atomic_store( &queue->tail, tail + 1, memory_order_release );
+        retVal = true;
+    }
+    return retVal;
+}
+
+/**
+ * @brief Take the oldest event, called by the consumer only.
+ *
+ * @param queue The queue.
+ * @param event Receives the event.
+ * @return true An event was removed.
+ * @return false The queue is empty.
+ */
+static inline bool fsm_spsc_pop( fsm_spsc_queue_t* queue, event_t* event )
+{
+    bool retVal = false;
+    size_t head = fsm_atomic_load( &queue->head, memory_order_relaxed );
+    if( head == queue->tailCache )
+    {
+        // Looks empty, refresh our view of the producer.
+        queue->tailCache = fsm_atomic_load( &queue->tail, memory_order_acquire );
+    }
+
+    if( head != queue->tailCache )
+    {
+        *event = queue->events[ head & queue->mask ];
+        fsm_atomic_store( &queue->head, head + 1, memory_order_release );
+        retVal = true;
+    }
+    return retVal;
+}
+
+/**
+ * @brief Initialise a multiple producer, single consumer queue.
+ *
+ * @param queue The queue.
+ * @param slots Storage for *capacity* slots.
+ * @param capacity The maximum number of queued events, a power of two.
+ * @return true The queue is ready for use.
+ * @return false The capacity is not a power of two.
+ */
+static inline bool fsm_mpsc_init( fsm_mpsc_queue_t* queue, fsm_queue_slot_t* slots, size_t capacity )
+{
+    bool retVal = false;
+    if( capacity && !( capacity & ( capacity - 1 ) ) )
+    {
+        for( size_t i = 0; i < capacity; ++i )
+        {
+            fsm_atomic_init( &slots[ i ].sequence, i );
+        }
+        fsm_atomic_init( &queue->tail, ( size_t )0 );
+        queue->head = 0;
+        queue->slots = slots;
+        queue->mask = capacity - 1;
+        retVal = true;
+    }
+    return retVal;
+}
+
+/**
+ * @brief Post an event, may be called by any number of producers concurrently.
+ *
+ * @param queue The queue.
+ * @param event The event to copy into the queue.
+ * @return true The event was queued.
+ * @return false The queue is full.
+ */
+static inline bool fsm_mpsc_push( fsm_mpsc_queue_t* queue, const event_t* event )
+{
+    size_t tail = fsm_atomic_load( &queue->tail, memory_order_relaxed );
+    for( ;; )
+    {
+        fsm_queue_slot_t* slot = &queue->slots[ tail & queue->mask ];
+        size_t sequence = fsm_atomic_load( &slot->sequence, memory_order_acquire );
+        intptr_t difference = ( intptr_t )sequence - ( intptr_t )tail;
+        if( difference == 0 )
+        {
+            // The slot is free, try to claim it (on failure tail is reloaded).
+            if( fsm_atomic_compare_exchange_weak( &queue->tail, &tail, tail + 1, memory_order_relaxed ) )
+            {
+                slot->event = *event;
+                fsm_atomic_store( &slot->sequence, tail + 1, memory_order_release );
+                return true;
+            }
+        }
+        else if( difference < 0 )
+        {
+            // The consumer has not yet released the slot from the previous lap.
+            return false;
+        }
+        else
+        {
+            // Another producer claimed the slot first.
+            tail = fsm_atomic_load( &queue->tail, memory_order_relaxed );
+        }
+    }
+}
+
+/**
+ * @brief Take the oldest event, called by the consumer only.
+ *
+ * @param queue The queue.
+ * @param event Receives the event.
+ * @return true An event was removed.
+ * @return false The queue is empty (or the oldest event is still being written).
+ */
+static inline bool fsm_mpsc_pop( fsm_mpsc_queue_t* queue, event_t* event )
+{
+    bool retVal = false;
+    fsm_queue_slot_t* slot = &queue->slots[ queue->head & queue->mask ];
+    size_t sequence = fsm_atomic_load( &slot->sequence, memory_order_acquire );
+    if( sequence == queue->head + 1 )
+    {
+        *event = slot->event;
+        // Hand the slot back to producers for the next lap.
+        fsm_atomic_store( &slot->sequence, queue->head + queue->mask + 1, memory_order_release );
+        ++queue->head;
+        retVal = true;
+    }
+    return retVal;
+}
+
+/**
+ * @brief Drain a single producer queue into a state machine.
+ *
+ * @details Events are popped in batches of FSM_QUEUE_BATCH_SIZE and handled with fsm_handle_events().
+ * Must be called from the thread that owns the state machine.
+ *
+ * @param fsm The state machine instance.
+ * @param queue The queue to drain.
+ * @param maxEvents The maximum number of events to handle (SIZE_MAX to drain until empty).
+ * @return The number of events handled.
+ */
+static inline size_t fsm_run_spsc_queue( state_machine_t* fsm, fsm_spsc_queue_t* queue, size_t maxEvents )
+{
+    event_t batch[ FSM_QUEUE_BATCH_SIZE ];
+    size_t handled = 0;
+    size_t count;
+    do
+    {
+        count = 0;
+        while( ( count < FSM_QUEUE_BATCH_SIZE ) && ( handled + count < maxEvents ) && fsm_spsc_pop( queue, &batch[ count ] ) )
+        {
+            ++count;
+        }
+        fsm_handle_events( fsm, batch, count );
+        handled += count;
+    } while( count == FSM_QUEUE_BATCH_SIZE );
+    return handled;
+}
+
+/**
+ * @brief Drain a multiple producer queue into a state machine.
+ *
+ * @details Events are popped in batches of FSM_QUEUE_BATCH_SIZE and handled with fsm_handle_events().
+ * Must be called from the thread that owns the state machine.
+ *
+ * @param fsm The state machine instance.
+ * @param queue The queue to drain.
+ * @param maxEvents The maximum number of events to handle (SIZE_MAX to drain until empty).
+ * @return The number of events handled.
+ */
+static inline size_t fsm_run_mpsc_queue( state_machine_t* fsm, fsm_mpsc_queue_t* queue, size_t maxEvents )
+{
+    event_t batch[ FSM_QUEUE_BATCH_SIZE ];
+    size_t handled = 0;
+    size_t count;
+    do
+    {
+        count = 0;
+        while( ( count < FSM_QUEUE_BATCH_SIZE ) && ( handled + count < maxEvents ) && fsm_mpsc_pop( queue, &batch[ count ] ) )
+        {
+            ++count;
+        }
+        fsm_handle_events( fsm, batch, count );
+        handled += count;
+    } while( count == FSM_QUEUE_BATCH_SIZE );
+    return handled;
+}
+
+#ifdef __cplusplus
+}
+
+// Drain either kind of queue, see fsm_run_spsc_queue() and fsm_run_mpsc_queue().
+static inline size_t fsm_run_queue( state_machine_t* fsm, fsm_spsc_queue_t* queue, size_t maxEvents )
+{
+    return fsm_run_spsc_queue( fsm, queue, maxEvents );
+}
+
+static inline size_t fsm_run_queue( state_machine_t* fsm, fsm_mpsc_queue_t* queue, size_t maxEvents )
+{
+    return fsm_run_mpsc_queue( fsm, queue, maxEvents );
+}
+#else
+// Drain either kind of queue, see fsm_run_spsc_queue() and fsm_run_mpsc_queue().
+#define fsm_run_queue( FSM, QUEUE, MAX_EVENTS )                                                           \
+    _Generic( ( QUEUE ), fsm_spsc_queue_t* : fsm_run_spsc_queue, fsm_mpsc_queue_t* : fsm_run_mpsc_queue )( \
+        FSM, QUEUE, MAX_EVENTS )
+#endif
+
+#endif  // FINITE_STATE_MACHINE_QUEUE_H
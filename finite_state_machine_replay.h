@@ -0,0 +1,636 @@
+/*******************************************************************************
+MIT License
+
+Copyright (c) 2024 Julian Mitchell
+https://github.com/jupeos/fsm
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+
+#ifndef FINITE_STATE_MACHINE_REPLAY_H
+#define FINITE_STATE_MACHINE_REPLAY_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined( __unix__ ) || defined( __APPLE__ )
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define FSM_REPLAY_MMAP 1
+#else
+#define FSM_REPLAY_MMAP 0
+#endif
+
+#include "finite_state_machine.h"
+#include "finite_state_machine_port.h"
+#include "finite_state_machine_trace.h"
+
+/**
+ * @file finite_state_machine_replay.h
+ * @author Julian Mitchell
+ * @date 25th Jan 2024
+ * @brief Replay recorded event streams into state machines, as a benchmark and to check behaviour.
+ *
+ * @details fsm_replay_open() maps a trace dump written by fsm_trace_dump() (or fsm_replay_parse() takes
+ * records already in memory, e.g. from fsm_trace_snapshot()) and recovers the events handled from it: the
+ * records of one event are those written while it was handled (one per transition considered), the recorded
+ * instances are numbered in order of appearance and each starts in the state its first record was for. The
+ * state each event left its instance in is kept to check the replay against.
+ *
+ * fsm_replay_run() feeds the events to an array of state machines, one per recorded instance, at full speed
+ * with fsm_handle_event() or, for runs of events to the same instance, fsm_handle_events(). With more than one
+ * thread the instances are split into shards (instance % threads), each replayed by one thread in recorded
+ * order. The result gives the throughput, a latency histogram, and how often a state machine was not in the
+ * recorded state after a call. Replaying the same dump into the same states is deterministic,
+ * so a dump of production traffic doubles as a benchmark.
+ *
+ * Records hold event IDs but not event data or payloads, replayed events have data 0. With FSM_ENABLE_HIERARCHY
+ * a record's source is the state owning the transition, so an instance whose first event was handled by an
+ * enclosing state is taken to start in that state. Events posted or raised
+ * by timeouts while recording are in the dump as events of their own.
+ *
+ * Example usage:
+ * @code
+ *    #include "finite_state_machine_replay.h"
+ *
+ *    fsm_replay_t replay;
+ *    fsm_replay_open( &replay, "trace.bin" );
+ *    state_machine_t* machines = calloc( replay.numInstances, sizeof( state_machine_t ) );
+ *    fsm_replay_reset( &replay, machines, states, NUM_STATES );
+ *
+ *    fsm_replay_result_t result;
+ *    fsm_replay_run( &replay, machines, 4, 1, &result );
+ *    printf( "%.0f events/s, p99 %llu ns\n", result.eventsPerSecond, ( unsigned long long )fsm_replay_percentile( &result, 0.99 ) );
+ *    fsm_replay_close( &replay );
+ * @endcode
+ */
+
+#ifndef FSM_REPLAY_MAX_BATCH
+#define FSM_REPLAY_MAX_BATCH 256 /*< The most events handed to fsm_handle_events() at once. */
+#endif
+
+#define FSM_REPLAY_BUCKETS 32 /*< Latency histogram buckets, bucket b counts events taking 2^b to 2^(b+1) - 1 ns.*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief An event recovered from a trace.
+ */
+typedef struct
+{
+    size_t instance;     /*< The number of the instance that handled it.*/
+    event_id_t eventID;  /*< The event ID.*/
+    data_t expected;     /*< The data of the state the instance was left in.*/
+} fsm_replay_event_t;
+
+/**
+ * @brief A recorded event stream.
+ */
+typedef struct
+{
+    const fsm_trace_record_t* records; /*< The records.*/
+    size_t numRecords;                 /*< The number of records.*/
+    void* base;                        /*< The start of the mapping of the dump (NULL for records in memory).*/
+    size_t length;                     /*< The length of the mapping.*/
+    fsm_replay_event_t* events;        /*< The events in the order they were handled.*/
+    size_t numEvents;                  /*< The number of events.*/
+    uint64_t* instanceIDs;             /*< The recorded address of each instance.*/
+    data_t* initialStates;             /*< The data of the state each instance started in.*/
+    size_t numInstances;               /*< The number of instances.*/
+} fsm_replay_t;
+
+/**
+ * @brief The result of a replay.
+ */
+typedef struct
+{
+    uint64_t events;                          /*< The number of events handled.*/
+    uint64_t transitions;                     /*< The number of events that caused a transition.*/
+    uint64_t mismatches;                      /*< The number of calls (events, or batches of them) after which the state differed from the recording.*/
+    uint64_t elapsedNs;                       /*< The wall clock time of the replay.*/
+    double eventsPerSecond;                   /*< The throughput.*/
+    uint64_t histogram[ FSM_REPLAY_BUCKETS ]; /*< The number of events by latency, see FSM_REPLAY_BUCKETS.*/
+} fsm_replay_result_t;
+
+/**
+ * @brief A shard of a replay, replayed by one thread.
+ */
+typedef struct
+{
+    const fsm_replay_t* replay;     /*< The replay.*/
+    state_machine_t* machines;      /*< The state machines of all the instances.*/
+    const fsm_replay_event_t* events; /*< The shard's events, in recorded order.*/
+    size_t numEvents;               /*< The number of events.*/
+    size_t batch;                   /*< The most events handled by one call.*/
+    fsm_replay_result_t result;     /*< The shard's result (elapsedNs and eventsPerSecond unused).*/
+    pthread_t thread;               /*< The thread.*/
+} fsm_replay_shard_t;
+
+/**
+ * @brief Read a monotonic wall clock in nanoseconds.
+ */
+static inline uint64_t fsm_replay_now_ns( void )
+{
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return ( ( uint64_t )now.tv_sec * 1000000000u ) + ( uint64_t )now.tv_nsec;
+}
+
+/**
+ * @brief Free the events recovered from a trace.
+ */
+static inline void fsm_replay_free( fsm_replay_t* replay )
+{
+    free( replay->events );
+    free( replay->instanceIDs );
+    free( ( void* )replay->initialStates );
+    replay->events = NULL;
+    replay->instanceIDs = NULL;
+    replay->initialStates = NULL;
+    replay->numEvents = 0;
+    replay->numInstances = 0;
+}
+
+/**
+ * @brief Check whether a record was written for the same event as the one before it.
+ *
+ * @details Events are handled one at a time so the records of an event are written together. After a guard
+ * fails the search goes on to later transitions of the same state (FSM_ENABLE_GUARD_FALLTHROUGH), then to the
+ * enclosing states (FSM_ENABLE_HIERARCHY), whereas the next event starts over at the first state searched.
+ *
+ * @param record The record.
+ * @param previous The record before it.
+ * @param firstSource The source of the first record of the event *previous* belongs to.
+ */
+static inline bool fsm_replay_continues( const fsm_trace_record_t* record, const fsm_trace_record_t* previous, int32_t firstSource )
+{
+    if( ( record->instance != previous->instance ) || ( record->eventID != previous->eventID ) || ( previous->flags & FSM_TRACE_TAKEN ) ||
+        ( previous->transition == FSM_TRACE_NO_TRANSITION ) || ( record->transition == FSM_TRACE_NO_TRANSITION ) )
+    {
+        return false;
+    }
+    if( record->source == firstSource )
+    {
+        return ( previous->source == firstSource ) && ( record->transition > previous->transition );
+    }
+    return ( record->source != previous->source ) || ( record->transition > previous->transition );
+}
+
+/**
+ * @brief Find an instance by its recorded address, numbering it if it is new.
+ *
+ * @return The number of the instance.
+ */
+static inline size_t fsm_replay_instance( fsm_replay_t* replay, size_t* slots, size_t mask, const fsm_trace_record_t* record )
+{
+    uint64_t hash = record->instance * 0x9e3779b97f4a7c15ull;
+    for( size_t slot = ( size_t )( hash >> 32 ) & mask;; slot = ( slot + 1 ) & mask )
+    {
+        if( slots[ slot ] == SIZE_MAX )
+        {
+            // Slots and instances are both sized for one instance per record.
+            slots[ slot ] = replay->numInstances;
+            replay->instanceIDs[ replay->numInstances ] = record->instance;
+            replay->initialStates[ replay->numInstances ] = ( data_t )record->source;
+            return replay->numInstances++;
+        }
+        if( replay->instanceIDs[ slots[ slot ] ] == record->instance )
+        {
+            return slots[ slot ];
+        }
+    }
+}
+
+/**
+ * @brief Recover the events handled from trace records.
+ *
+ * @param replay Receives the events, free them with fsm_replay_close().
+ * @param records The records, oldest first, which must stay valid while the replay is used.
+ * @param count The number of records.
+ * @return true The events were recovered.
+ * @return false Out of memory.
+ */
+static inline bool fsm_replay_parse( fsm_replay_t* replay, const fsm_trace_record_t* records, size_t count )
+{
+    replay->base = NULL;
+    replay->length = 0;
+    replay->records = records;
+    replay->numRecords = count;
+    replay->numEvents = 0;
+    replay->numInstances = 0;
+
+    size_t numSlots = 16;
+    while( numSlots < ( count * 2 ) )
+    {
+        numSlots *= 2;
+    }
+    size_t* slots = ( size_t* )malloc( numSlots * sizeof( size_t ) );
+    replay->events = ( fsm_replay_event_t* )malloc( ( count + 1 ) * sizeof( fsm_replay_event_t ) );
+    replay->instanceIDs = ( uint64_t* )malloc( ( count + 1 ) * sizeof( uint64_t ) );
+    replay->initialStates = ( data_t* )malloc( ( count + 1 ) * sizeof( data_t ) );
+    bool retVal = slots && replay->events && replay->instanceIDs && replay->initialStates;
+    for( size_t i = 0; retVal && ( i < numSlots ); ++i )
+    {
+        slots[ i ] = SIZE_MAX;
+    }
+
+    // The state each instance was last recorded in, for events that did not move it.
+    data_t* current = retVal ? ( data_t* )malloc( ( count + 1 ) * sizeof( data_t ) ) : NULL;
+    retVal = retVal && current;
+    int32_t firstSource = 0;
+    for( size_t i = 0; retVal && ( i < count ); ++i )
+    {
+        const fsm_trace_record_t* record = &records[ i ];
+        fsm_replay_event_t* event = &replay->events[ replay->numEvents ];
+        if( !i || !fsm_replay_continues( record, &records[ i - 1 ], firstSource ) )
+        {
+            size_t known = replay->numInstances;
+            event->instance = fsm_replay_instance( replay, slots, numSlots - 1, record );
+            event->eventID = ( event_id_t )record->eventID;
+            if( event->instance == known )
+            {
+                current[ known ] = ( data_t )record->source;
+            }
+            event->expected = current[ event->instance ];
+            firstSource = record->source;
+            ++replay->numEvents;
+        }
+        else
+        {
+            --event;
+        }
+        if( record->flags & FSM_TRACE_TAKEN )
+        {
+            event->expected = ( data_t )record->destination;
+            current[ event->instance ] = event->expected;
+        }
+    }
+
+    free( slots );
+    free( current );
+    if( !retVal )
+    {
+        fsm_replay_free( replay );
+    }
+    return retVal;
+}
+
+/**
+ * @brief Release a replay, unmapping its dump if it was opened with fsm_replay_open().
+ *
+ * @param replay The replay.
+ */
+static inline void fsm_replay_close( fsm_replay_t* replay )
+{
+    fsm_replay_free( replay );
+#if FSM_REPLAY_MMAP
+    if( replay->base )
+    {
+        munmap( replay->base, replay->length );
+    }
+#else
+    free( replay->base );
+#endif
+    replay->base = NULL;
+    replay->length = 0;
+    replay->records = NULL;
+    replay->numRecords = 0;
+}
+
+/**
+ * @brief Check the header of a trace dump and find its records.
+ *
+ * @return The records or NULL if the dump is not valid.
+ */
+static inline const fsm_trace_record_t* fsm_replay_attach( const void* data, size_t size, size_t* count )
+{
+    const fsm_trace_dump_header_t* header = ( const fsm_trace_dump_header_t* )data;
+    bool valid = ( size >= sizeof( *header ) ) && ( header->magic == FSM_TRACE_MAGIC ) && ( header->version == FSM_TRACE_VERSION ) &&
+                 ( header->recordSize == sizeof( fsm_trace_record_t ) ) &&
+                 ( header->count <= ( ( size - sizeof( *header ) ) / sizeof( fsm_trace_record_t ) ) );
+    *count = valid ? ( size_t )header->count : 0;
+    return valid ? ( const fsm_trace_record_t* )( header + 1 ) : NULL;
+}
+
+/**
+ * @brief Map a trace dump written by fsm_trace_dump() and recover its events.
+ *
+ * @param replay Receives the events, release it with fsm_replay_close().
+ * @param path The dump.
+ * @return true The dump is mapped and its events recovered.
+ * @return false The file could not be read, is not a trace dump (or of another version or byte order), or
+ * out of memory; nothing is left allocated.
+ */
+static inline bool fsm_replay_open( fsm_replay_t* replay, const char* path )
+{
+    void* base = NULL;
+    size_t length = 0;
+    replay->base = NULL;
+    replay->length = 0;
+    replay->events = NULL;
+    replay->instanceIDs = NULL;
+    replay->initialStates = NULL;
+
+#if FSM_REPLAY_MMAP
+    int fd = open( path, O_RDONLY );
+    if( fd >= 0 )
+    {
+        struct stat info;
+        if( ( fstat( fd, &info ) == 0 ) && ( info.st_size > 0 ) )
+        {
+            void* mapping = mmap( NULL, ( size_t )info.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+            if( mapping != MAP_FAILED )
+            {
+                base = mapping;
+                length = ( size_t )info.st_size;
+            }
+        }
+        close( fd );
+    }
+#else
+    FILE* file = fopen( path, "rb" );
+    if( file )
+    {
+        if( ( fseek( file, 0, SEEK_END ) == 0 ) && ( ftell( file ) > 0 ) )
+        {
+            length = ( size_t )ftell( file );
+            base = malloc( length );
+            rewind( file );
+            if( base && ( fread( base, 1, length, file ) != length ) )
+            {
+                free( base );
+                base = NULL;
+            }
+        }
+        fclose( file );
+    }
+#endif
+
+    size_t count = 0;
+    const fsm_trace_record_t* records = base ? fsm_replay_attach( base, length, &count ) : NULL;
+    bool retVal = records && fsm_replay_parse( replay, records, count );
+    // Parsing starts a replay of records in memory, the mapping is owned from here on.
+    replay->base = base;
+    replay->length = length;
+    if( !retVal )
+    {
+        fsm_replay_close( replay );
+    }
+    return retVal;
+}
+
+/**
+ * @brief Put each state machine in the state its instance started in.
+ *
+ * @param replay The replay.
+ * @param machines The state machines, one per instance (numInstances of them).
+ * @param states The state table, states are matched to the recording by their data.
+ * @param numStates The number of states in the table.
+ * @return true Every instance's state was found.
+ * @return false An instance started in a state not in the table, its state machine is left unchanged.
+ */
+static inline bool fsm_replay_reset( const fsm_replay_t* replay, state_machine_t* machines, state_t* const* states, size_t numStates )
+{
+    bool retVal = true;
+    for( size_t i = 0; i < replay->numInstances; ++i )
+    {
+        size_t s = 0;
+        while( ( s < numStates ) && ( states[ s ]->data != replay->initialStates[ i ] ) )
+        {
+            ++s;
+        }
+        if( s < numStates )
+        {
+            machines[ i ].currentState = states[ s ];
+        }
+        else
+        {
+            retVal = false;
+        }
+    }
+    return retVal;
+}
+
+/**
+ * @brief Add the latency of a call to a histogram.
+ */
+static inline void fsm_replay_record( fsm_replay_result_t* result, uint64_t ns, size_t events )
+{
+    size_t bucket = 0;
+    while( ( ns >>= 1 ) && ( bucket < FSM_REPLAY_BUCKETS - 1 ) )
+    {
+        ++bucket;
+    }
+    result->histogram[ bucket ] += events;
+}
+
+/**
+ * @brief Replay the events of a shard.
+ */
+static inline void fsm_replay_shard( fsm_replay_shard_t* shard )
+{
+    fsm_replay_result_t* result = &shard->result;
+    event_t events[ FSM_REPLAY_MAX_BATCH ];
+    memset( events, 0, sizeof( events ) );
+
+    // Calls are timed with the cycle counter, converted to nanoseconds with the wall clock over the shard.
+    uint64_t startNs = fsm_replay_now_ns();
+    uint64_t startCycles = fsm_cycles();
+    uint64_t calls[ FSM_REPLAY_BUCKETS * 2 ] = { 0 };
+    for( size_t i = 0; i < shard->numEvents; )
+    {
+        const fsm_replay_event_t* first = &shard->events[ i ];
+        state_machine_t* fsm = &shard->machines[ first->instance ];
+        size_t count = 1;
+        while( ( count < shard->batch ) && ( i + count < shard->numEvents ) && ( shard->events[ i + count ].instance == first->instance ) )
+        {
+            ++count;
+        }
+        for( size_t j = 0; j < count; ++j )
+        {
+            events[ j ].ID = shard->events[ i + j ].eventID;
+            events[ j ].data = 0;
+        }
+
+        uint64_t begin = fsm_cycles();
+        size_t transitions = ( count == 1 ) ? ( fsm_handle_event( fsm, &events[ 0 ] ) ? 1 : 0 ) : fsm_handle_events( fsm, events, count );
+        uint64_t taken = fsm_cycles() - begin;
+
+        // Per event cycles, binned by power of two until the conversion rate is known.
+        uint64_t perEvent = taken / count;
+        size_t bin = 0;
+        while( ( perEvent >>= 1 ) && ( bin < ( FSM_REPLAY_BUCKETS * 2 ) - 1 ) )
+        {
+            ++bin;
+        }
+        calls[ bin ] += count;
+
+        result->transitions += transitions;
+        result->events += count;
+        if( !fsm->currentState || ( fsm->currentState->data != shard->events[ i + count - 1 ].expected ) )
+        {
+            ++result->mismatches;
+        }
+        i += count;
+    }
+    double elapsedCycles = ( double )( fsm_cycles() - startCycles );
+    double nsPerCycle = elapsedCycles > 0 ? ( double )( fsm_replay_now_ns() - startNs ) / elapsedCycles : 1.0;
+    for( size_t bin = 0; bin < FSM_REPLAY_BUCKETS * 2; ++bin )
+    {
+        if( calls[ bin ] )
+        {
+            fsm_replay_record( result, ( uint64_t )( ( double )( ( uint64_t )1 << bin ) * nsPerCycle ), ( size_t )calls[ bin ] );
+        }
+    }
+}
+
+/**
+ * @brief Thread entry of a shard.
+ */
+static inline void* fsm_replay_worker( void* argument )
+{
+    fsm_replay_shard( ( fsm_replay_shard_t* )argument );
+    return NULL;
+}
+
+/**
+ * @brief Replay the recorded events into state machines.
+ *
+ * @param replay The replay.
+ * @param machines The state machines, one per instance, in their starting states (see fsm_replay_reset()).
+ * @param numThreads The number of threads (shards), including the calling thread.
+ * @param batch The most consecutive events for one instance handed to fsm_handle_events() at once, 1 to
+ * handle every event with fsm_handle_event() (up to FSM_REPLAY_MAX_BATCH).
+ * @param result Receives the result.
+ * @return true The events were replayed.
+ * @return false Out of memory.
+ */
+static inline bool fsm_replay_run( const fsm_replay_t* replay, state_machine_t* machines, size_t numThreads, size_t batch, fsm_replay_result_t* result )
+{
+    memset( result, 0, sizeof( *result ) );
+    numThreads = numThreads ? numThreads : 1;
+    batch = ( batch < 1 ) ? 1 : ( ( batch > FSM_REPLAY_MAX_BATCH ) ? FSM_REPLAY_MAX_BATCH : batch );
+
+    // Split the events into shards by instance, keeping their order.
+    fsm_replay_shard_t* shards = ( fsm_replay_shard_t* )calloc( numThreads, sizeof( fsm_replay_shard_t ) );
+    fsm_replay_event_t* events = ( fsm_replay_event_t* )malloc( ( replay->numEvents + 1 ) * sizeof( fsm_replay_event_t ) );
+    bool* started = ( bool* )calloc( numThreads, sizeof( bool ) );
+    bool retVal = shards && events && started;
+    for( size_t i = 0; retVal && ( i < replay->numEvents ); ++i )
+    {
+        ++shards[ replay->events[ i ].instance % numThreads ].numEvents;
+    }
+    for( size_t s = 0, first = 0; retVal && ( s < numThreads ); ++s )
+    {
+        shards[ s ].replay = replay;
+        shards[ s ].machines = machines;
+        shards[ s ].events = &events[ first ];
+        shards[ s ].batch = batch;
+        first += shards[ s ].numEvents;
+        shards[ s ].numEvents = 0;
+    }
+    for( size_t i = 0; retVal && ( i < replay->numEvents ); ++i )
+    {
+        fsm_replay_shard_t* shard = &shards[ replay->events[ i ].instance % numThreads ];
+        events[ ( size_t )( shard->events - events ) + shard->numEvents++ ] = replay->events[ i ];
+    }
+
+    if( retVal )
+    {
+        uint64_t startNs = fsm_replay_now_ns();
+        for( size_t s = 1; s < numThreads; ++s )
+        {
+            started[ s ] = pthread_create( &shards[ s ].thread, NULL, fsm_replay_worker, &shards[ s ] ) == 0;
+        }
+        // The calling thread replays the first shard and any shard a thread could not be started for.
+        for( size_t s = 0; s < numThreads; ++s )
+        {
+            if( !started[ s ] )
+            {
+                fsm_replay_shard( &shards[ s ] );
+            }
+        }
+        for( size_t s = 1; s < numThreads; ++s )
+        {
+            if( started[ s ] )
+            {
+                pthread_join( shards[ s ].thread, NULL );
+            }
+        }
+        result->elapsedNs = fsm_replay_now_ns() - startNs;
+
+        for( size_t s = 0; s < numThreads; ++s )
+        {
+            result->events += shards[ s ].result.events;
+            result->transitions += shards[ s ].result.transitions;
+            result->mismatches += shards[ s ].result.mismatches;
+            for( size_t b = 0; b < FSM_REPLAY_BUCKETS; ++b )
+            {
+                result->histogram[ b ] += shards[ s ].result.histogram[ b ];
+            }
+        }
+        result->eventsPerSecond = result->elapsedNs ? ( ( double )result->events * 1e9 ) / ( double )result->elapsedNs : 0.0;
+    }
+    free( shards );
+    free( events );
+    free( started );
+    return retVal;
+}
+
+/**
+ * @brief Estimate a latency percentile from the histogram of a replay.
+ *
+ * @param result The result.
+ * @param fraction The fraction of events, e.g. 0.99.
+ * @return The upper bound in nanoseconds of the bucket holding the percentile.
+ */
+static inline uint64_t fsm_replay_percentile( const fsm_replay_result_t* result, double fraction )
+{
+    uint64_t total = 0;
+    for( size_t b = 0; b < FSM_REPLAY_BUCKETS; ++b )
+    {
+        total += result->histogram[ b ];
+    }
+    uint64_t seen = 0;
+    for( size_t b = 0; b < FSM_REPLAY_BUCKETS; ++b )
+    {
+        seen += result->histogram[ b ];
+        if( total && ( ( double )seen >= fraction * ( double )total ) )
+        {
+            return ( ( uint64_t )2 << b ) - 1;
+        }
+    }
+    return 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // FINITE_STATE_MACHINE_REPLAY_H
@@ -0,0 +1,612 @@
+/*******************************************************************************
+MIT License
+
+Copyright (c) 2024 Julian Mitchell
+https://github.com/jupeos/fsm
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+
+
+#ifndef FINITE_STATE_MACHINE_SNAPSHOT_H
+#define FINITE_STATE_MACHINE_SNAPSHOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "finite_state_machine.h"
+#include "finite_state_machine_population.h"
+
+/**
+ * @file finite_state_machine_snapshot.h
+ * @author Julian Mitchell
+ * @date 25th Jan 2024
+ * @brief Snapshots of the current states of many state machines, for restart and migration.
+ *
+ * @details State pointers mean nothing to another process, so a snapshot stores each instance's current state
+ * as its index in a state table (fsm_snapshot_table_t) along with a hash of the graph, and a restore rejects a
+ * snapshot of a different graph. A population already holds indices, it is written and read as one block of
+ * memory. Arrays of state_machine_t are converted a block at a time, each index turning back into a pointer
+ * with one table read.
+ *
+ * A full snapshot is the header followed by the index of every instance. A delta snapshot holds only the
+ * blocks of FSM_SNAPSHOT_BLOCK_SIZE instances that changed since the last snapshot, as recorded in a base
+ * array, and is restored on top of the snapshots before it. Data goes through write and read callbacks
+ * (fsm_snapshot_file_write() and fsm_snapshot_file_read() use stdio) in block sized or larger pieces.
+ *
+ * Only the current states are saved, not queued events or pending timeouts. Snapshots use the byte order of
+ * the machine that wrote them.
+ *
+ * Example usage:
+ * @code
+ *    #include "finite_state_machine_snapshot.h"
+ *
+ *    static fsm_snapshot_entry_t entries[ 2 ];
+ *    static fsm_snapshot_table_t table;
+ *    static fsm_state_index_t base[ 1000000 ];
+ *
+ *    void init( void )
+ *    {
+ *        fsm_snapshot_table_init( &table, states, 2, entries );
+ *    }
+ *
+ *    bool save( FILE* file, bool delta )
+ *    {
+ *        return fsm_snapshot_write_population( &table, &population, base, delta, fsm_snapshot_file_write, file );
+ *    }
+ *
+ *    bool restore( FILE* file )
+ *    {
+ *        return fsm_snapshot_read_population( &table, &population, base, fsm_snapshot_file_read, file );
+ *    }
+ * @endcode
+ */
+
+#ifndef FSM_SNAPSHOT_BLOCK_SIZE
+#define FSM_SNAPSHOT_BLOCK_SIZE 4096 /*< The number of instances in a block, the unit of delta snapshots. */
+#endif
+
+#define FSM_SNAPSHOT_MAGIC   0x534d5346u /*< "FSMS" in little endian byte order.*/
+#define FSM_SNAPSHOT_VERSION 1u
+#define FSM_SNAPSHOT_DELTA   0x01u                /*< Header flag, only the changed blocks follow.*/
+#define FSM_SNAPSHOT_END     ( ( uint64_t )-1 )   /*< The block number that ends a delta snapshot.*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Writes the next part of a snapshot.
+ *
+ * @param context The context given with the callback.
+ * @param data The data.
+ * @param size The number of bytes.
+ * @return true All of the data was written.
+ */
+typedef bool ( *fsm_snapshot_write_t )( void* context, const void* data, size_t size );
+
+/**
+ * @brief Reads the next part of a snapshot.
+ *
+ * @param context The context given with the callback.
+ * @param data Receives the data.
+ * @param size The number of bytes.
+ * @return true All of the data was read.
+ */
+typedef bool ( *fsm_snapshot_read_t )( void* context, void* data, size_t size );
+
+/**
+ * @brief The header of a snapshot.
+ *
+ * @details A full snapshot is followed by *count* indices. A delta snapshot is followed by block records, each
+ * a uint64_t block number and the indices of that block, and ends with the block number FSM_SNAPSHOT_END.
+ */
+typedef struct
+{
+    uint32_t magic;     /*< FSM_SNAPSHOT_MAGIC.*/
+    uint32_t version;   /*< FSM_SNAPSHOT_VERSION.*/
+    uint32_t indexSize; /*< sizeof( fsm_state_index_t ).*/
+    uint32_t flags;     /*< FSM_SNAPSHOT_DELTA.*/
+    uint32_t numStates; /*< The number of states in the table.*/
+    uint32_t blockSize; /*< FSM_SNAPSHOT_BLOCK_SIZE.*/
+    uint64_t graphHash; /*< fsm_snapshot_table_t::graphHash.*/
+    uint64_t count;     /*< The number of instances.*/
+} fsm_snapshot_header_t;
+
+/**
+ * @brief A state and its index in the state table.
+ */
+typedef struct
+{
+    const state_t* state;    /*< The state.*/
+    fsm_state_index_t index; /*< Its index.*/
+} fsm_snapshot_entry_t;
+
+/**
+ * @brief The state table of a graph, with a lookup from state to index.
+ */
+typedef struct
+{
+    state_t* const* states;        /*< The state table, every state an instance can be in must be listed.*/
+    size_t numStates;              /*< The number of states in the table.*/
+    fsm_snapshot_entry_t* byState; /*< The states in address order, for fsm_snapshot_index_of().*/
+    uint64_t graphHash;            /*< A hash of the states' data and transitions in table order.*/
+} fsm_snapshot_table_t;
+
+/**
+ * @brief Order entries by state address, see qsort().
+ */
+static inline int fsm_snapshot_compare_entries( const void* a, const void* b )
+{
+    uintptr_t x = ( uintptr_t )( ( const fsm_snapshot_entry_t* )a )->state;
+    uintptr_t y = ( uintptr_t )( ( const fsm_snapshot_entry_t* )b )->state;
+    return ( x > y ) - ( x < y );
+}
+
+/**
+ * @brief Find a state in a state table.
+ *
+ * @param table The table.
+ * @param state The state to look for.
+ * @return The index of the state or *numStates* if it is not in the table.
+ */
+static inline size_t fsm_snapshot_index_of( const fsm_snapshot_table_t* table, const state_t* state )
+{
+    size_t low = 0;
+    size_t high = table->numStates;
+    while( low < high )
+    {
+        size_t mid = low + ( ( high - low ) / 2 );
+        if( ( uintptr_t )table->byState[ mid ].state < ( uintptr_t )state )
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return ( ( low < table->numStates ) && ( table->byState[ low ].state == state ) ) ? table->byState[ low ].index : table->numStates;
+}
+
+/**
+ * @brief Mix a value into an FNV-1a hash.
+ */
+static inline uint64_t fsm_snapshot_hash( uint64_t hash, uint64_t value )
+{
+    for( int i = 0; i < 8; ++i )
+    {
+        hash = ( hash ^ ( ( value >> ( i * 8 ) ) & 0xffu ) ) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+/**
+ * @brief Initialise a state table.
+ *
+ * @details The graph hash covers each state's data and each transition's event ID and next state index, so it
+ * is the same in every process built from the same definitions while any change to the graph changes it.
+ *
+ * @param table The table.
+ * @param states The state table.
+ * @param numStates The number of states in the table.
+ * @param entries Storage for *numStates* entries.
+ * @return true The table is ready for use.
+ * @return false The table has more states than fsm_state_index_t can index or lists a state twice.
+ */
+static inline bool fsm_snapshot_table_init( fsm_snapshot_table_t* table,
+                                            state_t* const* states,
+                                            size_t numStates,
+                                            fsm_snapshot_entry_t* entries )
+{
+    if( !numStates || ( numStates - 1 != ( size_t )( fsm_state_index_t )( numStates - 1 ) ) )
+    {
+        return false;
+    }
+
+    table->states = states;
+    table->numStates = numStates;
+    table->byState = entries;
+    for( size_t i = 0; i < numStates; ++i )
+    {
+        entries[ i ].state = states[ i ];
+        entries[ i ].index = ( fsm_state_index_t )i;
+    }
+    qsort( entries, numStates, sizeof( fsm_snapshot_entry_t ), fsm_snapshot_compare_entries );
+    for( size_t i = 1; i < numStates; ++i )
+    {
+        if( entries[ i ].state == entries[ i - 1 ].state )
+        {
+            return false;
+        }
+    }
+
+    uint64_t hash = fsm_snapshot_hash( 0xcbf29ce484222325ull, numStates );
+    for( size_t i = 0; i < numStates; ++i )
+    {
+        const state_t* state = states[ i ];
+        hash = fsm_snapshot_hash( hash, ( uint64_t )state->data );
+        hash = fsm_snapshot_hash( hash, state->numTransitions );
+        for( size_t t = 0; t < state->numTransitions; ++t )
+        {
+            hash = fsm_snapshot_hash( hash, ( uint64_t )state->transitions[ t ].eventID );
+            hash = fsm_snapshot_hash( hash, fsm_snapshot_index_of( table, state->transitions[ t ].nextState ) );
+        }
+    }
+    table->graphHash = hash;
+    return true;
+}
+
+/**
+ * @brief Write a snapshot header.
+ */
+static inline bool fsm_snapshot_write_header( const fsm_snapshot_table_t* table,
+                                              size_t count,
+                                              bool delta,
+                                              fsm_snapshot_write_t write,
+                                              void* context )
+{
+    fsm_snapshot_header_t header = { FSM_SNAPSHOT_MAGIC,
+                                     FSM_SNAPSHOT_VERSION,
+                                     ( uint32_t )sizeof( fsm_state_index_t ),
+                                     delta ? FSM_SNAPSHOT_DELTA : 0u,
+                                     ( uint32_t )table->numStates,
+                                     FSM_SNAPSHOT_BLOCK_SIZE,
+                                     table->graphHash,
+                                     ( uint64_t )count };
+    return write( context, &header, sizeof( header ) );
+}
+
+/**
+ * @brief Read and check a snapshot header.
+ *
+ * @return true The snapshot is of *count* instances of the table's graph.
+ */
+static inline bool fsm_snapshot_read_header( const fsm_snapshot_table_t* table,
+                                             size_t count,
+                                             bool* delta,
+                                             fsm_snapshot_read_t read,
+                                             void* context )
+{
+    fsm_snapshot_header_t header;
+    if( !read( context, &header, sizeof( header ) ) )
+    {
+        return false;
+    }
+    *delta = ( header.flags & FSM_SNAPSHOT_DELTA ) != 0;
+    return ( header.magic == FSM_SNAPSHOT_MAGIC ) && ( header.version == FSM_SNAPSHOT_VERSION ) &&
+           ( header.indexSize == sizeof( fsm_state_index_t ) ) && ( header.numStates == table->numStates ) &&
+           ( header.blockSize == FSM_SNAPSHOT_BLOCK_SIZE ) && ( header.graphHash == table->graphHash ) &&
+           ( header.count == ( uint64_t )count );
+}
+
+/**
+ * @brief Write one block of a delta snapshot if it differs from the base.
+ */
+static inline bool fsm_snapshot_write_block( uint64_t block,
+                                             const fsm_state_index_t* current,
+                                             fsm_state_index_t* base,
+                                             size_t length,
+                                             fsm_snapshot_write_t write,
+                                             void* context )
+{
+    size_t size = length * sizeof( fsm_state_index_t );
+    if( memcmp( current, base, size ) == 0 )
+    {
+        return true;
+    }
+    return write( context, &block, sizeof( block ) ) && write( context, current, size );
+}
+
+/**
+ * @brief Check that every index is in the table.
+ */
+static inline bool fsm_snapshot_valid_indices( const fsm_snapshot_table_t* table, const fsm_state_index_t* indices, size_t length )
+{
+    // Branch free so the check runs at memory speed.
+    size_t invalid = 0;
+    for( size_t i = 0; i < length; ++i )
+    {
+        invalid |= ( size_t )( indices[ i ] >= table->numStates );
+    }
+    return !invalid;
+}
+
+/**
+ * @brief Write a snapshot of a population.
+ *
+ * @param table The table of the population's states, in the same order.
+ * @param population The population.
+ * @param base The instance states as of the last snapshot (optional for a full snapshot), updated to the current states
+ * once the whole snapshot is written. It is unchanged if a write fails, so the next delta writes every change again.
+ * @param delta Write only the blocks that differ from *base*.
+ * @param write The write callback.
+ * @param context The context for the callback.
+ * @return true The snapshot was written.
+ * @return false A write failed (or a delta was asked for without a base).
+ */
+static inline bool fsm_snapshot_write_population( const fsm_snapshot_table_t* table,
+                                                  const fsm_population_t* population,
+                                                  fsm_state_index_t* base,
+                                                  bool delta,
+                                                  fsm_snapshot_write_t write,
+                                                  void* context )
+{
+    if( ( delta && !base ) || !fsm_snapshot_write_header( table, population->count, delta, write, context ) )
+    {
+        return false;
+    }
+
+    if( !delta )
+    {
+        if( !write( context, population->current, population->count * sizeof( fsm_state_index_t ) ) )
+        {
+            return false;
+        }
+        if( base )
+        {
+            memcpy( base, population->current, population->count * sizeof( fsm_state_index_t ) );
+        }
+        return true;
+    }
+
+    for( size_t first = 0; first < population->count; first += FSM_SNAPSHOT_BLOCK_SIZE )
+    {
+        size_t length = ( population->count - first < FSM_SNAPSHOT_BLOCK_SIZE ) ? population->count - first : FSM_SNAPSHOT_BLOCK_SIZE;
+        if( !fsm_snapshot_write_block( first / FSM_SNAPSHOT_BLOCK_SIZE, &population->current[ first ], &base[ first ], length, write, context ) )
+        {
+            return false;
+        }
+    }
+    uint64_t end = FSM_SNAPSHOT_END;
+    if( !write( context, &end, sizeof( end ) ) )
+    {
+        return false;
+    }
+    // A reader rejects a delta without its end marker, only now are the blocks written.
+    memcpy( base, population->current, population->count * sizeof( fsm_state_index_t ) );
+    return true;
+}
+
+/**
+ * @brief Restore a population from a full or delta snapshot.
+ *
+ * @details A delta snapshot is applied on top of the current states, restore the full snapshot it follows
+ * first. The population is unchanged if the header does not match, but may be partly restored if the
+ * snapshot is cut short or corrupt.
+ *
+ * @param table The table of the population's states, in the same order.
+ * @param population The population, initialised with the same number of instances.
+ * @param base Updated to the restored states, ready for the next delta snapshot (optional).
+ * @param read The read callback.
+ * @param context The context for the callback.
+ * @return true The snapshot was restored.
+ * @return false A read failed or the snapshot is not of this graph and population.
+ */
+static inline bool fsm_snapshot_read_population( const fsm_snapshot_table_t* table,
+                                                 fsm_population_t* population,
+                                                 fsm_state_index_t* base,
+                                                 fsm_snapshot_read_t read,
+                                                 void* context )
+{
+    bool delta;
+    if( !fsm_snapshot_read_header( table, population->count, &delta, read, context ) )
+    {
+        return false;
+    }
+
+    if( !delta )
+    {
+        if( !read( context, population->current, population->count * sizeof( fsm_state_index_t ) ) ||
+            !fsm_snapshot_valid_indices( table, population->current, population->count ) )
+        {
+            return false;
+        }
+    }
+    else
+    {
+        uint64_t block;
+        while( read( context, &block, sizeof( block ) ) && ( block != FSM_SNAPSHOT_END ) )
+        {
+            if( block >= ( population->count + FSM_SNAPSHOT_BLOCK_SIZE - 1 ) / FSM_SNAPSHOT_BLOCK_SIZE )
+            {
+                return false;
+            }
+            size_t first = ( size_t )block * FSM_SNAPSHOT_BLOCK_SIZE;
+            size_t length = ( population->count - first < FSM_SNAPSHOT_BLOCK_SIZE ) ? population->count - first : FSM_SNAPSHOT_BLOCK_SIZE;
+            if( !read( context, &population->current[ first ], length * sizeof( fsm_state_index_t ) ) ||
+                !fsm_snapshot_valid_indices( table, &population->current[ first ], length ) )
+            {
+                return false;
+            }
+        }
+        if( block != FSM_SNAPSHOT_END )
+        {
+            return false;
+        }
+    }
+
+    if( base )
+    {
+        memcpy( base, population->current, population->count * sizeof( fsm_state_index_t ) );
+    }
+    return true;
+}
+
+/**
+ * @brief Write a snapshot of an array of state machines.
+ *
+ * @param table The table of the states the state machines can be in.
+ * @param machines The state machines, not handling events while they are written.
+ * @param count The number of state machines.
+ * @param base The state indices as of the last snapshot (optional for a full snapshot), updated to the current states
+ * once the whole snapshot is written. It is unchanged if the snapshot fails.
+ * @param delta Write only the blocks that differ from *base*.
+ * @param write The write callback.
+ * @param context The context for the callback.
+ * @return true The snapshot was written.
+ * @return false A write failed, a state machine is in a state not in the table or a delta was asked for without a base.
+ */
+static inline bool fsm_snapshot_write_machines( const fsm_snapshot_table_t* table,
+                                                const state_machine_t* machines,
+                                                size_t count,
+                                                fsm_state_index_t* base,
+                                                bool delta,
+                                                fsm_snapshot_write_t write,
+                                                void* context )
+{
+    if( ( delta && !base ) || !fsm_snapshot_write_header( table, count, delta, write, context ) )
+    {
+        return false;
+    }
+
+    fsm_state_index_t indices[ FSM_SNAPSHOT_BLOCK_SIZE ];
+    for( size_t first = 0; first < count; first += FSM_SNAPSHOT_BLOCK_SIZE )
+    {
+        size_t length = ( count - first < FSM_SNAPSHOT_BLOCK_SIZE ) ? count - first : FSM_SNAPSHOT_BLOCK_SIZE;
+        for( size_t i = 0; i < length; ++i )
+        {
+            size_t index = fsm_snapshot_index_of( table, machines[ first + i ].currentState );
+            if( index >= table->numStates )
+            {
+                return false;
+            }
+            indices[ i ] = ( fsm_state_index_t )index;
+        }
+
+        bool written = delta ? fsm_snapshot_write_block( first / FSM_SNAPSHOT_BLOCK_SIZE, indices, &base[ first ], length, write, context )
+                             : write( context, indices, length * sizeof( fsm_state_index_t ) );
+        if( !written )
+        {
+            return false;
+        }
+    }
+
+    uint64_t end = FSM_SNAPSHOT_END;
+    if( delta && !write( context, &end, sizeof( end ) ) )
+    {
+        return false;
+    }
+
+    // Every state was found above, the indices are looked up again rather than kept for the whole array.
+    for( size_t i = 0; base && ( i < count ); ++i )
+    {
+        base[ i ] = ( fsm_state_index_t )fsm_snapshot_index_of( table, machines[ i ].currentState );
+    }
+    return true;
+}
+
+/**
+ * @brief Restore the current states of an array of state machines from a full or delta snapshot.
+ *
+ * @details Only *currentState* is set, entry actions are not performed. A delta snapshot is applied on top of
+ * the current states, restore the full snapshot it follows first.
+ *
+ * @param table The table of the states the state machines can be in.
+ * @param machines The state machines.
+ * @param count The number of state machines.
+ * @param base Updated to the restored state indices, ready for the next delta snapshot (optional).
+ * @param read The read callback.
+ * @param context The context for the callback.
+ * @return true The snapshot was restored.
+ * @return false A read failed or the snapshot is not of this graph and number of state machines.
+ */
+static inline bool fsm_snapshot_read_machines( const fsm_snapshot_table_t* table,
+                                               state_machine_t* machines,
+                                               size_t count,
+                                               fsm_state_index_t* base,
+                                               fsm_snapshot_read_t read,
+                                               void* context )
+{
+    bool delta;
+    if( !fsm_snapshot_read_header( table, count, &delta, read, context ) )
+    {
+        return false;
+    }
+
+    const size_t numBlocks = ( count + FSM_SNAPSHOT_BLOCK_SIZE - 1 ) / FSM_SNAPSHOT_BLOCK_SIZE;
+    fsm_state_index_t indices[ FSM_SNAPSHOT_BLOCK_SIZE ];
+    for( uint64_t next = 0;; ++next )
+    {
+        // A full snapshot holds every block in order, a delta numbers the blocks it holds.
+        uint64_t block = next;
+        if( delta )
+        {
+            if( !read( context, &block, sizeof( block ) ) )
+            {
+                return false;
+            }
+            if( block == FSM_SNAPSHOT_END )
+            {
+                break;
+            }
+        }
+        if( block >= numBlocks )
+        {
+            if( !delta )
+            {
+                break;
+            }
+            return false;
+        }
+
+        size_t first = ( size_t )block * FSM_SNAPSHOT_BLOCK_SIZE;
+        size_t length = ( count - first < FSM_SNAPSHOT_BLOCK_SIZE ) ? count - first : FSM_SNAPSHOT_BLOCK_SIZE;
+        if( !read( context, indices, length * sizeof( fsm_state_index_t ) ) || !fsm_snapshot_valid_indices( table, indices, length ) )
+        {
+            return false;
+        }
+        for( size_t i = 0; i < length; ++i )
+        {
+            machines[ first + i ].currentState = table->states[ indices[ i ] ];
+        }
+        if( base )
+        {
+            memcpy( &base[ first ], indices, length * sizeof( fsm_state_index_t ) );
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief A write callback for a stdio file, the context is the FILE*.
+ */
+static inline bool fsm_snapshot_file_write( void* context, const void* data, size_t size )
+{
+    return fwrite( data, 1, size, ( FILE* )context ) == size;
+}
+
+/**
+ * @brief A read callback for a stdio file, the context is the FILE*.
+ */
+static inline bool fsm_snapshot_file_read( void* context, void* data, size_t size )
+{
+    return fread( data, 1, size, ( FILE* )context ) == size;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // FINITE_STATE_MACHINE_SNAPSHOT_H
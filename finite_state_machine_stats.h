@@ -0,0 +1,170 @@
+/*******************************************************************************
+MIT License
+
+Copyright (c) 2024 Julian Mitchell
+https://github.com/jupeos/fsm
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+
+#ifndef FINITE_STATE_MACHINE_STATS_H
+#define FINITE_STATE_MACHINE_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "finite_state_machine_conf.h"
+#include "finite_state_machine_port.h"
+
+/**
+ * @file finite_state_machine_stats.h
+ * @author Julian Mitchell
+ * @date 25th Jan 2024
+ * @brief Counters of state machine activity, included by finite_state_machine.h when FSM_ENABLE_STATS is set.
+ *
+ * @details Each state built with SM_TRANSITIONS gets a block of counters per thread slot, and each of its
+ * transitions a block per thread slot, every block on its own cache line so threads never share one.
+ * Updates are relaxed atomic adds with no ordering cost and an exporter on another thread can take a
+ * snapshot with fsm_stats_snapshot() at any time, without stopping the state machines.
+ *
+ * Threads are given slots round robin on first use (up to FSM_STATS_MAX_THREADS, after which slots are
+ * shared, which stays correct but costs cache line transfers) or can pick one with fsm_stats_set_thread_slot().
+ * With FSM_ENABLE_STATS_TIMING the cycles spent in guards and in the exit, transition and entry actions
+ * are also counted, using fsm_cycles().
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief The counters of a state for one thread slot.
+ */
+typedef struct
+{
+    FSM_ALIGNAS( FSM_CACHE_LINE_SIZE ) FSM_ATOMIC( uint64_t ) eventsReceived; /*< Events handled in this state.*/
+    FSM_ATOMIC( uint64_t ) transitionsTaken;                                 /*< Transitions out of this state.*/
+    FSM_ATOMIC( uint64_t ) guardRejections;                                  /*< Transitions blocked by their guard.*/
+    FSM_ATOMIC( uint64_t ) unmatchedEvents;                                  /*< Events with no transition.*/
+    FSM_ATOMIC( uint64_t ) guardCycles;                                      /*< Cycles spent in guards (FSM_ENABLE_STATS_TIMING).*/
+    FSM_ATOMIC( uint64_t ) actionCycles;                                     /*< Cycles spent in actions (FSM_ENABLE_STATS_TIMING).*/
+} fsm_state_stats_t;
+
+/**
+ * @brief The counters of a transition for one thread slot.
+ */
+typedef struct
+{
+    FSM_ALIGNAS( FSM_CACHE_LINE_SIZE ) FSM_ATOMIC( uint64_t ) taken; /*< Times the transition was taken.*/
+    FSM_ATOMIC( uint64_t ) guardRejections;                         /*< Times the guard blocked the transition.*/
+    FSM_ATOMIC( uint64_t ) guardCycles;                             /*< Cycles spent in the guard (FSM_ENABLE_STATS_TIMING).*/
+    FSM_ATOMIC( uint64_t ) actionCycles;                            /*< Cycles spent in actions (FSM_ENABLE_STATS_TIMING).*/
+} fsm_transition_stats_t;
+
+/**
+ * @brief A snapshot of the counters of a state, summed over all thread slots.
+ */
+typedef struct
+{
+    uint64_t eventsReceived;
+    uint64_t transitionsTaken;
+    uint64_t guardRejections;
+    uint64_t unmatchedEvents;
+    uint64_t guardCycles;
+    uint64_t actionCycles;
+} fsm_state_counters_t;
+
+/**
+ * @brief A snapshot of the counters of a transition, summed over all thread slots.
+ */
+typedef struct
+{
+    uint64_t taken;
+    uint64_t guardRejections;
+    uint64_t guardCycles;
+    uint64_t actionCycles;
+} fsm_transition_counters_t;
+
+#if FSM_ENABLE_STATS_TIMING
+#define FSM_STATS_CLOCK() fsm_cycles()
+#else
+#define FSM_STATS_CLOCK() ( ( uint64_t )0 )
+#endif
+
+// The next slot to assign and the calling thread's slot + 1 (0 until assigned), shared by all source files.
+#ifdef FSM_IMPLEMENTATION
+FSM_ATOMIC( size_t ) fsmStatsNextSlot;
+FSM_THREAD_LOCAL size_t fsmStatsSlot = 0;
+#else
+extern FSM_ATOMIC( size_t ) fsmStatsNextSlot;
+extern FSM_THREAD_LOCAL size_t fsmStatsSlot;
+#endif
+
+/**
+ * @brief Choose the counter slot of the calling thread.
+ *
+ * @param slot The slot, below FSM_STATS_MAX_THREADS.
+ */
+static inline void fsm_stats_set_thread_slot( size_t slot )
+{
+    fsmStatsSlot = ( slot % FSM_STATS_MAX_THREADS ) + 1;
+}
+
+/**
+ * @brief Get the counter slot of the calling thread, assigning one on first use.
+ *
+ * @return The slot.
+ */
+static inline size_t fsm_stats_thread_slot( void )
+{
+    if( !fsmStatsSlot )
+    {
+        fsm_stats_set_thread_slot( fsm_atomic_fetch_add( &fsmStatsNextSlot, ( size_t )1, memory_order_relaxed ) );
+    }
+    return fsmStatsSlot - 1;
+}
+
+/**
+ * @brief Add to a counter.
+ *
+ * @param counter The counter.
+ * @param value The amount to add.
+ */
+static inline void fsm_stats_add( FSM_ATOMIC( uint64_t ) * counter, uint64_t value )
+{
+    fsm_atomic_fetch_add( counter, value, memory_order_relaxed );
+}
+
+/**
+ * @brief Read a counter.
+ *
+ * @param counter The counter.
+ * @return The value.
+ */
+static inline uint64_t fsm_stats_read( const FSM_ATOMIC( uint64_t ) * counter )
+{
+    return fsm_atomic_load( ( FSM_ATOMIC( uint64_t )* )counter, memory_order_relaxed );
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // FINITE_STATE_MACHINE_STATS_H
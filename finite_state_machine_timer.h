@@ -0,0 +1,255 @@
+/*******************************************************************************
+MIT License
+
+Copyright (c) 2024 Julian Mitchell
+https://github.com/jupeos/fsm
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+
+#ifndef FINITE_STATE_MACHINE_TIMER_H
+#define FINITE_STATE_MACHINE_TIMER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @file finite_state_machine_timer.h
+ * @author Julian Mitchell
+ * @date 25th Jan 2024
+ * @brief A hierarchical timing wheel, included by finite_state_machine.h when FSM_ENABLE_TIMEOUTS is set.
+ *
+ * @details Timers are intrusive nodes kept in doubly linked slot lists so arming and cancelling are O(1)
+ * with no allocation, however many timers are pending. The wheel has FSM_TIMER_WHEEL_LEVELS levels of
+ * FSM_TIMER_WHEEL_SLOTS slots, level 0 holds timers due within FSM_TIMER_WHEEL_SLOTS ticks and each further
+ * level covers FSM_TIMER_WHEEL_SLOTS times the range of the one below. Timers in a higher level slot are
+ * moved down (cascaded) when the lower levels wrap, so a tick only touches the slots that are due.
+ *
+ * The wheel counts ticks, the caller decides how long a tick is and calls fsm_timer_advance() (or, for state
+ * timeouts, fsm_timeout_tick() in finite_state_machine.h) once per tick. Not thread safe.
+ */
+
+#ifndef FSM_TIMER_WHEEL_LEVELS
+#define FSM_TIMER_WHEEL_LEVELS 4 /*< The number of levels, with 64 slots a wheel covers 2^24 ticks. */
+#endif
+
+#define FSM_TIMER_WHEEL_BITS  6
+#define FSM_TIMER_WHEEL_SLOTS ( 1u << FSM_TIMER_WHEEL_BITS )
+#define FSM_TIMER_MAX_TICKS   ( ( ( uint64_t )1 << ( FSM_TIMER_WHEEL_BITS * FSM_TIMER_WHEEL_LEVELS ) ) - 1 )
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct fsm_timer;
+typedef struct fsm_timer fsm_timer_t;
+
+/**
+ * @brief A timer, embedded in the object it times.
+ * @note Zero initialised timers are not armed.
+ */
+struct fsm_timer
+{
+    fsm_timer_t* next;   /*< The next timer in the same list.*/
+    fsm_timer_t** pprev; /*< The link pointing at this timer, NULL when not armed.*/
+    uint64_t expiry;     /*< The tick the timer is due.*/
+};
+
+/**
+ * @brief A timing wheel.
+ */
+typedef struct
+{
+    fsm_timer_t* slots[ FSM_TIMER_WHEEL_LEVELS ][ FSM_TIMER_WHEEL_SLOTS ]; /*< The pending timers of each slot.*/
+    fsm_timer_t* expired;                                                  /*< The timers due, oldest first.*/
+    fsm_timer_t** expiredTail;                                             /*< The last link of the expired list.*/
+    uint64_t now;                                                          /*< The current tick.*/
+} fsm_timer_wheel_t;
+
+/**
+ * @brief Initialise a timing wheel.
+ *
+ * @param wheel The wheel.
+ */
+static inline void fsm_timer_wheel_init( fsm_timer_wheel_t* wheel )
+{
+    for( size_t level = 0; level < FSM_TIMER_WHEEL_LEVELS; ++level )
+    {
+        for( size_t slot = 0; slot < FSM_TIMER_WHEEL_SLOTS; ++slot )
+        {
+            wheel->slots[ level ][ slot ] = NULL;
+        }
+    }
+    wheel->expired = NULL;
+    wheel->expiredTail = &wheel->expired;
+    wheel->now = 0;
+}
+
+/**
+ * @brief Check whether a timer is armed (pending or expired but not yet delivered).
+ *
+ * @param timer The timer.
+ * @return true The timer is armed.
+ */
+static inline bool fsm_timer_armed( const fsm_timer_t* timer )
+{
+    return timer->pprev != NULL;
+}
+
+/**
+ * @brief Link a timer at the head of a list.
+ *
+ * @param head The list.
+ * @param timer The timer, not armed.
+ */
+static inline void fsm_timer_link( fsm_timer_t** head, fsm_timer_t* timer )
+{
+    timer->next = *head;
+    if( timer->next )
+    {
+        timer->next->pprev = &timer->next;
+    }
+    *head = timer;
+    timer->pprev = head;
+}
+
+/**
+ * @brief Link a timer into the slot for its expiry.
+ *
+ * @param wheel The wheel.
+ * @param timer The timer, not armed.
+ */
+static inline void fsm_timer_insert( fsm_timer_wheel_t* wheel, fsm_timer_t* timer )
+{
+    uint64_t delta = timer->expiry - wheel->now;
+    size_t level = 0;
+    while( ( level < ( FSM_TIMER_WHEEL_LEVELS - 1 ) ) && ( delta >= ( ( uint64_t )FSM_TIMER_WHEEL_SLOTS << ( level * FSM_TIMER_WHEEL_BITS ) ) ) )
+    {
+        ++level;
+    }
+    size_t slot = ( size_t )( timer->expiry >> ( level * FSM_TIMER_WHEEL_BITS ) ) & ( FSM_TIMER_WHEEL_SLOTS - 1 );
+    fsm_timer_link( &wheel->slots[ level ][ slot ], timer );
+}
+
+/**
+ * @brief Cancel a timer, O(1).
+ *
+ * @param wheel The wheel the timer was armed on.
+ * @param timer The timer, which need not be armed.
+ */
+static inline void fsm_timer_cancel( fsm_timer_wheel_t* wheel, fsm_timer_t* timer )
+{
+    if( timer->pprev )
+    {
+        *timer->pprev = timer->next;
+        if( timer->next )
+        {
+            timer->next->pprev = timer->pprev;
+        }
+        else if( wheel->expiredTail == &timer->next )
+        {
+            // The last expired timer.
+            wheel->expiredTail = timer->pprev;
+        }
+        timer->next = NULL;
+        timer->pprev = NULL;
+    }
+}
+
+/**
+ * @brief Arm a timer, O(1). An armed timer is re-armed.
+ *
+ * @param wheel The wheel.
+ * @param timer The timer.
+ * @param ticks The number of ticks until the timer is due, at least 1 and at most FSM_TIMER_MAX_TICKS.
+ */
+static inline void fsm_timer_arm( fsm_timer_wheel_t* wheel, fsm_timer_t* timer, uint64_t ticks )
+{
+    fsm_timer_cancel( wheel, timer );
+    ticks = ( ticks < 1 ) ? 1 : ( ( ticks > FSM_TIMER_MAX_TICKS ) ? FSM_TIMER_MAX_TICKS : ticks );
+    timer->expiry = wheel->now + ticks;
+    fsm_timer_insert( wheel, timer );
+}
+
+/**
+ * @brief Advance the wheel by one tick, the timers that are due are added to the expired list.
+ *
+ * @param wheel The wheel.
+ * @return true There are expired timers to take with fsm_timer_pop_expired().
+ */
+static inline bool fsm_timer_advance( fsm_timer_wheel_t* wheel )
+{
+    ++wheel->now;
+
+    // Each level wraps when all the levels below it do, moving its current slot down a level or more.
+    for( size_t level = 1; level < FSM_TIMER_WHEEL_LEVELS; ++level )
+    {
+        if( wheel->now & ( ( ( uint64_t )1 << ( level * FSM_TIMER_WHEEL_BITS ) ) - 1 ) )
+        {
+            break;
+        }
+        size_t slot = ( size_t )( wheel->now >> ( level * FSM_TIMER_WHEEL_BITS ) ) & ( FSM_TIMER_WHEEL_SLOTS - 1 );
+        fsm_timer_t* timer = wheel->slots[ level ][ slot ];
+        wheel->slots[ level ][ slot ] = NULL;
+        while( timer )
+        {
+            fsm_timer_t* next = timer->next;
+            fsm_timer_insert( wheel, timer );
+            timer = next;
+        }
+    }
+
+    // Everything in the current level 0 slot is due now.
+    fsm_timer_t* timer = wheel->slots[ 0 ][ wheel->now & ( FSM_TIMER_WHEEL_SLOTS - 1 ) ];
+    wheel->slots[ 0 ][ wheel->now & ( FSM_TIMER_WHEEL_SLOTS - 1 ) ] = NULL;
+    while( timer )
+    {
+        fsm_timer_t* next = timer->next;
+        timer->next = NULL;
+        timer->pprev = wheel->expiredTail;
+        *wheel->expiredTail = timer;
+        wheel->expiredTail = &timer->next;
+        timer = next;
+    }
+    return wheel->expired != NULL;
+}
+
+/**
+ * @brief Take the oldest expired timer, which is no longer armed.
+ *
+ * @param wheel The wheel.
+ * @return The timer or NULL if none have expired.
+ */
+static inline fsm_timer_t* fsm_timer_pop_expired( fsm_timer_wheel_t* wheel )
+{
+    fsm_timer_t* timer = wheel->expired;
+    if( timer )
+    {
+        fsm_timer_cancel( wheel, timer );
+    }
+    return timer;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,228 @@
+/*******************************************************************************
+MIT License
+
+Copyright (c) 2024 Julian Mitchell
+https://github.com/jupeos/fsm
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+
+#ifndef FINITE_STATE_MACHINE_TRACE_H
+#define FINITE_STATE_MACHINE_TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "finite_state_machine_conf.h"
+#include "finite_state_machine_port.h"
+
+/**
+ * @file finite_state_machine_trace.h
+ * @author Julian Mitchell
+ * @date 25th Jan 2024
+ * @brief Binary trace rings, included by finite_state_machine.h when FSM_ENABLE_TRACE is set.
+ *
+ * @details Every event handled writes one fixed size record per transition considered (or one if there was no
+ * transition) to a ring: the time stamp, the state machine, the source state's data, the event ID, the index of
+ * the transition, the guard result and the destination state's data. Records are copied in, never formatted,
+ * and the ring has one writer so there are no locks or atomic read-modify-writes on the hot path. A full ring
+ * overwrites its oldest records, keeping the recent history.
+ *
+ * A state machine writes to its own ring when *trace* is set, otherwise to the calling thread's ring (see
+ * fsm_trace_set_thread_ring(), shared by all source files, one of which defines FSM_IMPLEMENTATION).
+ * fsm_trace_dump() writes a ring to a file for tools/fsm_trace_decode.c. Reading a ring while it is written is
+ * best effort, records being overwritten during the read are dropped.
+ */
+
+#define FSM_TRACE_MAGIC         0x54534d46u /*< "FSMT" in little endian byte order.*/
+#define FSM_TRACE_VERSION       1u
+#define FSM_TRACE_NO_TRANSITION 0xffffu /*< The transition index of an event with no transition.*/
+
+#define FSM_TRACE_GUARD  0x01u /*< The transition has a guard.*/
+#define FSM_TRACE_PASSED 0x02u /*< The guard passed (or there was none).*/
+#define FSM_TRACE_TAKEN  0x04u /*< The transition was taken.*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief A trace record, 32 bytes.
+ */
+typedef struct
+{
+    uint64_t timestamp;   /*< fsm_cycles() when the record was written.*/
+    uint64_t instance;    /*< The address of the state machine, identifies it within one process.*/
+    int32_t source;       /*< The data of the state that owns the transition (the current state if none).*/
+    int32_t eventID;      /*< The event ID.*/
+    int32_t destination;  /*< The data of the next state (the source if the transition was not taken).*/
+    uint16_t transition;  /*< The index of the transition in the source state or FSM_TRACE_NO_TRANSITION.*/
+    uint8_t flags;        /*< FSM_TRACE_GUARD, FSM_TRACE_PASSED and FSM_TRACE_TAKEN.*/
+    uint8_t reserved;     /*< Zero.*/
+} fsm_trace_record_t;
+
+/**
+ * @brief The header of a trace dump, followed by *count* records oldest first.
+ */
+typedef struct
+{
+    uint32_t magic;      /*< FSM_TRACE_MAGIC.*/
+    uint32_t version;    /*< FSM_TRACE_VERSION.*/
+    uint32_t recordSize; /*< sizeof( fsm_trace_record_t ).*/
+    uint32_t reserved;   /*< Zero.*/
+    uint64_t count;      /*< The number of records.*/
+    uint64_t dropped;    /*< The number of older records that had been overwritten.*/
+} fsm_trace_dump_header_t;
+
+/**
+ * @brief A trace ring with one writer at a time.
+ */
+typedef struct
+{
+    fsm_trace_record_t* records;   /*< The record storage.*/
+    size_t mask;                   /*< The capacity - 1.*/
+    FSM_ATOMIC( uint64_t ) head;   /*< The number of records ever written.*/
+} fsm_trace_ring_t;
+
+// The calling thread's ring (optional), shared by all source files.
+#ifdef FSM_IMPLEMENTATION
+FSM_THREAD_LOCAL fsm_trace_ring_t* fsmTraceRing = NULL;
+#else
+extern FSM_THREAD_LOCAL fsm_trace_ring_t* fsmTraceRing;
+#endif
+
+/**
+ * @brief Initialise a trace ring.
+ *
+ * @param ring The ring.
+ * @param records Storage for *capacity* records.
+ * @param capacity The number of records kept, a power of two.
+ * @return true The ring is ready for use.
+ * @return false The capacity is not a power of two.
+ */
+static inline bool fsm_trace_init( fsm_trace_ring_t* ring, fsm_trace_record_t* records, size_t capacity )
+{
+    if( !capacity || ( capacity & ( capacity - 1 ) ) )
+    {
+        return false;
+    }
+    ring->records = records;
+    ring->mask = capacity - 1;
+    fsm_atomic_init( &ring->head, ( uint64_t )0 );
+    return true;
+}
+
+/**
+ * @brief Trace the state machines the calling thread handles events for, unless they have their own ring.
+ *
+ * @param ring The ring, written only by this thread (NULL to stop tracing).
+ */
+static inline void fsm_trace_set_thread_ring( fsm_trace_ring_t* ring )
+{
+    fsmTraceRing = ring;
+}
+
+/**
+ * @brief Append a record to a ring.
+ *
+ * @param ring The ring.
+ * @param record The record.
+ */
+static inline void fsm_trace_write( fsm_trace_ring_t* ring, const fsm_trace_record_t* record )
+{
+    // Only the writer changes head, a plain load and a release store publish the record.
+    uint64_t head = fsm_atomic_load( &ring->head, memory_order_relaxed );
+    ring->records[ head & ring->mask ] = *record;
+    fsm_atomic_store( &ring->head, head + 1, memory_order_release );
+}
+
+/**
+ * @brief Copy the most recent records of a ring, oldest first.
+ *
+ * @details Once the ring has wrapped the oldest record is in the slot the writer fills next, it may be torn
+ * and is dropped, so at most capacity - 1 records are copied.
+ *
+ * @param ring The ring.
+ * @param records Receives the records.
+ * @param max The most records to copy.
+ * @return The number of records copied.
+ */
+static inline size_t fsm_trace_snapshot( fsm_trace_ring_t* ring, fsm_trace_record_t* records, size_t max )
+{
+    uint64_t head = fsm_atomic_load( &ring->head, memory_order_acquire );
+    uint64_t available = ( head < ( uint64_t )ring->mask + 1 ) ? head : ( uint64_t )ring->mask + 1;
+    uint64_t count = ( available < max ) ? available : max;
+    uint64_t first = head - count;
+    for( uint64_t i = 0; i < count; ++i )
+    {
+        records[ i ] = ring->records[ ( first + i ) & ring->mask ];
+    }
+
+    // Drop the records the writer may have overwritten while they were copied. The fence orders the copies
+    // before the second load of head, and the writer stores record *end* (in the slot of end - capacity)
+    // before publishing it, so that one may be torn too.
+    fsm_atomic_thread_fence( memory_order_acquire );
+    uint64_t end = fsm_atomic_load( &ring->head, memory_order_relaxed );
+    uint64_t capacity = ( uint64_t )ring->mask + 1;
+    uint64_t overwritten = ( end - first + 1 > capacity ) ? ( end - first + 1 - capacity ) : 0;
+    if( overwritten >= count )
+    {
+        return 0;
+    }
+    for( uint64_t i = overwritten; i < count; ++i )
+    {
+        records[ i - overwritten ] = records[ i ];
+    }
+    return ( size_t )( count - overwritten );
+}
+
+/**
+ * @brief Write the records of a ring to a file for tools/fsm_trace_decode.c.
+ *
+ * @param ring The ring, best stopped (or owned by the calling thread).
+ * @param file A file open for binary writing.
+ * @return true The dump was written.
+ */
+static inline bool fsm_trace_dump( fsm_trace_ring_t* ring, FILE* file )
+{
+    uint64_t head = fsm_atomic_load( &ring->head, memory_order_acquire );
+    uint64_t capacity = ( uint64_t )ring->mask + 1;
+    uint64_t count = ( head < capacity ) ? head : capacity;
+    fsm_trace_dump_header_t header = { FSM_TRACE_MAGIC, FSM_TRACE_VERSION, ( uint32_t )sizeof( fsm_trace_record_t ), 0, count, head - count };
+    if( fwrite( &header, sizeof( header ), 1, file ) != 1 )
+    {
+        return false;
+    }
+
+    // The oldest records run to the end of the storage, the rest wrap to the start.
+    uint64_t first = ( head - count ) & ring->mask;
+    size_t toEnd = ( size_t )( ( count < ( capacity - first ) ) ? count : ( capacity - first ) );
+    size_t wrapped = ( size_t )count - toEnd;
+    return ( fwrite( &ring->records[ first ], sizeof( fsm_trace_record_t ), toEnd, file ) == toEnd ) &&
+           ( fwrite( ring->records, sizeof( fsm_trace_record_t ), wrapped, file ) == wrapped );
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,634 @@
+/*******************************************************************************
+MIT License
+
+Copyright (c) 2024 Julian Mitchell
+https://github.com/jupeos/fsm
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+
+#ifndef FINITE_STATE_MACHINE_VALIDATOR_H
+#define FINITE_STATE_MACHINE_VALIDATOR_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "finite_state_machine.h"
+#include "finite_state_machine_port.h"
+
+/**
+ * @file finite_state_machine_validator.h
+ * @author Julian Mitchell
+ * @date 25th Jan 2024
+ * @brief Check a large state graph in parallel before it is used.
+ *
+ * @details fsm_validate_graph() checks a table of states and reports, in table order:
+ * - transitions with a NULL next state, or leading to (or states nested in, FSM_ENABLE_HIERARCHY) a state not
+ *   in the table;
+ * - transitions that can never be taken as an earlier transition has the same event ID, see
+ *   fsm_transition_shadowed();
+ * - dead ends, states no transition (of their own or an enclosing state's) leads out of;
+ * - unreachable states, those no chain of transitions leads to from a start state (the enclosing states of
+ *   reachable states are reachable).
+ *
+ * The states are looked up by address in a hash table, the checks of each state are split between threads
+ * and the reachable states are found by a level synchronous breadth first search, levels with a large
+ * frontier being split between threads. A graph of 10^5 states is checked in a few milliseconds. The
+ * reachability found can be exported as a Graphviz DOT file with fsm_validate_write_dot().
+ *
+ * Requires POSIX threads, storage is allocated for the duration of the call.
+ *
+ * Example usage:
+ * @code
+ *    #include "finite_state_machine_validator.h"
+ *
+ *    size_t start = 0;
+ *    fsm_validate_diagnostic_t diagnostics[ 16 ];
+ *    fsm_validate_report_t report = { .diagnostics = diagnostics, .capacity = 16 };
+ *    if( fsm_validate_graph( states, NUM_STATES, &start, 1, 4, &report ) != 0 )
+ *    {
+ *        for( size_t i = 0; i < report.numDiagnostics && i < report.capacity; ++i )
+ *        {
+ *            printf( "state %zu: %s\n", diagnostics[ i ].state, fsm_validate_describe( diagnostics[ i ].kind ) );
+ *        }
+ *    }
+ * @endcode
+ */
+
+#ifndef FSM_VALIDATE_MIN_PARALLEL
+#define FSM_VALIDATE_MIN_PARALLEL 4096 /*< The fewest states a pass (or search level) is split between threads for. */
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief What is wrong.
+ */
+typedef enum
+{
+    FSM_VALIDATE_NULL_NEXT_STATE,  /*< A transition has no next state.*/
+    FSM_VALIDATE_FOREIGN_STATE,    /*< A transition leads to (or the state is nested in) a state not in the table.*/
+    FSM_VALIDATE_DUPLICATE_EVENT,  /*< A transition can never be taken, an earlier one has the same event ID.*/
+    FSM_VALIDATE_DEAD_END,         /*< No transition leads out of the state.*/
+    FSM_VALIDATE_UNREACHABLE,      /*< No chain of transitions leads to the state from a start state.*/
+    FSM_VALIDATE_NUM_KINDS,
+} fsm_validate_kind_t;
+
+/**
+ * @brief A problem found in a graph.
+ */
+typedef struct
+{
+    fsm_validate_kind_t kind; /*< What is wrong.*/
+    size_t state;             /*< The index of the state in the table.*/
+    size_t transition;        /*< The index of the transition in the state, SIZE_MAX for the state itself.*/
+} fsm_validate_diagnostic_t;
+
+/**
+ * @brief The result of validating a graph.
+ */
+typedef struct
+{
+    fsm_validate_diagnostic_t* diagnostics; /*< Receives the first *capacity* diagnostics (optional, set by the caller).*/
+    size_t capacity;                        /*< The number of entries in diagnostics (set by the caller).*/
+    bool* reachable;                        /*< Receives whether each table state is reachable (optional, set by the caller).*/
+    size_t numDiagnostics;                  /*< The number of diagnostics found, may be more than capacity.*/
+    size_t counts[ FSM_VALIDATE_NUM_KINDS ]; /*< The number of diagnostics of each kind.*/
+    size_t reachableStates;                 /*< The number of reachable states.*/
+} fsm_validate_report_t;
+
+/**
+ * @brief A slot of the address hash table.
+ */
+typedef struct
+{
+    const state_t* state; /*< The state, NULL for a free slot.*/
+    size_t index;         /*< Its index in the table.*/
+} fsm_validate_slot_t;
+
+// Codes stored in targets[] and parents[] for what is not an index.
+#define FSM_VALIDATE_NONE    SIZE_MAX         /*< A NULL next state or no enclosing state.*/
+#define FSM_VALIDATE_FOREIGN ( SIZE_MAX - 1 ) /*< A state not in the table.*/
+
+/**
+ * @brief Working storage of fsm_validate_graph().
+ */
+typedef struct
+{
+    state_t* const* states;         /*< The state table.*/
+    size_t numStates;               /*< The number of states in the table.*/
+    fsm_validate_slot_t* slots;     /*< The states by address, open addressing.*/
+    size_t mask;                    /*< The number of slots - 1.*/
+    size_t* first;                  /*< The position of each state's first transition in targets[], then the total.*/
+    size_t* targets;                /*< The table index of each transition's next state (or FSM_VALIDATE_NONE/FOREIGN).*/
+    bool* shadowed;                 /*< The transition can never be taken.*/
+    size_t* parents;                /*< The table index of each state's enclosing state (or FSM_VALIDATE_NONE/FOREIGN).*/
+    FSM_ATOMIC( bool ) * visited;   /*< The state has been reached.*/
+    size_t* frontier;               /*< The states reached by the last search level.*/
+    size_t* next;                   /*< The states reached by the current search level.*/
+    FSM_ATOMIC( size_t ) numNext;   /*< The number of entries in next.*/
+} fsm_validator_t;
+
+/**
+ * @brief The share of a pass given to one thread.
+ */
+typedef struct
+{
+    fsm_validator_t* validator;                                         /*< The validator.*/
+    void ( *pass )( fsm_validator_t* validator, size_t begin, size_t end ); /*< The pass.*/
+    size_t begin;                                                       /*< The first item of the share.*/
+    size_t end;                                                         /*< One past the last item of the share.*/
+    pthread_t thread;                                                   /*< The thread.*/
+} fsm_validate_share_t;
+
+/**
+ * @brief Get a short description of a kind of diagnostic.
+ */
+static inline const char* fsm_validate_describe( fsm_validate_kind_t kind )
+{
+    static const char* const descriptions[ FSM_VALIDATE_NUM_KINDS ] = {
+        "transition has no next state",
+        "state not in the table",
+        "transition shadowed by an earlier one for the same event",
+        "dead end",
+        "unreachable",
+    };
+    return ( ( size_t )kind < FSM_VALIDATE_NUM_KINDS ) ? descriptions[ kind ] : "unknown";
+}
+
+/**
+ * @brief Hash a state address to a slot.
+ */
+static inline size_t fsm_validate_hash( const fsm_validator_t* validator, const state_t* state )
+{
+    uint64_t hash = ( uint64_t )( uintptr_t )state;
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    return ( size_t )hash & validator->mask;
+}
+
+/**
+ * @brief Find a state in the table.
+ *
+ * @return The index of the state, FSM_VALIDATE_NONE for NULL or FSM_VALIDATE_FOREIGN if it is not in the table.
+ */
+static inline size_t fsm_validate_index_of( const fsm_validator_t* validator, const state_t* state )
+{
+    if( !state )
+    {
+        return FSM_VALIDATE_NONE;
+    }
+    for( size_t slot = fsm_validate_hash( validator, state );; slot = ( slot + 1 ) & validator->mask )
+    {
+        if( validator->slots[ slot ].state == state )
+        {
+            return validator->slots[ slot ].index;
+        }
+        if( !validator->slots[ slot ].state )
+        {
+            return FSM_VALIDATE_FOREIGN;
+        }
+    }
+}
+
+/**
+ * @brief Free the working storage of a validator.
+ */
+static inline void fsm_validator_free( fsm_validator_t* validator )
+{
+    free( validator->slots );
+    free( validator->first );
+    free( validator->targets );
+    free( validator->shadowed );
+    free( validator->parents );
+    free( ( void* )validator->visited );
+    free( validator->frontier );
+    free( validator->next );
+}
+
+/**
+ * @brief Allocate the working storage of a validator and index the states by address.
+ *
+ * @return true The validator is ready.
+ * @return false Out of memory, fsm_validator_free() frees what was allocated (it must be called either way).
+ */
+static inline bool fsm_validator_init( fsm_validator_t* validator, state_t* const* states, size_t numStates )
+{
+    size_t numSlots = 16;
+    while( numSlots < ( numStates * 2 ) )
+    {
+        numSlots *= 2;
+    }
+
+    validator->states = states;
+    validator->numStates = numStates;
+    validator->mask = numSlots - 1;
+    validator->targets = NULL;
+    validator->shadowed = NULL;
+    validator->parents = NULL;
+    validator->visited = NULL;
+    validator->frontier = NULL;
+    validator->next = NULL;
+    fsm_atomic_init( &validator->numNext, ( size_t )0 );
+    validator->slots = ( fsm_validate_slot_t* )calloc( numSlots, sizeof( fsm_validate_slot_t ) );
+    validator->first = ( size_t* )malloc( ( numStates + 1 ) * sizeof( size_t ) );
+    if( !validator->slots || !validator->first )
+    {
+        return false;
+    }
+
+    validator->first[ 0 ] = 0;
+    for( size_t i = 0; i < numStates; ++i )
+    {
+        validator->first[ i + 1 ] = validator->first[ i ] + states[ i ]->numTransitions;
+        // A state listed twice keeps its first index.
+        size_t slot = fsm_validate_hash( validator, states[ i ] );
+        while( validator->slots[ slot ].state && ( validator->slots[ slot ].state != states[ i ] ) )
+        {
+            slot = ( slot + 1 ) & validator->mask;
+        }
+        if( !validator->slots[ slot ].state )
+        {
+            validator->slots[ slot ].state = states[ i ];
+            validator->slots[ slot ].index = i;
+        }
+    }
+
+    size_t numTransitions = validator->first[ numStates ];
+    validator->targets = ( size_t* )malloc( ( numTransitions + 1 ) * sizeof( size_t ) );
+    validator->shadowed = ( bool* )malloc( ( numTransitions + 1 ) * sizeof( bool ) );
+    validator->parents = ( size_t* )malloc( ( numStates + 1 ) * sizeof( size_t ) );
+    validator->visited = ( FSM_ATOMIC( bool )* )malloc( ( numStates + 1 ) * sizeof( FSM_ATOMIC( bool ) ) );
+    validator->frontier = ( size_t* )malloc( ( numStates + 1 ) * sizeof( size_t ) );
+    validator->next = ( size_t* )malloc( ( numStates + 1 ) * sizeof( size_t ) );
+    if( !validator->targets || !validator->shadowed || !validator->parents || !validator->visited || !validator->frontier || !validator->next )
+    {
+        return false;
+    }
+    for( size_t i = 0; i < numStates; ++i )
+    {
+        fsm_atomic_init( &validator->visited[ i ], false );
+    }
+    return true;
+}
+
+/**
+ * @brief Resolve the next states and enclosing states of a range of states and find their shadowed transitions.
+ */
+static inline void fsm_validate_check( fsm_validator_t* validator, size_t begin, size_t end )
+{
+    for( size_t i = begin; i < end; ++i )
+    {
+        const state_t* state = validator->states[ i ];
+        const size_t first = validator->first[ i ];
+        for( size_t t = 0; t < state->numTransitions; ++t )
+        {
+            validator->targets[ first + t ] = fsm_validate_index_of( validator, state->transitions[ t ].nextState );
+            validator->shadowed[ first + t ] = fsm_transition_shadowed( state, t );
+        }
+#if FSM_ENABLE_HIERARCHY
+        validator->parents[ i ] = fsm_validate_index_of( validator, state->parent );
+#else
+        validator->parents[ i ] = FSM_VALIDATE_NONE;
+#endif
+    }
+}
+
+/**
+ * @brief Mark a state reached, adding it to the next search level if it was not already.
+ */
+static inline void fsm_validate_visit( fsm_validator_t* validator, size_t index )
+{
+    if( ( index < validator->numStates ) && !fsm_atomic_exchange( &validator->visited[ index ], true, memory_order_relaxed ) )
+    {
+        validator->next[ fsm_atomic_fetch_add( &validator->numNext, ( size_t )1, memory_order_relaxed ) ] = index;
+    }
+}
+
+/**
+ * @brief Reach the states a range of the frontier leads to.
+ */
+static inline void fsm_validate_expand( fsm_validator_t* validator, size_t begin, size_t end )
+{
+    for( size_t i = begin; i < end; ++i )
+    {
+        const size_t index = validator->frontier[ i ];
+        // An enclosing state handles the events its nested states do not.
+        fsm_validate_visit( validator, validator->parents[ index ] );
+        for( size_t t = validator->first[ index ]; t < validator->first[ index + 1 ]; ++t )
+        {
+            if( !validator->shadowed[ t ] )
+            {
+                fsm_validate_visit( validator, validator->targets[ t ] );
+            }
+        }
+    }
+}
+
+/**
+ * @brief Thread entry of a share of a pass.
+ */
+static inline void* fsm_validate_worker( void* argument )
+{
+    fsm_validate_share_t* share = ( fsm_validate_share_t* )argument;
+    share->pass( share->validator, share->begin, share->end );
+    return NULL;
+}
+
+/**
+ * @brief Perform a pass over a number of items, split between threads if there are enough items.
+ *
+ * @details The calling thread performs the first share, and any share a thread could not be started for.
+ */
+static inline void fsm_validate_parallel( fsm_validator_t* validator,
+                                          void ( *pass )( fsm_validator_t* validator, size_t begin, size_t end ),
+                                          size_t count,
+                                          fsm_validate_share_t* shares,
+                                          size_t numThreads )
+{
+    if( ( numThreads < 2 ) || ( count < FSM_VALIDATE_MIN_PARALLEL ) )
+    {
+        pass( validator, 0, count );
+        return;
+    }
+
+    bool* started = ( bool* )calloc( numThreads, sizeof( bool ) );
+    for( size_t i = 0; i < numThreads; ++i )
+    {
+        shares[ i ].validator = validator;
+        shares[ i ].pass = pass;
+        shares[ i ].begin = ( count * i ) / numThreads;
+        shares[ i ].end = ( count * ( i + 1 ) ) / numThreads;
+        if( ( i > 0 ) && started )
+        {
+            started[ i ] = pthread_create( &shares[ i ].thread, NULL, fsm_validate_worker, &shares[ i ] ) == 0;
+        }
+    }
+    for( size_t i = 0; i < numThreads; ++i )
+    {
+        if( !started || !started[ i ] )
+        {
+            pass( validator, shares[ i ].begin, shares[ i ].end );
+        }
+    }
+    for( size_t i = 1; started && ( i < numThreads ); ++i )
+    {
+        if( started[ i ] )
+        {
+            pthread_join( shares[ i ].thread, NULL );
+        }
+    }
+    free( started );
+}
+
+/**
+ * @brief Find the states reachable from the start states, visited[] marks them.
+ *
+ * @return The number of reachable states or SIZE_MAX if a start state is not in the table.
+ */
+static inline size_t fsm_validate_search( fsm_validator_t* validator, const size_t* starts, size_t numStarts, fsm_validate_share_t* shares, size_t numThreads )
+{
+    for( size_t i = 0; i < ( starts ? numStarts : validator->numStates ); ++i )
+    {
+        size_t start = starts ? starts[ i ] : i;
+        if( start >= validator->numStates )
+        {
+            return SIZE_MAX;
+        }
+        fsm_validate_visit( validator, start );
+    }
+
+    size_t reached = 0;
+    size_t count = fsm_atomic_load( &validator->numNext, memory_order_relaxed );
+    while( count )
+    {
+        reached += count;
+        size_t* level = validator->next;
+        validator->next = validator->frontier;
+        validator->frontier = level;
+        fsm_atomic_store( &validator->numNext, ( size_t )0, memory_order_relaxed );
+        fsm_validate_parallel( validator, fsm_validate_expand, count, shares, numThreads );
+        count = fsm_atomic_load( &validator->numNext, memory_order_relaxed );
+    }
+    return reached;
+}
+
+/**
+ * @brief Check whether any transition of a state, or of the states enclosing it, leads out of it.
+ */
+static inline bool fsm_validate_dead_end( const fsm_validator_t* validator, size_t index )
+{
+    // The depth is bounded in case the enclosing states form a cycle.
+    size_t owner = index;
+    for( size_t depth = 0; ( owner < validator->numStates ) && ( depth <= validator->numStates ); ++depth )
+    {
+        for( size_t t = validator->first[ owner ]; t < validator->first[ owner + 1 ]; ++t )
+        {
+            if( !validator->shadowed[ t ] && ( validator->targets[ t ] != index ) && ( validator->targets[ t ] != FSM_VALIDATE_NONE ) )
+            {
+                return false;
+            }
+        }
+        owner = validator->parents[ owner ];
+    }
+    return true;
+}
+
+/**
+ * @brief Add a diagnostic to a report.
+ */
+static inline void fsm_validate_report( fsm_validate_report_t* report, fsm_validate_kind_t kind, size_t state, size_t transition )
+{
+    if( report->diagnostics && ( report->numDiagnostics < report->capacity ) )
+    {
+        fsm_validate_diagnostic_t* diagnostic = &report->diagnostics[ report->numDiagnostics ];
+        diagnostic->kind = kind;
+        diagnostic->state = state;
+        diagnostic->transition = transition;
+    }
+    ++report->numDiagnostics;
+    ++report->counts[ kind ];
+}
+
+/**
+ * @brief Report the problems found, in table order.
+ */
+static inline void fsm_validate_collect( const fsm_validator_t* validator, fsm_validate_report_t* report )
+{
+    for( size_t i = 0; i < validator->numStates; ++i )
+    {
+        const bool reachable = fsm_atomic_load( &validator->visited[ i ], memory_order_relaxed );
+        if( report->reachable )
+        {
+            report->reachable[ i ] = reachable;
+        }
+        if( validator->parents[ i ] == FSM_VALIDATE_FOREIGN )
+        {
+            fsm_validate_report( report, FSM_VALIDATE_FOREIGN_STATE, i, SIZE_MAX );
+        }
+        for( size_t t = 0; t < validator->states[ i ]->numTransitions; ++t )
+        {
+            const size_t position = validator->first[ i ] + t;
+            if( validator->targets[ position ] == FSM_VALIDATE_NONE )
+            {
+                fsm_validate_report( report, FSM_VALIDATE_NULL_NEXT_STATE, i, t );
+            }
+            else if( validator->targets[ position ] == FSM_VALIDATE_FOREIGN )
+            {
+                fsm_validate_report( report, FSM_VALIDATE_FOREIGN_STATE, i, t );
+            }
+            if( validator->shadowed[ position ] )
+            {
+                fsm_validate_report( report, FSM_VALIDATE_DUPLICATE_EVENT, i, t );
+            }
+        }
+        if( fsm_validate_dead_end( validator, i ) )
+        {
+            fsm_validate_report( report, FSM_VALIDATE_DEAD_END, i, SIZE_MAX );
+        }
+        if( !reachable )
+        {
+            fsm_validate_report( report, FSM_VALIDATE_UNREACHABLE, i, SIZE_MAX );
+        }
+    }
+}
+
+/**
+ * @brief Validate a table of states.
+ *
+ * @details Every state a transition of the table leads to should itself be in the table. Dead ends are reported
+ * for every state, final states included. Shadowed transitions are not followed when finding reachable states.
+ *
+ * @param states The state table.
+ * @param numStates The number of states.
+ * @param starts The indices of the states instances start in (NULL for all of them).
+ * @param numStarts The number of start states.
+ * @param numThreads The number of threads to split the work between, including the calling thread.
+ * @param report Receives the diagnostics (optional).
+ * @return The number of diagnostics, 0 for a sound graph, or SIZE_MAX if out of memory or a start state is not
+ * in the table.
+ */
+static inline size_t fsm_validate_graph( state_t* const* states, size_t numStates, const size_t* starts, size_t numStarts, size_t numThreads, fsm_validate_report_t* report )
+{
+    fsm_validate_report_t local = { NULL, 0, NULL, 0, { 0 }, 0 };
+    if( !report )
+    {
+        report = &local;
+    }
+    report->numDiagnostics = 0;
+    report->reachableStates = 0;
+    for( size_t i = 0; i < FSM_VALIDATE_NUM_KINDS; ++i )
+    {
+        report->counts[ i ] = 0;
+    }
+
+    size_t retVal = SIZE_MAX;
+    fsm_validator_t validator;
+    fsm_validate_share_t* shares = ( fsm_validate_share_t* )calloc( numThreads ? numThreads : 1, sizeof( fsm_validate_share_t ) );
+    if( shares )
+    {
+        // The validator's storage is only valid once initialisation has been attempted.
+        if( fsm_validator_init( &validator, states, numStates ) )
+        {
+            fsm_validate_parallel( &validator, fsm_validate_check, numStates, shares, numThreads );
+            size_t reached = fsm_validate_search( &validator, starts, numStarts, shares, numThreads );
+            if( reached != SIZE_MAX )
+            {
+                report->reachableStates = reached;
+                fsm_validate_collect( &validator, report );
+                retVal = report->numDiagnostics;
+            }
+        }
+        fsm_validator_free( &validator );
+    }
+    free( shares );
+    return retVal;
+}
+
+/**
+ * @brief Write a table of states as a Graphviz DOT graph.
+ *
+ * @details Each state is a node labelled with its index and data, each transition an edge labelled with its
+ * event ID. Shadowed transitions are dotted, transitions to no state or to a state not in the table lead to
+ * a red node, enclosing states are linked to the states nested in them by a dashed edge and with
+ * *reachable* unreachable states are grey.
+ *
+ * @param states The state table.
+ * @param numStates The number of states.
+ * @param reachable Whether each state is reachable, see fsm_validate_report_t (optional).
+ * @param file The file to write to.
+ * @return true The graph was written.
+ * @return false Out of memory or a write failed.
+ */
+static inline bool fsm_validate_write_dot( state_t* const* states, size_t numStates, const bool* reachable, FILE* file )
+{
+    fsm_validator_t validator;
+    bool retVal = fsm_validator_init( &validator, states, numStates ) && ( fprintf( file, "digraph fsm {\n" ) > 0 );
+    if( retVal )
+    {
+        fsm_validate_check( &validator, 0, numStates );
+        retVal = fprintf( file, "  invalid [label=\"invalid\", shape=box, color=red];\n" ) > 0;
+    }
+    for( size_t i = 0; retVal && ( i < numStates ); ++i )
+    {
+        const state_t* state = states[ i ];
+        retVal = fprintf( file, "  s%zu [label=\"%zu\\ndata %lld\"%s];\n", i, i, ( long long )state->data,
+                          ( reachable && !reachable[ i ] ) ? ", color=grey, fontcolor=grey" : "" ) > 0;
+        if( retVal && ( validator.parents[ i ] != FSM_VALIDATE_NONE ) )
+        {
+            if( validator.parents[ i ] == FSM_VALIDATE_FOREIGN )
+            {
+                retVal = fprintf( file, "  invalid -> s%zu [style=dashed, arrowhead=none];\n", i ) > 0;
+            }
+            else
+            {
+                retVal = fprintf( file, "  s%zu -> s%zu [style=dashed, arrowhead=none];\n", validator.parents[ i ], i ) > 0;
+            }
+        }
+        for( size_t t = 0; retVal && ( t < state->numTransitions ); ++t )
+        {
+            const size_t target = validator.targets[ validator.first[ i ] + t ];
+            const char* style = validator.shadowed[ validator.first[ i ] + t ] ? ", style=dotted" : "";
+            if( target < numStates )
+            {
+                retVal = fprintf( file, "  s%zu -> s%zu [label=\"%lld\"%s];\n", i, target, ( long long )state->transitions[ t ].eventID, style ) > 0;
+            }
+            else
+            {
+                retVal = fprintf( file, "  s%zu -> invalid [label=\"%lld\", color=red%s];\n", i, ( long long )state->transitions[ t ].eventID, style ) > 0;
+            }
+        }
+    }
+    retVal = retVal && ( fprintf( file, "}\n" ) > 0 );
+    fsm_validator_free( &validator );
+    return retVal;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // FINITE_STATE_MACHINE_VALIDATOR_H
@@ -0,0 +1,229 @@
+/*******************************************************************************
+MIT License
+
+Copyright (c) 2024 Julian Mitchell
+https://github.com/jupeos/fsm
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+
+/**
+ * @file fsm_replay.c
+ * @author Julian Mitchell
+ * @date 25th Jan 2024
+ * @brief Replay a trace dump into the graph of a binary image and report throughput and latency.
+ *
+ * @details The graph is rebuilt from an image written by fsm_image_write() without its callbacks, so guards
+ * pass and actions do nothing; events after which a state machine is not in the recorded state are counted
+ * as mismatches (a guard that failed while recording shows up this way). Each recorded instance gets a state
+ * machine of its own, started in the state it was first recorded in. The dump must have been written on a
+ * machine with the same byte order. Default transitions (SM_DEFAULT_TRANSITION) are taken for events a state
+ * has no transition for, as when the dump was recorded with FSM_ENABLE_EVENT_FILTER.
+ *
+ * Build and run (from the repository root):
+ * @code
+ *    cc -O2 -I. tools/fsm_replay.c -o fsm_replay -lpthread
+ *    ./fsm_replay door.fsm trace.bin
+ *    ./fsm_replay --threads 4 --batch 16 --repeat 10 door.fsm trace.bin
+ * @endcode
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+// Default transitions in the image are taken as they were while recording.
+#define FSM_ENABLE_EVENT_FILTER 1
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "finite_state_machine_builder.h"
+#include "finite_state_machine_image.h"
+#include "finite_state_machine_replay.h"
+
+// Callbacks are not loaded, any callback ID is accepted.
+static const fsm_image_registry_t anyCallbacks = { NULL, UINT16_MAX + 1u, NULL, UINT16_MAX + 1u };
+
+static fsm_graph_t* load_graph( const fsm_image_header_t* image )
+{
+    const fsm_image_state_t* states = fsm_image_states( image );
+    const fsm_image_transition_t* transitions = fsm_image_transitions( image );
+
+    fsm_builder_t builder;
+    fsm_builder_init( &builder );
+    for( uint32_t s = 0; s < image->numStates; ++s )
+    {
+        fsm_builder_add_state( &builder, ( data_t )states[ s ].data, NULL, NULL );
+    }
+    for( uint32_t s = 0; s < image->numStates; ++s )
+    {
+        for( uint32_t t = 0; t < states[ s ].numTransitions; ++t )
+        {
+            const fsm_image_transition_t* transition = &transitions[ states[ s ].firstTransition + t ];
+            fsm_builder_add_transition( &builder, s, ( event_id_t )transition->eventID, transition->nextState, NULL, NULL );
+        }
+    }
+    fsm_graph_t* graph = fsm_builder_build( &builder );
+    fsm_builder_free( &builder );
+    return graph;
+}
+
+static void print_result( const fsm_replay_result_t* result )
+{
+    printf( "%llu events, %llu transitions, %llu mismatches\n", ( unsigned long long )result->events, ( unsigned long long )result->transitions,
+            ( unsigned long long )result->mismatches );
+    printf( "%.3f ms, %.0f events/s\n", ( double )result->elapsedNs / 1e6, result->eventsPerSecond );
+    printf( "latency p50 %llu ns, p99 %llu ns, p99.9 %llu ns\n", ( unsigned long long )fsm_replay_percentile( result, 0.5 ),
+            ( unsigned long long )fsm_replay_percentile( result, 0.99 ), ( unsigned long long )fsm_replay_percentile( result, 0.999 ) );
+    for( size_t b = 0; b < FSM_REPLAY_BUCKETS; ++b )
+    {
+        if( result->histogram[ b ] )
+        {
+            printf( "  < %10llu ns  %llu\n", ( unsigned long long )( ( uint64_t )2 << b ), ( unsigned long long )result->histogram[ b ] );
+        }
+    }
+}
+
+static void print_states( const fsm_graph_t* graph, const state_machine_t* machines, size_t numMachines )
+{
+    printf( "final states:\n" );
+    for( size_t s = 0; s < graph->numStates; ++s )
+    {
+        size_t count = 0;
+        for( size_t i = 0; i < numMachines; ++i )
+        {
+            count += ( machines[ i ].currentState == &graph->states[ s ] ) ? 1 : 0;
+        }
+        if( count )
+        {
+            printf( "  state %-6d %zu\n", ( int )graph->states[ s ].data, count );
+        }
+    }
+}
+
+static int replay( const fsm_graph_t* graph, const fsm_replay_t* events, size_t threads, size_t batch, size_t repeat )
+{
+    state_t** states = ( state_t** )malloc( ( graph->numStates + 1 ) * sizeof( state_t* ) );
+    state_machine_t* machines = ( state_machine_t* )calloc( events->numInstances + 1, sizeof( state_machine_t ) );
+    if( !states || !machines )
+    {
+        fprintf( stderr, "out of memory\n" );
+        free( states );
+        free( machines );
+        return 1;
+    }
+    for( size_t s = 0; s < graph->numStates; ++s )
+    {
+        states[ s ] = &graph->states[ s ];
+    }
+
+    int retVal = 0;
+    for( size_t pass = 0; ( retVal == 0 ) && ( pass < repeat ); ++pass )
+    {
+        fsm_replay_result_t result;
+        if( !fsm_replay_reset( events, machines, states, graph->numStates ) )
+        {
+            fprintf( stderr, "an instance starts in a state that is not in the graph\n" );
+            retVal = 1;
+        }
+        else if( !fsm_replay_run( events, machines, threads, batch, &result ) )
+        {
+            fprintf( stderr, "out of memory\n" );
+            retVal = 1;
+        }
+        else
+        {
+            if( repeat > 1 )
+            {
+                printf( "pass %zu: ", pass + 1 );
+            }
+            print_result( &result );
+        }
+    }
+    if( retVal == 0 )
+    {
+        print_states( graph, machines, events->numInstances );
+    }
+    free( states );
+    free( machines );
+    return retVal;
+}
+
+int main( int argc, char** argv )
+{
+    size_t threads = 1;
+    size_t batch = 1;
+    size_t repeat = 1;
+    const char* paths[ 2 ] = { NULL, NULL };
+    size_t numPaths = 0;
+    bool valid = true;
+    for( int i = 1; i < argc; ++i )
+    {
+        size_t* option = !strcmp( argv[ i ], "--threads" ) ? &threads : !strcmp( argv[ i ], "--batch" ) ? &batch : !strcmp( argv[ i ], "--repeat" ) ? &repeat : NULL;
+        if( option && ( i + 1 < argc ) )
+        {
+            *option = ( size_t )strtoul( argv[ ++i ], NULL, 10 );
+        }
+        else if( !option && ( numPaths < 2 ) )
+        {
+            paths[ numPaths++ ] = argv[ i ];
+        }
+        else
+        {
+            valid = false;
+        }
+    }
+
+    if( !valid || ( numPaths != 2 ) || !threads || !batch || !repeat )
+    {
+        fprintf( stderr, "usage: %s [--threads N] [--batch N] [--repeat N] graph.fsm trace.bin\n", argv[ 0 ] );
+        return 2;
+    }
+
+    fsm_image_file_t image;
+    if( !fsm_image_open( &image, paths[ 0 ] ) || !fsm_image_validate( image.image, &anyCallbacks ) )
+    {
+        fprintf( stderr, "%s: not a valid image (or written with another version or byte order)\n", paths[ 0 ] );
+        fsm_image_close( &image );
+        return 1;
+    }
+    fsm_graph_t* graph = load_graph( image.image );
+    fsm_image_close( &image );
+
+    fsm_replay_t events;
+    int retVal = 1;
+    if( !graph )
+    {
+        fprintf( stderr, "out of memory\n" );
+    }
+    else if( !fsm_replay_open( &events, paths[ 1 ] ) )
+    {
+        fprintf( stderr, "%s: not a trace dump (or written with another version or byte order)\n", paths[ 1 ] );
+    }
+    else
+    {
+        printf( "%zu records, %zu events, %zu instances\n", events.numRecords, events.numEvents, events.numInstances );
+        retVal = replay( graph, &events, threads, batch, repeat );
+        fsm_replay_close( &events );
+    }
+    fsm_graph_free( graph );
+    return retVal;
+}
@@ -0,0 +1,150 @@
+/*******************************************************************************
+MIT License
+
+Copyright (c) 2024 Julian Mitchell
+https://github.com/jupeos/fsm
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+
+/**
+ * @file fsm_trace_decode.c
+ * @author Julian Mitchell
+ * @date 25th Jan 2024
+ * @brief Print a trace dump written by fsm_trace_dump() as text or JSON lines.
+ *
+ * @details Each record is printed on its own line, oldest first. Time stamps are fsm_cycles() readings of the
+ * machine that wrote the dump and are printed relative to the first record. The dump must have been written
+ * on a machine with the same byte order.
+ *
+ * Build and run (from the repository root):
+ * @code
+ *    cc -O2 -I. tools/fsm_trace_decode.c -o fsm_trace_decode
+ *    ./fsm_trace_decode trace.bin
+ *    ./fsm_trace_decode --json trace.bin > trace.jsonl
+ * @endcode
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "finite_state_machine_trace.h"
+
+static const char* guard_name( uint8_t flags )
+{
+    if( !( flags & FSM_TRACE_GUARD ) )
+    {
+        return "none";
+    }
+    return ( flags & FSM_TRACE_PASSED ) ? "passed" : "failed";
+}
+
+static void print_record( const fsm_trace_record_t* record, uint64_t start, bool json )
+{
+    if( json )
+    {
+        printf( "{\"time\":%llu,\"instance\":\"0x%llx\",\"source\":%d,\"event\":%d,", ( unsigned long long )( record->timestamp - start ),
+                ( unsigned long long )record->instance, ( int )record->source, ( int )record->eventID );
+        if( record->transition == FSM_TRACE_NO_TRANSITION )
+        {
+            printf( "\"transition\":null," );
+        }
+        else
+        {
+            printf( "\"transition\":%u,", ( unsigned )record->transition );
+        }
+        printf( "\"guard\":\"%s\",\"taken\":%s,\"destination\":%d}\n", guard_name( record->flags ), ( record->flags & FSM_TRACE_TAKEN ) ? "true" : "false",
+                ( int )record->destination );
+    }
+    else if( record->transition == FSM_TRACE_NO_TRANSITION )
+    {
+        printf( "%14llu  0x%-14llx  state %-6d event %-6d unmatched\n", ( unsigned long long )( record->timestamp - start ),
+                ( unsigned long long )record->instance, ( int )record->source, ( int )record->eventID );
+    }
+    else
+    {
+        printf( "%14llu  0x%-14llx  state %-6d event %-6d transition %-4u guard %-6s %s %d\n", ( unsigned long long )( record->timestamp - start ),
+                ( unsigned long long )record->instance, ( int )record->source, ( int )record->eventID, ( unsigned )record->transition,
+                guard_name( record->flags ), ( record->flags & FSM_TRACE_TAKEN ) ? "->" : "stays", ( int )record->destination );
+    }
+}
+
+int main( int argc, char** argv )
+{
+    bool json = false;
+    const char* path = NULL;
+    for( int i = 1; i < argc; ++i )
+    {
+        if( !strcmp( argv[ i ], "--json" ) )
+        {
+            json = true;
+        }
+        else
+        {
+            path = argv[ i ];
+        }
+    }
+
+    if( !path )
+    {
+        fprintf( stderr, "usage: %s [--json] trace.bin\n", argv[ 0 ] );
+        return 2;
+    }
+
+    FILE* file = fopen( path, "rb" );
+    if( !file )
+    {
+        perror( path );
+        return 1;
+    }
+
+    fsm_trace_dump_header_t header;
+    if( ( fread( &header, sizeof( header ), 1, file ) != 1 ) || ( header.magic != FSM_TRACE_MAGIC ) || ( header.version != FSM_TRACE_VERSION ) ||
+        ( header.recordSize != sizeof( fsm_trace_record_t ) ) )
+    {
+        fprintf( stderr, "%s: not a trace dump (or written with another version or byte order)\n", path );
+        fclose( file );
+        return 1;
+    }
+
+    if( !json )
+    {
+        printf( "%llu records, %llu older records overwritten\n", ( unsigned long long )header.count, ( unsigned long long )header.dropped );
+    }
+
+    fsm_trace_record_t record;
+    uint64_t start = 0;
+    uint64_t decoded = 0;
+    while( ( decoded < header.count ) && ( fread( &record, sizeof( record ), 1, file ) == 1 ) )
+    {
+        start = decoded ? start : record.timestamp;
+        print_record( &record, start, json );
+        ++decoded;
+    }
+    fclose( file );
+
+    if( decoded != header.count )
+    {
+        fprintf( stderr, "%s: truncated after %llu records\n", path, ( unsigned long long )decoded );
+        return 1;
+    }
+    return 0;
+}